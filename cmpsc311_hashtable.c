@@ -0,0 +1,601 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cmpsc311_hashtable.c
+//  Description    : This is an open addressing implementation of the generic
+//                   hash table.  The slots (index and block) sit in one flat
+//                   array, with a control byte per slot holding 7 bits of
+//                   the hash (or empty/deleted), so a lookup compares a
+//                   group of 16 control bytes at once and only touches the
+//                   slots whose bytes match.  The table doubles when 7/8
+//                   full.  It keeps the HTable and HtIterator layouts, so
+//                   libcrud's object store runs on it unchanged.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Sat May 27 14:31:08 PDT 2017
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Project Includes
+#include <cmpsc311_hashtable.h>
+#include <cmpsc311_log.h>
+#include <crud_rand.h>
+
+// Defines
+#define HT_GROUP_WIDTH 16            // Control bytes compared at once
+#define HT_CTRL_EMPTY ((int8_t)0x80) // Never used, ends a probe
+#define HT_CTRL_DELETED ((int8_t)0xfe) // Used, probes continue past it
+#define HT_MAX_LOAD(cap) ((cap) - (cap) / 8) // Used slots before the table grows
+#define HT_UNIT_TEST_KEYS 10000
+#define HT_UNIT_TEST_ITERATIONS 50000
+#define HT_BENCH_KEYS 50000
+#define HT_BENCH_BITS 8              // The width libcrud's object store asks for
+
+// Type definitions
+
+// A slot of the table
+typedef struct {
+	HtIndexValue  index; // The "key value" index of the object
+	void         *block; // The data block of the stored item
+} HtSlot;
+
+// The table storage (what HTable.hasHTable points at)
+typedef struct {
+	uint64_t  capacity; // The number of slots (a power of two)
+	uint64_t  growth;   // Empty slots that can be filled before the table grows
+	HtSlot   *slots;    // The slots, after the control bytes
+	int8_t    ctrl[];   // A control byte per slot, the first group repeated at the end
+} HtStore;
+
+// The libcrud (chained) table, renamed by the Makefile, for the benchmark
+int libcrud_initHashTable(HTable *ht, uint16_t bits);
+int libcrud_cleanupHashTable(HTable *ht);
+int libcrud_insertValueInHashTable(HTable *ht, HtIndexValue idx, void *blk);
+void *libcrud_findValueInHashTable(HTable *ht, HtIndexValue idx);
+void *libcrud_deleteValueFromHashTable(HTable *ht, HtIndexValue idx);
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_hash
+// Description  : Hash an index value (object ids are dense, so mix them well)
+//
+// Inputs       : idx - the index value
+// Outputs      : the hash (the low 7 bits go in the control byte)
+
+uint64_t ht_hash(HtIndexValue idx) {
+	uint64_t h = idx;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (h);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_group_match
+// Description  : Find the control bytes of a group equal to a value
+//
+// Inputs       : ctrl - the first control byte of the group
+//                val - the value to match
+// Outputs      : a bit mask, bit i set if ctrl[i] matches
+
+uint32_t ht_group_match(const int8_t *ctrl, int8_t val) {
+#ifdef __SSE2__
+	__m128i grp = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8(val))));
+#else
+	uint32_t mask = 0;
+	int i;
+
+	for (i = 0; i < HT_GROUP_WIDTH; i++) {
+		if (ctrl[i] == val)
+			mask |= 1U << i;
+	}
+	return (mask);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_group_free
+// Description  : Find the empty or deleted control bytes of a group (the
+//                ones with the top bit set)
+//
+// Inputs       : ctrl - the first control byte of the group
+// Outputs      : a bit mask, bit i set if ctrl[i] is free
+
+uint32_t ht_group_free(const int8_t *ctrl) {
+#ifdef __SSE2__
+	return ((uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl)));
+#else
+	uint32_t mask = 0;
+	int i;
+
+	for (i = 0; i < HT_GROUP_WIDTH; i++) {
+		if (ctrl[i] < 0)
+			mask |= 1U << i;
+	}
+	return (mask);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_set_ctrl
+// Description  : Set the control byte of a slot, and its copy past the end
+//                if it is in the first group
+//
+// Inputs       : st - the table storage
+//                i - the slot
+//                val - the control byte
+// Outputs      : none
+
+void ht_set_ctrl(HtStore *st, uint64_t i, int8_t val) {
+	st->ctrl[i] = val;
+	st->ctrl[((i - HT_GROUP_WIDTH) & (st->capacity - 1)) + HT_GROUP_WIDTH] = val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_alloc
+// Description  : Allocate empty table storage
+//
+// Inputs       : capacity - the number of slots (a power of two, at least
+//                           a group)
+// Outputs      : the storage, or NULL if failure
+
+HtStore *ht_alloc(uint64_t capacity) {
+	uint64_t ctrl_bytes = (capacity + HT_GROUP_WIDTH + 15) & ~15ULL;
+	HtStore *st;
+
+	if ((st = malloc(sizeof(HtStore) + ctrl_bytes + capacity * sizeof(HtSlot))) == NULL)
+		return (NULL);
+	st->capacity = capacity;
+	st->growth = HT_MAX_LOAD(capacity);
+	st->slots = (HtSlot *)&st->ctrl[ctrl_bytes];
+	memset(st->ctrl, HT_CTRL_EMPTY, capacity + HT_GROUP_WIDTH);
+	return (st);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_find_slot
+// Description  : Find the slot holding an index value
+//
+// Inputs       : st - the table storage
+//                idx - the index value
+//                hash - its hash
+// Outputs      : the slot, or -1 if not in the table
+
+int64_t ht_find_slot(HtStore *st, HtIndexValue idx, uint64_t hash) {
+	uint64_t mask = st->capacity - 1, pos = (hash >> 7) & mask, step = 0, i;
+	uint32_t bits;
+
+	for (;;) {
+		for (bits = ht_group_match(&st->ctrl[pos], hash & 0x7f); bits; bits &= bits - 1) {
+			i = (pos + __builtin_ctz(bits)) & mask;
+			if (st->slots[i].index == idx)
+				return ((int64_t)i);
+		}
+
+		// An empty slot ends the probe, the value would have gone there
+		if (ht_group_match(&st->ctrl[pos], HT_CTRL_EMPTY))
+			return (-1);
+		step += HT_GROUP_WIDTH;
+		pos = (pos + step) & mask;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_find_free
+// Description  : Find the first free slot on the probe sequence of a hash
+//
+// Inputs       : st - the table storage
+//                hash - the hash
+// Outputs      : the slot
+
+uint64_t ht_find_free(HtStore *st, uint64_t hash) {
+	uint64_t mask = st->capacity - 1, pos = (hash >> 7) & mask, step = 0;
+	uint32_t bits;
+
+	while ((bits = ht_group_free(&st->ctrl[pos])) == 0) {
+		step += HT_GROUP_WIDTH;
+		pos = (pos + step) & mask;
+	}
+	return ((pos + __builtin_ctz(bits)) & mask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_resize
+// Description  : Move the table to new storage, doubling it unless clearing
+//                the deleted slots frees enough room
+//
+// Inputs       : ht - the hash table
+// Outputs      : 0 if successful, -1 if failure
+
+int ht_resize(HTable *ht) {
+	HtStore *old = (HtStore *)ht->hasHTable, *st;
+	uint64_t capacity = old->capacity, i, j;
+	uint64_t hash;
+
+	if (ht->elements >= HT_MAX_LOAD(capacity) / 2)
+		capacity *= 2;
+	if ((st = ht_alloc(capacity)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to grow hash table to %lu slots", capacity);
+		return (-1);
+	}
+
+	for (i = 0; i < old->capacity; i++) {
+		if (old->ctrl[i] >= 0) {
+			hash = ht_hash(old->slots[i].index);
+			j = ht_find_free(st, hash);
+			ht_set_ctrl(st, j, hash & 0x7f);
+			st->slots[j] = old->slots[i];
+		}
+	}
+	st->growth -= ht->elements;
+
+	free(old);
+	ht->hasHTable = (HtEntryData **)st;
+	ht->htTableSize = (capacity > UINT16_MAX) ? UINT16_MAX : capacity;
+	return (0);
+}
+
+//
+// Hashtable Interface
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initHashTable
+// Description  : Initialize the hash table to 2^(bits) slots (it grows as
+//                needed, so this is only the starting size)
+//
+// Inputs       : ht - the hash table
+//                bits - the bits of the starting size
+// Outputs      : 0 if successful, -1 if failure
+
+int initHashTable( HTable *ht, uint16_t bits ) {
+	uint64_t capacity = HT_GROUP_WIDTH;
+	HtStore *st;
+
+	while (capacity < (1ULL << ((bits < 24) ? bits : 24)))
+		capacity *= 2;
+	if ((st = ht_alloc(capacity)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Unable to allocate hash table of %lu slots", capacity);
+		return (-1);
+	}
+
+	ht->htTableSize = (capacity > UINT16_MAX) ? UINT16_MAX : capacity;
+	ht->elements = 0;
+	ht->hasHTable = (HtEntryData **)st;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cleanupHashTable
+// Description  : Cleanup the hash table (the blocks belong to the caller)
+//
+// Inputs       : ht - the hash table
+// Outputs      : 0 if successful, -1 if failure
+
+int cleanupHashTable( HTable *ht ) {
+	free(ht->hasHTable);
+	ht->hasHTable = NULL;
+	ht->htTableSize = 0;
+	ht->elements = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insertValueInHashTable
+// Description  : Insert a value into the hash table (an index inserted twice
+//                is held twice, as in a chained table, and found or deleted
+//                one entry at a time)
+//
+// Inputs       : ht - the hash table
+//                idx - the index value
+//                blk - the block to store
+// Outputs      : 0 if successful, -1 if failure
+
+int insertValueInHashTable( HTable *ht, HtIndexValue idx, void *blk ) {
+	HtStore *st = (HtStore *)ht->hasHTable;
+	uint64_t hash = ht_hash(idx), i;
+
+	// Grow (or clear the deleted slots) once the table is full
+	if (st->growth == 0) {
+		if (ht_resize(ht))
+			return (-1);
+		st = (HtStore *)ht->hasHTable;
+	}
+
+	i = ht_find_free(st, hash);
+	if (st->ctrl[i] == HT_CTRL_EMPTY)
+		st->growth--;
+	ht_set_ctrl(st, i, hash & 0x7f);
+	st->slots[i].index = idx;
+	st->slots[i].block = blk;
+	ht->elements++;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findValueInHashTable
+// Description  : Find the block for a particular index value in the table
+//
+// Inputs       : ht - the hash table
+//                idx - the index value
+// Outputs      : the block, or NULL if not found
+
+void * findValueInHashTable( HTable *ht, HtIndexValue idx ) {
+	HtStore *st = (HtStore *)ht->hasHTable;
+	int64_t i = ht_find_slot(st, idx, ht_hash(idx));
+
+	return ((i == -1) ? NULL : st->slots[i].block);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deleteValueFromHashTable
+// Description  : Delete a value from the hash table
+//
+// Inputs       : ht - the hash table
+//                idx - the index value
+// Outputs      : the block deleted, or NULL if not found
+
+void * deleteValueFromHashTable( HTable *ht, HtIndexValue idx ) {
+	HtStore *st = (HtStore *)ht->hasHTable;
+	uint64_t mask = st->capacity - 1;
+	uint32_t before, after;
+	int64_t i;
+
+	if ((i = ht_find_slot(st, idx, ht_hash(idx))) == -1)
+		return (NULL);
+
+	// If no group holding the slot was ever full, no probe went past it
+	// and it can be empty again, otherwise it has to stay in the way
+	before = ht_group_match(&st->ctrl[(i - HT_GROUP_WIDTH) & mask], HT_CTRL_EMPTY);
+	after = ht_group_match(&st->ctrl[i], HT_CTRL_EMPTY);
+	if (before && after && (__builtin_clz(before) - 16) + __builtin_ctz(after) < HT_GROUP_WIDTH) {
+		ht_set_ctrl(st, i, HT_CTRL_EMPTY);
+		st->growth++;
+	} else {
+		ht_set_ctrl(st, i, HT_CTRL_DELETED);
+	}
+	ht->elements--;
+	return (st->slots[i].block);
+}
+
+//
+// Iterator Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initHashTableIterator
+// Description  : Initialize an iterator (values may be deleted as they are
+//                returned, but an insert may reorder the table)
+//
+// Inputs       : ht - the hash table
+//                it - the iterator
+// Outputs      : 0 if successful, -1 if failure
+
+int initHashTableIterator( HTable *ht, HtIterator *it ) {
+	it->table = ht;
+	it->idx = 0;
+	it->ptr = NULL; // Holds the next slot to look at
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : iterateHashTable
+// Description  : Iterate through the hash table
+//
+// Inputs       : it - the iterator
+// Outputs      : the next value in the table, or NULL at the end
+
+void * iterateHashTable( HtIterator *it ) {
+	HtStore *st = (HtStore *)it->table->hasHTable;
+	uint64_t i;
+
+	if (st == NULL)
+		return (NULL);
+	for (i = (uintptr_t)it->ptr; i < st->capacity; i++) {
+		if (st->ctrl[i] >= 0) {
+			it->ptr = (HtEntryData *)(uintptr_t)(i + 1);
+			return (st->slots[i].block);
+		}
+	}
+	it->ptr = (HtEntryData *)(uintptr_t)i;
+	return (NULL);
+}
+
+//
+// Unit Testing
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_clock
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in ns
+
+uint64_t ht_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ht_bench
+// Description  : Time inserting dense object ids into a table, finding each
+//                (in random order), missing and deleting them
+//
+// Inputs       : name - the implementation name, for the log
+//                libcrud - 1 for the libcrud table, 0 for this one
+//                order - the random lookup order
+// Outputs      : 0 if successful, -1 if failure
+
+int ht_bench(const char *name, int libcrud, uint32_t *order) {
+	uint64_t start, ns[4];
+	HtIndexValue idx;
+	HTable ht;
+	int i, bad = 0;
+
+	if (libcrud ? libcrud_initHashTable(&ht, HT_BENCH_BITS) : initHashTable(&ht, HT_BENCH_BITS))
+		return (-1);
+
+	start = ht_clock();
+	for (i = 0; i < HT_BENCH_KEYS; i++) {
+		idx = 4096 + i;
+		if (libcrud)
+			libcrud_insertValueInHashTable(&ht, idx, &order[i]);
+		else
+			insertValueInHashTable(&ht, idx, &order[i]);
+	}
+	ns[0] = ht_clock() - start;
+
+	start = ht_clock();
+	for (i = 0; i < HT_BENCH_KEYS; i++) {
+		idx = 4096 + order[i];
+		if ((libcrud ? libcrud_findValueInHashTable(&ht, idx) : findValueInHashTable(&ht, idx)) != &order[order[i]])
+			bad++;
+	}
+	ns[1] = ht_clock() - start;
+
+	start = ht_clock();
+	for (i = 0; i < HT_BENCH_KEYS; i++) {
+		idx = 4096 + HT_BENCH_KEYS + order[i];
+		if ((libcrud ? libcrud_findValueInHashTable(&ht, idx) : findValueInHashTable(&ht, idx)) != NULL)
+			bad++;
+	}
+	ns[2] = ht_clock() - start;
+
+	start = ht_clock();
+	for (i = 0; i < HT_BENCH_KEYS; i++) {
+		idx = 4096 + order[i];
+		if ((libcrud ? libcrud_deleteValueFromHashTable(&ht, idx) : deleteValueFromHashTable(&ht, idx)) == NULL)
+			bad++;
+	}
+	ns[3] = ht_clock() - start;
+
+	if (libcrud)
+		libcrud_cleanupHashTable(&ht);
+	else
+		cleanupHashTable(&ht);
+	if (bad) {
+		logMessage(LOG_ERROR_LEVEL, "HT_BENCH : %s table gave %d wrong results.", name, bad);
+		return (-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "HT_BENCH : %-12s %d keys, ns per insert %7.1f, hit %7.1f, miss %7.1f, delete %7.1f",
+		name, HT_BENCH_KEYS, (double)ns[0] / HT_BENCH_KEYS, (double)ns[1] / HT_BENCH_KEYS,
+		(double)ns[2] / HT_BENCH_KEYS, (double)ns[3] / HT_BENCH_KEYS);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashTableUnitTest
+// Description  : Check the table against a flat array through random
+//                inserts, finds and deletes (from a small start, so it grows
+//                and clears deleted slots), check iteration, then benchmark
+//                it against the libcrud chained table
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hashTableUnitTest( void ) {
+	static uint32_t values[HT_BENCH_KEYS];
+	char present[HT_UNIT_TEST_KEYS];
+	uint32_t count = 0, seen = 0, i, j, tmp;
+	HtIndexValue idx;
+	HtIterator it;
+	HTable ht;
+	void *blk;
+
+	logMessage(LOG_INFO_LEVEL, "HT_UNIT_TEST : Starting hash table unit test.");
+	memset(present, 0x0, sizeof(present));
+	for (i = 0; i < HT_BENCH_KEYS; i++)
+		values[i] = i;
+	if (initHashTable(&ht, 0))
+		return (-1);
+
+	for (i = 0; i < HT_UNIT_TEST_ITERATIONS; i++) {
+		j = crud_rand_value(0, HT_UNIT_TEST_KEYS - 1);
+		idx = (HtIndexValue)j * 0x10001 + 4096;
+		blk = findValueInHashTable(&ht, idx);
+		if (blk != (present[j] ? &values[j] : NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "HT_UNIT_TEST : Lookup of %lu wrong.", idx);
+			return (-1);
+		}
+		if (present[j] && crud_rand_value(0, 2) == 0) {
+			if (deleteValueFromHashTable(&ht, idx) != &values[j]) {
+				logMessage(LOG_ERROR_LEVEL, "HT_UNIT_TEST : Delete of %lu wrong.", idx);
+				return (-1);
+			}
+			present[j] = 0;
+			count--;
+		} else if (!present[j]) {
+			if (insertValueInHashTable(&ht, idx, &values[j])) {
+				logMessage(LOG_ERROR_LEVEL, "HT_UNIT_TEST : Insert of %lu failed.", idx);
+				return (-1);
+			}
+			present[j] = 1;
+			count++;
+		}
+		if (ht.elements != count) {
+			logMessage(LOG_ERROR_LEVEL, "HT_UNIT_TEST : Table has %u elements, expected %u.", ht.elements, count);
+			return (-1);
+		}
+	}
+
+	// Every value comes out once, and deleting each as it comes out is safe
+	initHashTableIterator(&ht, &it);
+	while ((blk = iterateHashTable(&it)) != NULL) {
+		j = *(uint32_t *)blk;
+		if (!present[j] || deleteValueFromHashTable(&ht, (HtIndexValue)j * 0x10001 + 4096) != blk) {
+			logMessage(LOG_ERROR_LEVEL, "HT_UNIT_TEST : Iterator returned bad value %u.", j);
+			return (-1);
+		}
+		present[j] = 0;
+		seen++;
+	}
+	if (seen != count || ht.elements != 0) {
+		logMessage(LOG_ERROR_LEVEL, "HT_UNIT_TEST : Iterator saw %u of %u values.", seen, count);
+		return (-1);
+	}
+	cleanupHashTable(&ht);
+
+	// Benchmark against the libcrud table, looking up in a random order
+	for (i = HT_BENCH_KEYS - 1; i > 0; i--) {
+		j = crud_rand_value(0, i);
+		tmp = values[i];
+		values[i] = values[j];
+		values[j] = tmp;
+	}
+	if (ht_bench("open", 0, values) || ht_bench("libcrud", 1, values))
+		return (-1);
+
+	logMessage(LOG_INFO_LEVEL, "HT_UNIT_TEST : Hash table unit test completed successfully.");
+	return (0);
+}
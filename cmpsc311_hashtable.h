@@ -18,7 +18,7 @@
 #define HT_COOKIE_VALUE 0xa3a3
 typedef unsigned long HtIndexValue;
 
-// Hash table entry structure
+// Hash table entry structure (the chained layout, kept for compatibility)
 typedef struct HtEntry {
 	uint16_t 	    cookie;  // This is a cookie value to detect memory corruption
 	HtIndexValue	index;   // This is the "key value" index of the object
@@ -29,23 +29,23 @@ typedef struct HtEntry {
 
 // Hash table structure
 typedef struct  {
-	uint16_t         htTableSize;  // The the bits in the hash values
+	uint16_t         htTableSize;  // The slots in the table (saturates at 65535)
 	uint32_t	     elements;     // This is the number of elements
-	HtEntryData    **hasHTable;    // This is the hash table itself
+	HtEntryData    **hasHTable;    // This is the hash table itself (open addressed storage)
 } HTable;
 
 // Hash table iterator
 typedef struct {
 	HTable      *table; // The table we are iterating through
-	uint16_t 	 idx;   // The current index into the hash table
-	HtEntryData *ptr;   // The pointer into the linked list at the index
+	uint16_t 	 idx;   // Unused
+	HtEntryData *ptr;   // The next slot to look at (a slot number, not a pointer)
 } HtIterator;
 
 //
 // Hashtable Interface
 
 int initHashTable( HTable *ht, uint16_t bits );
-	// This function initializes the hash table to a width of 2^(bits) width
+	// This function initializes the hash table to 2^(bits) slots, it grows as needed
 
 int cleanupHashTable( HTable *ht );
 	// Cleanup the hash table
@@ -0,0 +1,597 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_alloc.c
+//  Description    : This is the implementation of the CRUD memory
+//                   allocators.  Slab blocks come in power of two classes
+//                   carved from huge page backed arena mappings; each thread
+//                   keeps free lists of its own, trading blocks with a
+//                   shared pool in batches when they run dry or grow past
+//                   CRUD_ALLOC_CACHE_BYTES.  Each thread also has a scratch
+//                   arena, a stack of mappings that is bump allocated and
+//                   rolled back to a mark, for buffers that live for one call.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri May 19 15:47:09 PDT 2017
+//
+
+// Includes
+#define _GNU_SOURCE // For MAP_HUGETLB
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// Project Includes
+#include <crud_alloc.h>
+#include <crud_rand.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_ALLOC_CHUNK_SIZE (8 << 20)   // Size of the slab arena mappings
+#define CRUD_ALLOC_CACHE_BYTES (4 << 20)  // Bytes of a class a thread keeps
+#define CRUD_ALLOC_CARVE 32               // Most blocks carved at once
+#define CRUD_SCRATCH_CHUNK_SIZE (2 << 20) // Smallest scratch mapping
+#define CRUD_ALLOC_UNIT_TEST_THREADS 4
+#define CRUD_ALLOC_UNIT_TEST_ITERATIONS 8192
+#define CRUD_ALLOC_UNIT_TEST_SLOTS 64
+
+// Type definitions
+
+// A free slab block
+typedef struct CrudAllocBlock {
+	struct CrudAllocBlock *next; // The next free block of the class
+} CrudAllocBlock;
+
+// A mapping of the scratch arena
+typedef struct CrudScratchChunk {
+	struct CrudScratchChunk *prev; // The chunk below this one
+	size_t  size;                  // The bytes in "data"
+	size_t  used;                  // The bytes handed out
+	char    data[] __attribute__((aligned(16)));
+} CrudScratchChunk;
+
+// The free lists and scratch arena of a thread
+typedef struct {
+	CrudAllocBlock   *lists[CRUD_ALLOC_CLASSES];  // Free blocks, by class
+	uint32_t          counts[CRUD_ALLOC_CLASSES]; // Blocks on each list
+	CrudScratchChunk *scratch;    // The top of the scratch arena
+	CrudScratchChunk *spare;      // A released chunk kept for reuse
+	int               registered; // Flag indicating the exit hook is set
+} CrudAllocCache;
+
+// A unit test allocation
+typedef struct {
+	uint8_t *ptr;  // The allocation (NULL if none)
+	size_t   size; // Its size
+	uint8_t  fill; // The byte it was filled with
+} CrudAllocSlot;
+
+// Allocator Static Data
+CrudAllocBlock *crud_alloc_pool[CRUD_ALLOC_CLASSES]; // The shared free lists
+char *crud_alloc_next = NULL;  // The uncarved part of the newest arena mapping
+size_t crud_alloc_left = 0;    // The bytes in it
+CrudAllocStats crud_alloc_stats; // The allocation counts
+pthread_mutex_t crud_alloc_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the pool and arena
+pthread_once_t crud_alloc_once = PTHREAD_ONCE_INIT;
+pthread_key_t crud_alloc_key;  // Runs crud_alloc_thread_exit for each thread
+__thread CrudAllocCache crud_alloc_cache; // The calling thread's lists
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_class
+// Description  : Get the slab class of an allocation size
+//
+// Inputs       : size - the allocation size
+// Outputs      : the class (0 for 1 << CRUD_ALLOC_MIN_SHIFT bytes)
+
+int crud_alloc_class(size_t size) {
+	if (size <= ((size_t)1 << CRUD_ALLOC_MIN_SHIFT))
+		return (0);
+	return (64 - __builtin_clzl(size - 1) - CRUD_ALLOC_MIN_SHIFT);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_limit
+// Description  : Get the number of blocks of a class a thread may keep
+//
+// Inputs       : cls - the class
+// Outputs      : the limit (at least 2)
+
+uint32_t crud_alloc_limit(int cls) {
+	uint32_t limit = CRUD_ALLOC_CACHE_BYTES >> (cls + CRUD_ALLOC_MIN_SHIFT);
+	return (limit < 2 ? 2 : limit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_thread_exit
+// Description  : Hand an exiting thread's free blocks to the shared pool and
+//                unmap its scratch arena
+//
+// Inputs       : arg - the thread's CrudAllocCache
+// Outputs      : none
+
+void crud_alloc_thread_exit(void *arg) {
+	CrudAllocCache *cache = arg;
+	CrudScratchChunk *chunk;
+	CrudAllocBlock *blk;
+	int cls;
+
+	pthread_mutex_lock(&crud_alloc_lock);
+	for (cls = 0; cls < CRUD_ALLOC_CLASSES; cls++) {
+		while ((blk = cache->lists[cls]) != NULL) {
+			cache->lists[cls] = blk->next;
+			blk->next = crud_alloc_pool[cls];
+			crud_alloc_pool[cls] = blk;
+		}
+		cache->counts[cls] = 0;
+	}
+	pthread_mutex_unlock(&crud_alloc_lock);
+
+	if (cache->spare != NULL) {
+		cache->spare->prev = cache->scratch;
+		cache->scratch = cache->spare;
+		cache->spare = NULL;
+	}
+	while ((chunk = cache->scratch) != NULL) {
+		cache->scratch = chunk->prev;
+		crud_huge_free(chunk, sizeof(CrudScratchChunk) + chunk->size);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_setup
+// Description  : Create the key whose destructor cleans up after threads
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_alloc_setup(void) {
+	pthread_key_create(&crud_alloc_key, crud_alloc_thread_exit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_thread
+// Description  : Get the calling thread's lists, arranging for them to be
+//                cleaned up when it exits
+//
+// Inputs       : none
+// Outputs      : the thread's CrudAllocCache
+
+CrudAllocCache *crud_alloc_thread(void) {
+	CrudAllocCache *cache = &crud_alloc_cache;
+
+	if (!cache->registered) {
+		pthread_once(&crud_alloc_once, crud_alloc_setup);
+		pthread_setspecific(crud_alloc_key, cache);
+		cache->registered = 1;
+	}
+	return (cache);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_carve
+// Description  : Carve a block from the arena, mapping more as needed (the
+//                allocator lock is held)
+//
+// Inputs       : size - the block size (a power of two)
+// Outputs      : the block, or NULL if failure
+
+void *crud_alloc_carve(size_t size) {
+	size_t align = (size < 4096) ? size : 4096, pad;
+	void *blk;
+
+	pad = (align - ((uintptr_t)crud_alloc_next & (align - 1))) & (align - 1);
+	if (crud_alloc_next == NULL || crud_alloc_left < pad + size) {
+		if ((crud_alloc_next = crud_huge_alloc(CRUD_ALLOC_CHUNK_SIZE)) == NULL) {
+			crud_alloc_left = 0;
+			return (NULL);
+		}
+		crud_alloc_left = CRUD_ALLOC_CHUNK_SIZE;
+		pad = 0;
+	}
+	blk = crud_alloc_next + pad;
+	crud_alloc_next += pad + size;
+	crud_alloc_left -= pad + size;
+	return (blk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_refill
+// Description  : Fill a thread's empty free list from the shared pool, or
+//                failing that from the arena
+//
+// Inputs       : cache - the thread's lists
+//                cls - the class to refill
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_alloc_refill(CrudAllocCache *cache, int cls) {
+	uint32_t want = crud_alloc_limit(cls) / 2;
+	CrudAllocBlock *blk;
+
+	pthread_mutex_lock(&crud_alloc_lock);
+	while (cache->counts[cls] < want && (blk = crud_alloc_pool[cls]) != NULL) {
+		crud_alloc_pool[cls] = blk->next;
+		blk->next = cache->lists[cls];
+		cache->lists[cls] = blk;
+		cache->counts[cls]++;
+	}
+	if (want > CRUD_ALLOC_CARVE)
+		want = CRUD_ALLOC_CARVE;
+	while (cache->counts[cls] < want &&
+			(blk = crud_alloc_carve((size_t)1 << (cls + CRUD_ALLOC_MIN_SHIFT))) != NULL) {
+		blk->next = cache->lists[cls];
+		cache->lists[cls] = blk;
+		cache->counts[cls]++;
+	}
+	pthread_mutex_unlock(&crud_alloc_lock);
+	return (cache->counts[cls] ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_drain
+// Description  : Move half of a thread's overfull free list to the shared pool
+//
+// Inputs       : cache - the thread's lists
+//                cls - the class to drain
+// Outputs      : none
+
+void crud_alloc_drain(CrudAllocCache *cache, int cls) {
+	uint32_t keep = crud_alloc_limit(cls) / 2;
+	CrudAllocBlock *blk;
+
+	pthread_mutex_lock(&crud_alloc_lock);
+	while (cache->counts[cls] > keep) {
+		blk = cache->lists[cls];
+		cache->lists[cls] = blk->next;
+		blk->next = crud_alloc_pool[cls];
+		crud_alloc_pool[cls] = blk;
+		cache->counts[cls]--;
+	}
+	pthread_mutex_unlock(&crud_alloc_lock);
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_alloc
+// Description  : Allocate from the calling thread's free list of the size
+//                class, refilling it in a batch when empty
+//
+// Inputs       : size - the allocation size
+// Outputs      : the allocation, or NULL if failure
+
+void *crud_slab_alloc(size_t size) {
+	CrudAllocCache *cache = crud_alloc_thread();
+	CrudAllocBlock *blk;
+	int cls;
+
+	if (size > ((size_t)1 << CRUD_ALLOC_MAX_SHIFT)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD alloc : Allocation too large [%lu].", size);
+		return (NULL);
+	}
+	cls = crud_alloc_class(size);
+	if (cache->lists[cls] == NULL && crud_alloc_refill(cache, cls)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD alloc : Out of memory for [%lu].", size);
+		return (NULL);
+	}
+
+	blk = cache->lists[cls];
+	cache->lists[cls] = blk->next;
+	cache->counts[cls]--;
+	__atomic_fetch_add(&crud_alloc_stats.allocs, 1, __ATOMIC_RELAXED);
+	return (blk);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_slab_free
+// Description  : Return an allocation to the calling thread's free list (it
+//                may have been allocated by another thread)
+//
+// Inputs       : ptr - the allocation (NULL is ignored)
+//                size - the size it was allocated with
+// Outputs      : none
+
+void crud_slab_free(void *ptr, size_t size) {
+	CrudAllocCache *cache;
+	CrudAllocBlock *blk = ptr;
+	int cls;
+
+	if (ptr == NULL)
+		return;
+	cache = crud_alloc_thread();
+	cls = crud_alloc_class(size);
+	blk->next = cache->lists[cls];
+	cache->lists[cls] = blk;
+	if (++cache->counts[cls] > crud_alloc_limit(cls))
+		crud_alloc_drain(cache, cls);
+	__atomic_fetch_add(&crud_alloc_stats.frees, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_scratch_mark
+// Description  : Get the current position of the calling thread's scratch
+//                arena, to release back to
+//
+// Inputs       : none
+// Outputs      : the mark
+
+CrudScratchMark crud_scratch_mark(void) {
+	CrudAllocCache *cache = crud_alloc_thread();
+	CrudScratchMark mark = { cache->scratch, cache->scratch ? cache->scratch->used : 0 };
+
+	return (mark);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_scratch_alloc
+// Description  : Bump allocate from the calling thread's scratch arena,
+//                pushing a new chunk (the spare, if big enough) when full
+//
+// Inputs       : size - the allocation size
+// Outputs      : the allocation (16 byte aligned), or NULL if failure
+
+void *crud_scratch_alloc(size_t size) {
+	CrudAllocCache *cache = crud_alloc_thread();
+	CrudScratchChunk *chunk = cache->scratch;
+	size_t csize;
+	void *ptr;
+
+	size = (size + 15) & ~(size_t)15;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		if (cache->spare != NULL && cache->spare->size >= size) {
+			chunk = cache->spare;
+			cache->spare = NULL;
+		} else {
+			csize = sizeof(CrudScratchChunk) + size;
+			if (csize < CRUD_SCRATCH_CHUNK_SIZE)
+				csize = CRUD_SCRATCH_CHUNK_SIZE;
+			csize = (csize + CRUD_ALLOC_HUGE_PAGE - 1) & ~((size_t)CRUD_ALLOC_HUGE_PAGE - 1);
+			if ((chunk = crud_huge_alloc(csize)) == NULL)
+				return (NULL);
+			chunk->size = csize - sizeof(CrudScratchChunk);
+		}
+		chunk->used = 0;
+		chunk->prev = cache->scratch;
+		cache->scratch = chunk;
+	}
+
+	ptr = &chunk->data[chunk->used];
+	chunk->used += size;
+	__atomic_fetch_add(&crud_alloc_stats.scratch, 1, __ATOMIC_RELAXED);
+	return (ptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_scratch_release
+// Description  : Drop the scratch allocations made since a mark, keeping
+//                the largest chunk popped as the spare
+//
+// Inputs       : mark - the position from crud_scratch_mark
+// Outputs      : none
+
+void crud_scratch_release(CrudScratchMark mark) {
+	CrudAllocCache *cache = crud_alloc_thread();
+	CrudScratchChunk *chunk;
+
+	while ((chunk = cache->scratch) != NULL && chunk != mark.chunk) {
+		cache->scratch = chunk->prev;
+		if (cache->spare != NULL && cache->spare->size >= chunk->size) {
+			crud_huge_free(chunk, sizeof(CrudScratchChunk) + chunk->size);
+			continue;
+		}
+		if (cache->spare != NULL)
+			crud_huge_free(cache->spare, sizeof(CrudScratchChunk) + cache->spare->size);
+		cache->spare = chunk;
+	}
+	if (chunk != NULL)
+		chunk->used = mark.used;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_huge_alloc
+// Description  : Map a region on reserved huge pages, or failing that on
+//                huge page aligned memory advised for transparent huge pages
+//
+// Inputs       : size - the region size (rounded up to CRUD_ALLOC_HUGE_PAGE)
+// Outputs      : the region (zero filled), or NULL if failure
+
+void *crud_huge_alloc(size_t size) {
+	char *ptr, *aligned;
+
+	size = (size + CRUD_ALLOC_HUGE_PAGE - 1) & ~((size_t)CRUD_ALLOC_HUGE_PAGE - 1);
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr != MAP_FAILED) {
+		__atomic_fetch_add(&crud_alloc_stats.huge_maps, 1, __ATOMIC_RELAXED);
+	} else {
+
+		// Over map, then trim to a huge page boundary
+		ptr = mmap(NULL, size + CRUD_ALLOC_HUGE_PAGE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD alloc : Unable to map %lu bytes.", size);
+			return (NULL);
+		}
+		aligned = (char *)(((uintptr_t)ptr + CRUD_ALLOC_HUGE_PAGE - 1) &
+			~((uintptr_t)CRUD_ALLOC_HUGE_PAGE - 1));
+		if (aligned > ptr)
+			munmap(ptr, aligned - ptr);
+		munmap(aligned + size, ptr + CRUD_ALLOC_HUGE_PAGE - aligned);
+		madvise(aligned, size, MADV_HUGEPAGE);
+		ptr = aligned;
+	}
+
+	__atomic_fetch_add(&crud_alloc_stats.maps, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&crud_alloc_stats.mapped, size, __ATOMIC_RELAXED);
+	return (ptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_huge_free
+// Description  : Unmap a region from crud_huge_alloc
+//
+// Inputs       : ptr - the region (NULL is ignored)
+//                size - the size it was mapped with
+// Outputs      : none
+
+void crud_huge_free(void *ptr, size_t size) {
+	if (ptr == NULL)
+		return;
+	size = (size + CRUD_ALLOC_HUGE_PAGE - 1) & ~((size_t)CRUD_ALLOC_HUGE_PAGE - 1);
+	munmap(ptr, size);
+	__atomic_fetch_sub(&crud_alloc_stats.mapped, size, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_get_stats
+// Description  : Get the allocation counts
+//
+// Inputs       : stats - the structure to fill in
+// Outputs      : none
+
+void crud_alloc_get_stats(CrudAllocStats *stats) {
+	memcpy(stats, &crud_alloc_stats, sizeof(CrudAllocStats));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_log_stats
+// Description  : Write the allocation counts and the peak RSS to the log
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_alloc_log_stats(void) {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD alloc : %lu allocations, %lu frees, %lu scratch, "
+		"%.1f MB mapped (%lu of %lu maps on huge pages), peak RSS %ld KB",
+		crud_alloc_stats.allocs, crud_alloc_stats.frees, crud_alloc_stats.scratch,
+		crud_alloc_stats.mapped / (1024.0 * 1024.0), crud_alloc_stats.huge_maps,
+		crud_alloc_stats.maps, usage.ru_maxrss);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_alloc_worker
+// Description  : Allocate, fill, check and free at random, with scratch
+//                buffers in between, leaving the last allocations for the
+//                caller to free
+//
+// Inputs       : arg - the thread's CrudAllocSlot array
+// Outputs      : NULL if successful, the array if failure
+
+void *crud_alloc_worker(void *arg) {
+	CrudAllocSlot *slots = arg, *s;
+	CrudScratchMark mark;
+	uint8_t *scratch[4];
+	size_t len[4], j;
+	int i, k;
+
+	for (i = 0; i < CRUD_ALLOC_UNIT_TEST_ITERATIONS; i++) {
+		s = &slots[crud_rand_value(0, CRUD_ALLOC_UNIT_TEST_SLOTS - 1)];
+
+		// Check and free a filled slot, or fill an empty one
+		if (s->ptr != NULL) {
+			for (j = 0; j < s->size; j++) {
+				if (s->ptr[j] != s->fill) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_ALLOC_UNIT_TEST : Slab block overwritten.");
+					return (slots);
+				}
+			}
+			crud_slab_free(s->ptr, s->size);
+			s->ptr = NULL;
+		} else {
+			s->size = crud_rand_value(0, (uint32_t)1 << crud_rand_value(0, CRUD_ALLOC_MAX_SHIFT));
+			s->fill = crud_rand_value(0, 0xff);
+			if ((s->ptr = crud_slab_alloc(s->size)) == NULL)
+				return (slots);
+			memset(s->ptr, s->fill, s->size);
+		}
+
+		// Nest a few scratch buffers (now and then one past a chunk), then drop them
+		if ((i % 64) == 0) {
+			mark = crud_scratch_mark();
+			for (k = 0; k < 4; k++) {
+				len[k] = crud_rand_value(1, ((i % 1024) == 0 && k == 3) ?
+					2 * CRUD_SCRATCH_CHUNK_SIZE : CRUD_SCRATCH_CHUNK_SIZE / 32);
+				if ((scratch[k] = crud_scratch_alloc(len[k])) == NULL)
+					return (slots);
+				memset(scratch[k], k, len[k]);
+			}
+			for (k = 0; k < 4; k++) {
+				if (scratch[k][0] != k || scratch[k][len[k] - 1] != k) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_ALLOC_UNIT_TEST : Scratch buffer overwritten.");
+					return (slots);
+				}
+			}
+			crud_scratch_release(mark);
+		}
+	}
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudAllocUnitTest
+// Description  : Run the allocation workers on several threads, then free
+//                what they left behind from this one
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudAllocUnitTest(void) {
+	CrudAllocSlot slots[CRUD_ALLOC_UNIT_TEST_THREADS][CRUD_ALLOC_UNIT_TEST_SLOTS];
+	pthread_t tids[CRUD_ALLOC_UNIT_TEST_THREADS];
+	void *result;
+	int i, j, ret = 0;
+
+	logMessage(LOG_INFO_LEVEL, "CRUD_ALLOC_UNIT_TEST : Starting allocator unit test.");
+	memset(slots, 0x0, sizeof(slots));
+	for (i = 0; i < CRUD_ALLOC_UNIT_TEST_THREADS; i++) {
+		if (pthread_create(&tids[i], NULL, crud_alloc_worker, slots[i])) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_ALLOC_UNIT_TEST : Thread create failed.");
+			return (-1);
+		}
+	}
+	for (i = 0; i < CRUD_ALLOC_UNIT_TEST_THREADS; i++) {
+		pthread_join(tids[i], &result);
+		if (result != NULL)
+			ret = -1;
+	}
+
+	// Blocks freed by another thread than the one that allocated them
+	for (i = 0; i < CRUD_ALLOC_UNIT_TEST_THREADS; i++) {
+		for (j = 0; j < CRUD_ALLOC_UNIT_TEST_SLOTS; j++)
+			crud_slab_free(slots[i][j].ptr, slots[i][j].size);
+	}
+
+	if (ret == 0)
+		logMessage(LOG_INFO_LEVEL, "CRUD_ALLOC_UNIT_TEST : Allocator unit test completed successfully.");
+	else
+		logMessage(LOG_ERROR_LEVEL, "CRUD_ALLOC_UNIT_TEST : Allocator unit test failed.");
+	return (ret);
+}
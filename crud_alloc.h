@@ -0,0 +1,75 @@
+#ifndef CRUD_ALLOC_INCLUDED
+#define CRUD_ALLOC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_alloc.h
+//  Description    : This is the header file for the CRUD memory allocators:
+//                   size classed slab pools for object payloads, a per
+//                   thread scratch arena for transfer buffers, and huge page
+//                   backed mappings for large long lived regions.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri May 19 15:47:09 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+#include <stddef.h>
+
+// Defines
+#define CRUD_ALLOC_MIN_SHIFT 4   // Smallest slab class (16 bytes)
+#define CRUD_ALLOC_MAX_SHIFT 20  // Largest slab class (1MB, holds CRUD_MAX_OBJECT_SIZE)
+#define CRUD_ALLOC_CLASSES (CRUD_ALLOC_MAX_SHIFT - CRUD_ALLOC_MIN_SHIFT + 1)
+#define CRUD_ALLOC_HUGE_PAGE (2 << 20) // Huge page size
+
+// A position in the calling thread's scratch arena
+typedef struct {
+	void   *chunk; // The chunk on top at the time
+	size_t  used;  // The bytes used in it
+} CrudScratchMark;
+
+// Allocator statistics
+typedef struct {
+	uint64_t allocs;      // Slab allocations
+	uint64_t frees;       // Slab frees
+	uint64_t scratch;     // Scratch allocations
+	uint64_t mapped;      // Bytes mapped for the slabs, scratch and huge regions
+	uint64_t huge_maps;   // Mappings backed by reserved huge pages
+	uint64_t maps;        // All mappings
+} CrudAllocStats;
+
+//
+// Allocator interface
+
+void *crud_slab_alloc(size_t size);
+	// Allocate "size" bytes (at most 1 << CRUD_ALLOC_MAX_SHIFT) from the slabs
+
+void crud_slab_free(void *ptr, size_t size);
+	// Return an allocation of "size" bytes to the calling thread's slabs
+
+CrudScratchMark crud_scratch_mark(void);
+	// Get the current position of the calling thread's scratch arena
+
+void *crud_scratch_alloc(size_t size);
+	// Allocate a transfer buffer from the calling thread's scratch arena
+
+void crud_scratch_release(CrudScratchMark mark);
+	// Drop the scratch allocations made since "mark"
+
+void *crud_huge_alloc(size_t size);
+	// Map a region on huge pages where possible (zero filled)
+
+void crud_huge_free(void *ptr, size_t size);
+	// Unmap a region from crud_huge_alloc
+
+void crud_alloc_get_stats(CrudAllocStats *stats);
+	// Get the allocation counts
+
+void crud_alloc_log_stats(void);
+	// Write the allocation counts and the peak RSS to the log
+
+int crudAllocUnitTest(void);
+	// Check the slabs and scratch arena, from several threads
+
+#endif
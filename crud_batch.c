@@ -0,0 +1,350 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_batch.c
+//  Description    : This is the implementation of the request batching layer.
+//                   While a batch is open, UPDATE and DELETE requests are
+//                   queued rather than sent.  A later UPDATE of the same
+//                   object replaces the queued one, a DELETE drops the
+//                   object's queued UPDATE, and reads of an object with a
+//                   queued UPDATE are answered from the queue.  CREATE is
+//                   always sent at once, since the caller needs the OID.
+//                   All requests pass through here under the batch lock,
+//                   which serializes the path onto the CRUD bus.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Mon May  1 14:20:51 PDT 2017
+//
+
+// Includes
+#define _GNU_SOURCE // For PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_batch.h>
+#include <crud_stats.h>
+#include <crud_alloc.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+#include <cmpsc311_hashtable.h>
+
+// Defines
+#define CRUD_BATCH_INDEX_BITS 9 // Twice the queue depth
+
+// Type definitions
+
+// This is a queued request
+typedef struct {
+	CrudRequest  request;    // The queued request
+	CrudOID      oid;        // The object the request is for
+	void        *buf;        // Private copy of the data for an UPDATE
+	uint32_t     length;     // The length of the data
+	CrudResponse completion; // The bus response once dispatched
+	uint8_t      live;       // Flag indicating the request is still to be sent
+	uint8_t      caller;     // The file IO call that queued the request
+	int32_t      file;       // The file handle it was queued for
+} CrudBatchEntry;
+
+// Batch Static Data
+CrudBatchEntry crud_batch_queue[CRUD_BATCH_MAX_REQUESTS]; // The submission queue
+int crud_batch_count = 0;         // The number of queued requests
+int crud_batch_open = 0;          // Flag indicating requests are being queued
+int crud_batch_ready = 0;         // Flag indicating the indices are setup
+HTable crud_batch_updates;        // OID to queued UPDATE entry
+HTable crud_batch_deletes;        // OID to queued DELETE entry
+CrudBatchStats crud_batch_stats;  // The batching statistics
+pthread_mutex_t crud_batch_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // Guards the bus and all of the above
+
+// Pick up these definitions from the unit test of the crud driver
+CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
+		uint32_t length, uint8_t flags, uint8_t res);
+int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
+		CRUD_REQUEST_TYPES *req, uint32_t *length, uint8_t *flags,
+		uint8_t *res);
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_send
+// Description  : Send a request on the bus
+//
+// Inputs       : request - the request to send
+//                buf - the request data
+// Outputs      : the bus response
+
+CrudResponse crud_batch_send(CrudRequest request, void *buf) {
+	crud_batch_stats.issued++;
+	return (crud_stats_bus_request(request, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_reset
+// Description  : Empty the queue and its indices
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_batch_reset(void) {
+	int i;
+
+	if (!crud_batch_ready) {
+		initHashTable(&crud_batch_updates, CRUD_BATCH_INDEX_BITS);
+		initHashTable(&crud_batch_deletes, CRUD_BATCH_INDEX_BITS);
+		crud_batch_ready = 1;
+	}
+
+	// The indices point into the queue, so empty them entry by entry
+	for (i = 0; i < crud_batch_count; i++) {
+		deleteValueFromHashTable(&crud_batch_updates, crud_batch_queue[i].oid);
+		deleteValueFromHashTable(&crud_batch_deletes, crud_batch_queue[i].oid);
+		crud_slab_free(crud_batch_queue[i].buf, crud_batch_queue[i].length);
+		crud_batch_queue[i].buf = NULL;
+	}
+	crud_batch_count = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_enqueue
+// Description  : Add a request to the queue, flushing first if it is full
+//
+// Inputs       : request - the request to queue
+//                oid - the object the request is for
+//                buf - the data to copy with it (NULL if none)
+//                length - the length of the data
+// Outputs      : the queued entry, or NULL if failure
+
+CrudBatchEntry *crud_batch_enqueue(CrudRequest request, CrudOID oid, void *buf, uint32_t length) {
+	CrudBatchEntry *ent;
+
+	if (crud_batch_count == CRUD_BATCH_MAX_REQUESTS && crud_batch_flush())
+		return (NULL);
+
+	ent = &crud_batch_queue[crud_batch_count];
+	ent->request = request;
+	ent->oid = oid;
+	ent->length = length;
+	ent->completion = 0;
+	ent->live = 1;
+	ent->caller = crud_stats_get_caller();
+	ent->file = crud_stats_get_file();
+	ent->buf = NULL;
+	if (buf != NULL) {
+		if ((ent->buf = crud_slab_alloc(length)) == NULL)
+			return (NULL);
+		memcpy(ent->buf, buf, length);
+	}
+	crud_batch_count++;
+	return (ent);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_submit
+// Description  : Queue or send a request (the batch lock is held)
+//
+// Inputs       : request - the request to submit
+//                buf - the request data
+// Outputs      : the (possibly synthesized) response
+
+CrudResponse crud_batch_submit(CrudRequest request, void *buf) {
+	CrudBatchEntry *ent;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+	CrudOID oid;
+
+	crud_batch_stats.submitted++;
+	if (!crud_batch_open)
+		return (crud_batch_send(request, buf));
+
+	// The priority object and new objects never conflict with the queue
+	deconstruct_crud_request(request, &oid, &req, &length, &flags, &res);
+	if (flags & CRUD_PRIORITY_OBJECT)
+		return (crud_batch_send(request, buf));
+
+	switch (req) {
+
+	case CRUD_CREATE:
+		return (crud_batch_send(request, buf));
+
+	case CRUD_READ: // Answer from the queue when it holds the latest contents
+		if (findValueInHashTable(&crud_batch_deletes, oid) != NULL)
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		if ((ent = findValueInHashTable(&crud_batch_updates, oid)) == NULL)
+			return (crud_batch_send(request, buf));
+		if (length < ent->length)
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		memcpy(buf, ent->buf, ent->length);
+		crud_batch_stats.coalesced++;
+		return (construct_crud_request(oid, req, ent->length, flags, 0));
+
+	case CRUD_UPDATE: // Replace a queued update of the same object
+		if (findValueInHashTable(&crud_batch_deletes, oid) != NULL)
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		ent = findValueInHashTable(&crud_batch_updates, oid);
+		if (ent != NULL && ent->length == length) {
+			memcpy(ent->buf, buf, length);
+			crud_batch_stats.coalesced++;
+			return (construct_crud_request(oid, req, length, flags, 0));
+		}
+		if (ent != NULL && crud_batch_flush())
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		if ((ent = crud_batch_enqueue(request, oid, buf, length)) == NULL)
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		insertValueInHashTable(&crud_batch_updates, oid, ent);
+		return (construct_crud_request(oid, req, length, flags, 0));
+
+	case CRUD_DELETE: // Drop any queued update of the object
+		if (findValueInHashTable(&crud_batch_deletes, oid) != NULL)
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		if ((ent = deleteValueFromHashTable(&crud_batch_updates, oid)) != NULL) {
+			ent->live = 0;
+			crud_batch_stats.coalesced++;
+		}
+		if ((ent = crud_batch_enqueue(request, oid, NULL, 0)) == NULL)
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		insertValueInHashTable(&crud_batch_deletes, oid, ent);
+		return (construct_crud_request(oid, req, 0, flags, 0));
+
+	default: // Device level requests see everything queued before them
+		if (crud_batch_flush())
+			return (construct_crud_request(oid, req, 0, flags, 1));
+		return (crud_batch_send(request, buf));
+	}
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_request
+// Description  : Submit a request, queued if a batch is open, otherwise sent
+//                directly.  Queued requests get a successful response now,
+//                failures are reported when the queue is flushed.
+//
+// Inputs       : request - the request to submit
+//                buf - the request data
+// Outputs      : the (possibly synthesized) response
+
+CrudResponse crud_batch_request(CrudRequest request, void *buf) {
+	CrudResponse response;
+
+	pthread_mutex_lock(&crud_batch_lock);
+	response = crud_batch_submit(request, buf);
+	pthread_mutex_unlock(&crud_batch_lock);
+	return (response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_begin
+// Description  : Start queuing deferrable requests (UPDATE and DELETE)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_batch_begin(void) {
+	pthread_mutex_lock(&crud_batch_lock);
+	if (!crud_batch_ready)
+		crud_batch_reset();
+	crud_batch_open = 1;
+	pthread_mutex_unlock(&crud_batch_lock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_flush
+// Description  : Dispatch the queued requests in order, filling in their
+//                completions
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if any request failed
+
+int crud_batch_flush(void) {
+	CrudBatchEntry *ent;
+	CRUD_STATS_CALLERS caller;
+	int32_t file;
+	int i, failed = 0;
+
+	pthread_mutex_lock(&crud_batch_lock);
+	if (crud_batch_count == 0) {
+		pthread_mutex_unlock(&crud_batch_lock);
+		return (0);
+	}
+
+	// Charge each request to the call that queued it, not the one flushing
+	caller = crud_stats_get_caller();
+	file = crud_stats_get_file();
+	for (i = 0; i < crud_batch_count; i++) {
+		ent = &crud_batch_queue[i];
+		if (!ent->live)
+			continue;
+		crud_stats_set_caller(ent->caller);
+		crud_stats_set_file(ent->file);
+		ent->completion = crud_batch_send(ent->request, ent->buf);
+		if (ent->completion & 0x1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_BATCH : Queued request [%lx] failed.", ent->request);
+			failed++;
+		}
+	}
+
+	crud_stats_set_caller(caller);
+	crud_stats_set_file(file);
+
+	crud_batch_stats.flushes++;
+	crud_batch_reset();
+	pthread_mutex_unlock(&crud_batch_lock);
+	return (failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_end
+// Description  : Flush the queue and stop queuing requests
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_batch_end(void) {
+	int ret;
+
+	pthread_mutex_lock(&crud_batch_lock);
+	ret = crud_batch_flush();
+	crud_batch_open = 0;
+	pthread_mutex_unlock(&crud_batch_lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_get_stats
+// Description  : Get the request batching counts
+//
+// Inputs       : stats - the structure to fill in
+// Outputs      : none
+
+void crud_batch_get_stats(CrudBatchStats *stats) {
+	pthread_mutex_lock(&crud_batch_lock);
+	*stats = crud_batch_stats;
+	pthread_mutex_unlock(&crud_batch_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_log_stats
+// Description  : Write the batching statistics to the log
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_batch_log_stats(void) {
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD batch : %lu requests, %lu issued, %lu coalesced, %lu flushes",
+		crud_batch_stats.submitted, crud_batch_stats.issued,
+		crud_batch_stats.coalesced, crud_batch_stats.flushes);
+}
@@ -0,0 +1,53 @@
+#ifndef CRUD_BATCH_INCLUDED
+#define CRUD_BATCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_batch.h
+//  Description    : This is the header file for the request batching layer
+//                   that queues CRUD bus requests and collapses redundant
+//                   ones before they are dispatched.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Mon May  1 14:20:51 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_BATCH_MAX_REQUESTS 256 // Queue depth before a forced flush
+
+// Batch statistics
+typedef struct {
+	uint64_t submitted; // Requests handed to the batching layer
+	uint64_t issued;    // Requests actually sent on the bus
+	uint64_t coalesced; // Requests absorbed by the queue (never sent)
+	uint64_t flushes;   // Times the queue was dispatched
+} CrudBatchStats;
+
+//
+// Batch interface
+
+CrudResponse crud_batch_request(CrudRequest request, void *buf);
+	// Submit a request, queued if a batch is open, otherwise sent directly
+
+int crud_batch_begin(void);
+	// Start queuing deferrable requests (UPDATE and DELETE)
+
+int crud_batch_flush(void);
+	// Dispatch the queued requests, filling in their completions
+
+int crud_batch_end(void);
+	// Flush the queue and stop queuing requests
+
+void crud_batch_get_stats(CrudBatchStats *stats);
+	// Get the request batching counts
+
+void crud_batch_log_stats(void);
+	// Write the batching statistics to the log
+
+#endif
@@ -0,0 +1,220 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_bench.c
+//  Description    : This is the implementation of the benchmark timers.
+//                   Each operation keeps an HDR style histogram: latencies
+//                   below 2^4 ns get a bucket each, and every power of two
+//                   above that is split into 2^4 linear buckets, so any
+//                   reported percentile is within about 6% of the truth.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Tue May  9 16:02:37 PDT 2017
+//
+
+// Includes
+#include <string.h>
+#include <time.h>
+
+// Project Includes
+#include <crud_bench.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+
+// Benchmark Static Data
+CrudBenchHistogram crud_bench_hist[CRUD_BENCH_MAXOP]; // Histogram per operation
+int crud_bench_enabled = 0;      // Flag indicating the timers are on
+uint64_t crud_bench_started = 0; // The wall clock at enable
+const char *crud_bench_names[CRUD_BENCH_MAXOP] = {
+	"open", "read", "write", "seek", "close", "format", "mount", "unmount"
+};
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_clock
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in ns
+
+uint64_t crud_bench_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_bucket
+// Description  : Find the histogram bucket of a latency
+//
+// Inputs       : ns - the latency
+// Outputs      : the bucket index
+
+uint32_t crud_bench_bucket(uint64_t ns) {
+	uint32_t msb;
+
+	if (ns < CRUD_BENCH_SUB_BUCKETS)
+		return (ns);
+	msb = 63 - __builtin_clzll(ns);
+	return ((msb - CRUD_BENCH_SUB_BITS + 1) * CRUD_BENCH_SUB_BUCKETS +
+		((ns >> (msb - CRUD_BENCH_SUB_BITS)) & (CRUD_BENCH_SUB_BUCKETS - 1)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_bucket_top
+// Description  : Get the largest latency that falls in a bucket
+//
+// Inputs       : idx - the bucket index
+// Outputs      : the latency in ns
+
+uint64_t crud_bench_bucket_top(uint32_t idx) {
+	uint32_t shift;
+
+	if (idx < CRUD_BENCH_SUB_BUCKETS)
+		return (idx);
+	shift = idx / CRUD_BENCH_SUB_BUCKETS - 1;
+	return ((((uint64_t)(idx % CRUD_BENCH_SUB_BUCKETS) + CRUD_BENCH_SUB_BUCKETS + 1) << shift) - 1);
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_enable
+// Description  : Turn the timers on and start the wall clock
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_bench_enable(void) {
+	memset(crud_bench_hist, 0x0, sizeof(crud_bench_hist));
+	crud_bench_started = crud_bench_clock();
+	crud_bench_enabled = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_now
+// Description  : Get the time at the start of a timed call
+//
+// Inputs       : none
+// Outputs      : the monotonic time in ns (0 if the timers are off)
+
+uint64_t crud_bench_now(void) {
+	return (crud_bench_enabled ? crud_bench_clock() : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_record
+// Description  : Add the time since "start" to the histogram of "op"
+//                (safe to call from several replay threads)
+//
+// Inputs       : op - the operation timed
+//                start - the time from crud_bench_now at the call
+//                bytes - the bytes the call moved
+// Outputs      : none
+
+void crud_bench_record(CRUD_BENCH_OPS op, uint64_t start, uint64_t bytes) {
+	CrudBenchHistogram *h = &crud_bench_hist[op];
+	uint64_t ns, max;
+
+	if (!crud_bench_enabled)
+		return;
+
+	ns = crud_bench_clock() - start;
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->buckets[crud_bench_bucket(ns)], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_percentile
+// Description  : Get the latency that "pct" percent of the calls were within
+//
+// Inputs       : op - the operation
+//                pct - the percentile (0-100)
+// Outputs      : the latency in ns (the top of its bucket, at most the max)
+
+uint64_t crud_bench_percentile(CRUD_BENCH_OPS op, double pct) {
+	CrudBenchHistogram *h = &crud_bench_hist[op];
+	uint64_t want, seen = 0, top;
+	uint32_t i;
+
+	if (h->count == 0)
+		return (0);
+
+	want = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < CRUD_BENCH_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			break;
+	}
+	top = crud_bench_bucket_top(i);
+	return ((top < h->max) ? top : h->max);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_report
+// Description  : Log the throughput and latency percentiles of each
+//                operation, and write the same as JSON
+//
+// Inputs       : json - the stream for the JSON summary (NULL for none)
+// Outputs      : none
+
+void crud_bench_report(FILE *json) {
+	CrudBenchHistogram *h;
+	uint64_t ops = 0, bytes = 0;
+	double secs;
+	int i, first = 1;
+
+	if (!crud_bench_enabled)
+		return;
+
+	secs = (crud_bench_clock() - crud_bench_started) / 1e9;
+	for (i = 0; i < CRUD_BENCH_MAXOP; i++) {
+		ops += crud_bench_hist[i].count;
+		bytes += crud_bench_hist[i].bytes;
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD bench : %lu ops, %lu bytes in %.3fs (%.0f ops/s, %.0f bytes/s)",
+		ops, bytes, secs, ops / secs, bytes / secs);
+	if (json != NULL)
+		fprintf(json, "{\"ops\": %lu, \"bytes\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+			"\"bytes_per_sec\": %.1f, \"operations\": {", ops, bytes, secs, ops / secs, bytes / secs);
+
+	// One line (and JSON member) per operation that was called
+	for (i = 0; i < CRUD_BENCH_MAXOP; i++) {
+		h = &crud_bench_hist[i];
+		if (h->count == 0)
+			continue;
+		logMessage(LOG_OUTPUT_LEVEL, "CRUD bench : %-8s %8lu calls, mean %.2fus, p50 %.2fus, "
+			"p99 %.2fus, p999 %.2fus, max %.2fus", crud_bench_names[i], h->count,
+			h->total / (h->count * 1000.0), crud_bench_percentile(i, 50.0) / 1000.0,
+			crud_bench_percentile(i, 99.0) / 1000.0, crud_bench_percentile(i, 99.9) / 1000.0,
+			h->max / 1000.0);
+		if (json != NULL)
+			fprintf(json, "%s\"%s\": {\"count\": %lu, \"bytes\": %lu, \"mean_ns\": %lu, "
+				"\"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}",
+				first ? "" : ", ", crud_bench_names[i], h->count, h->bytes, h->total / h->count,
+				crud_bench_percentile(i, 50.0), crud_bench_percentile(i, 99.0),
+				crud_bench_percentile(i, 99.9), h->max);
+		first = 0;
+	}
+	if (json != NULL)
+		fprintf(json, "}}\n");
+}
@@ -0,0 +1,64 @@
+#ifndef CRUD_BENCH_INCLUDED
+#define CRUD_BENCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_bench.h
+//  Description    : This is the header file for the benchmark timers used
+//                   by the simulator to keep per operation latency
+//                   histograms of the CRUD file IO calls.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Tue May  9 16:02:37 PDT 2017
+//
+
+// Include files
+#include <stdio.h>
+#include <stdint.h>
+
+// Defines
+#define CRUD_BENCH_SUB_BITS 4 // Linear sub-buckets per power of two (2^4)
+#define CRUD_BENCH_SUB_BUCKETS (1 << CRUD_BENCH_SUB_BITS)
+#define CRUD_BENCH_BUCKETS ((64 - CRUD_BENCH_SUB_BITS + 1) * CRUD_BENCH_SUB_BUCKETS)
+
+// The timed operations
+typedef enum {
+	CRUD_BENCH_OPEN    = 0,
+	CRUD_BENCH_READ    = 1,
+	CRUD_BENCH_WRITE   = 2,
+	CRUD_BENCH_SEEK    = 3,
+	CRUD_BENCH_CLOSE   = 4,
+	CRUD_BENCH_FORMAT  = 5,
+	CRUD_BENCH_MOUNT   = 6,
+	CRUD_BENCH_UNMOUNT = 7,
+	CRUD_BENCH_MAXOP   = 8,
+} CRUD_BENCH_OPS;
+
+// Latency histogram of one operation, log bucketed (values in ns)
+typedef struct {
+	uint64_t count;   // The number of calls timed
+	uint64_t bytes;   // The bytes moved by those calls
+	uint64_t total;   // The sum of the latencies
+	uint64_t max;     // The largest latency
+	uint64_t buckets[CRUD_BENCH_BUCKETS]; // Calls per latency bucket
+} CrudBenchHistogram;
+
+//
+// Benchmark interface
+
+void crud_bench_enable(void);
+	// Turn the timers on and start the wall clock
+
+uint64_t crud_bench_now(void);
+	// Get the monotonic time in ns (0 if the timers are off)
+
+void crud_bench_record(CRUD_BENCH_OPS op, uint64_t start, uint64_t bytes);
+	// Add the time since "start" to the histogram of "op"
+
+uint64_t crud_bench_percentile(CRUD_BENCH_OPS op, double pct);
+	// Get the latency (ns) that "pct" percent of the "op" calls were within
+
+void crud_bench_report(FILE *json);
+	// Log the throughput and latencies, writing a JSON summary to "json"
+
+#endif
@@ -0,0 +1,676 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_cache.c
+//  Description    : This is the implementation of the write-back block cache
+//                   used by the CRUD file IO layer.  Lines hold one block
+//                   object each, are found through a hash table on the block
+//                   OID, and are replaced in least recently used order.
+//                   The cache is split into shards by block OID, each with
+//                   its own lines, index, LRU list and lock.  A line being
+//                   read or written on the bus is marked busy and the shard
+//                   lock is dropped for the transfer, so threads working on
+//                   different blocks only meet on the bus itself.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri Apr 21 10:12:44 PDT 2017
+//
+
+// Includes
+#include <malloc.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_cache.h>
+#include <crud_file_io.h>
+#include <crud_batch.h>
+#include <crud_alloc.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+#include <cmpsc311_hashtable.h>
+
+// Type definitions
+
+// This is a single cache line
+typedef struct CrudCacheLine {
+	CrudOID               oid;   // The block object held in the line
+	uint8_t               valid; // Flag indicating line holds a block
+	uint8_t               dirty; // Flag indicating line must be written back
+	uint8_t               busy;  // Flag indicating line is on the bus (shard unlocked)
+	char                 *data;  // The CRUD_BLOCK_SIZE contents of the block
+	struct CrudCacheLine *prev;  // The next more recently used line
+	struct CrudCacheLine *next;  // The next less recently used line
+} CrudCacheLine;
+
+// This is a shard of the cache, holding the blocks whose OIDs map to it
+typedef struct {
+	CrudCacheLine   *lines; // The lines of the shard
+	uint32_t         size;  // The number of lines in the shard
+	HTable           index; // Block OID to line lookup
+	CrudCacheLine   *mru;   // Most recently used line
+	CrudCacheLine   *lru;   // Least recently used line
+	CrudCacheStats   stats; // The shard statistics
+	pthread_mutex_t  lock;  // Guards all of the above and the lines
+	pthread_cond_t   idle;  // Signalled when a line stops being busy
+} CrudCacheShard;
+
+// Cache Static Data
+CrudCacheShard crud_cache_shards[CRUD_CACHE_SHARDS]; // The shards of the cache
+CrudCacheLine *crud_cache_lines = NULL; // The cache lines (of all shards)
+char *crud_cache_data = NULL;           // The block storage of the lines
+uint32_t crud_cache_size = 0;           // The number of lines in the cache
+uint32_t crud_cache_nshards = 0;        // The number of shards in use (power of two)
+int crud_cache_ready = 0;               // Flag indicating the cache is setup
+pthread_mutex_t crud_cache_setup_lock = PTHREAD_MUTEX_INITIALIZER; // Guards setup and teardown
+
+// Pick up these definitions from the unit test of the crud driver
+CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
+		uint32_t length, uint8_t flags, uint8_t res);
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_shard
+// Description  : Find the shard holding a block
+//
+// Inputs       : oid - the block object
+// Outputs      : the shard
+
+CrudCacheShard *crud_cache_shard(CrudOID oid) {
+	return (&crud_cache_shards[oid & (crud_cache_nshards - 1)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_unlink
+// Description  : Remove a line from the LRU list
+//
+// Inputs       : sh - the shard of the line
+//                line - the line to remove
+// Outputs      : none
+
+void crud_cache_unlink(CrudCacheShard *sh, CrudCacheLine *line) {
+	if (line->prev != NULL)
+		line->prev->next = line->next;
+	else
+		sh->mru = line->next;
+	if (line->next != NULL)
+		line->next->prev = line->prev;
+	else
+		sh->lru = line->prev;
+	line->prev = line->next = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_touch
+// Description  : Move a line to the most recently used end of the LRU list
+//
+// Inputs       : sh - the shard of the line
+//                line - the line that was used
+// Outputs      : none
+
+void crud_cache_touch(CrudCacheShard *sh, CrudCacheLine *line) {
+	if (sh->mru == line)
+		return;
+	crud_cache_unlink(sh, line);
+	line->next = sh->mru;
+	if (sh->mru != NULL)
+		sh->mru->prev = line;
+	sh->mru = line;
+	if (sh->lru == NULL)
+		sh->lru = line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_transfer
+// Description  : Move a line's block on the bus with the shard unlocked, the
+//                line being busy meanwhile (the shard lock is held)
+//
+// Inputs       : sh - the shard of the line
+//                line - the line to read into or write out
+//                req - CRUD_READ or CRUD_UPDATE
+// Outputs      : the bus response
+
+CrudResponse crud_cache_transfer(CrudCacheShard *sh, CrudCacheLine *line, CRUD_REQUEST_TYPES req) {
+	CrudResponse response;
+
+	line->busy = 1;
+	pthread_mutex_unlock(&sh->lock);
+	response = crud_batch_request(construct_crud_request(line->oid, req, CRUD_BLOCK_SIZE, 0, 0),
+		line->data);
+	pthread_mutex_lock(&sh->lock);
+	line->busy = 0;
+	pthread_cond_broadcast(&sh->idle);
+	return (response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_writeback
+// Description  : Write a dirty line back to its block object (the shard lock
+//                is held, but dropped during the write)
+//
+// Inputs       : sh - the shard of the line
+//                line - the line to write back (not busy)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_writeback(CrudCacheShard *sh, CrudCacheLine *line) {
+	if (!line->valid || !line->dirty)
+		return (0);
+
+	line->dirty = 0;
+	if (crud_cache_transfer(sh, line, CRUD_UPDATE) & 0x1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_CACHE : Write back of block [%u] failed.", line->oid);
+		line->dirty = 1;
+		return (-1);
+	}
+	sh->stats.writebacks++;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_find
+// Description  : Find the line of a block, waiting for it if it is busy
+//                (the shard lock is held)
+//
+// Inputs       : sh - the shard of the block
+//                oid - the block object
+// Outputs      : the line, or NULL if the block is not cached
+
+CrudCacheLine *crud_cache_find(CrudCacheShard *sh, CrudOID oid) {
+	CrudCacheLine *line;
+
+	while ((line = findValueInHashTable(&sh->index, oid)) != NULL && line->busy)
+		pthread_cond_wait(&sh->idle, &sh->lock);
+	return (line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_fill
+// Description  : Find the line for a block, taking the least recently used
+//                idle line on a miss (written back first if dirty) and
+//                reading the block into it if "fill" is set.  The shard lock
+//                is held, but dropped for the bus transfers.
+//
+// Inputs       : sh - the shard of the block
+//                oid - the block object to find
+//                fill - read the block contents in on a miss
+//                count - count the hit or miss in the statistics
+// Outputs      : the line (not busy), or NULL if failure
+
+CrudCacheLine *crud_cache_fill(CrudCacheShard *sh, CrudOID oid, int fill, int count) {
+	CrudCacheLine *line;
+
+	// Anything can change while the shard is unlocked, so look again after
+	while (1) {
+		if ((line = crud_cache_find(sh, oid)) != NULL) {
+			sh->stats.hits += count;
+			crud_cache_touch(sh, line);
+			return (line);
+		}
+		for (line = sh->lru; line != NULL && line->busy; line = line->prev)
+			;
+		if (line == NULL)
+			pthread_cond_wait(&sh->idle, &sh->lock);
+		else if (line->valid && line->dirty) {
+			if (crud_cache_writeback(sh, line))
+				return (NULL);
+		} else
+			break;
+	}
+
+	// Take the line over for the block
+	sh->stats.misses += count;
+	if (line->valid) {
+		deleteValueFromHashTable(&sh->index, line->oid);
+		sh->stats.evictions++;
+	}
+	line->oid = oid;
+	line->valid = 1;
+	line->dirty = 0;
+	insertValueInHashTable(&sh->index, oid, line);
+	crud_cache_touch(sh, line);
+
+	if (fill && (crud_cache_transfer(sh, line, CRUD_READ) & 0x1)) {
+		// Check for good read, drop the line if not
+		deleteValueFromHashTable(&sh->index, oid);
+		line->valid = 0;
+		return (NULL);
+	}
+	return (line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_setup
+// Description  : Setup the cache with "lines" block sized lines (the setup
+//                lock is held)
+//
+// Inputs       : lines - the number of cache lines (0 disables caching)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_setup(uint32_t lines) {
+	CrudCacheShard *sh;
+	uint32_t i, s, first;
+	uint16_t bits;
+
+	// A line per shard at least, the shards splitting the lines evenly
+	for (crud_cache_nshards = 1; crud_cache_nshards < CRUD_CACHE_SHARDS &&
+			crud_cache_nshards * 2 <= lines; crud_cache_nshards *= 2)
+		;
+	for (s = 0; s < CRUD_CACHE_SHARDS; s++) {
+		sh = &crud_cache_shards[s];
+		memset(sh, 0x0, sizeof(CrudCacheShard));
+		pthread_mutex_init(&sh->lock, NULL);
+		pthread_cond_init(&sh->idle, NULL);
+	}
+	crud_cache_size = lines;
+	if (lines == 0)
+		return (0);
+
+	crud_cache_lines = calloc(lines, sizeof(CrudCacheLine));
+	crud_cache_data = crud_huge_alloc((size_t)lines * CRUD_BLOCK_SIZE);
+	if (crud_cache_lines == NULL || crud_cache_data == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_CACHE : Unable to allocate %u lines.", lines);
+		free(crud_cache_lines);
+		crud_huge_free(crud_cache_data, (size_t)lines * CRUD_BLOCK_SIZE);
+		crud_cache_lines = NULL;
+		crud_cache_data = NULL;
+		crud_cache_size = 0;
+		return (-1);
+	}
+
+	// Hand each shard its lines, chained (empty) into its LRU list
+	for (s = 0, first = 0; s < crud_cache_nshards; s++) {
+		sh = &crud_cache_shards[s];
+		sh->size = lines / crud_cache_nshards + (s < lines % crud_cache_nshards);
+		sh->lines = &crud_cache_lines[first];
+		for (i = 0; i < sh->size; i++) {
+			sh->lines[i].data = &crud_cache_data[(size_t)(first + i) * CRUD_BLOCK_SIZE];
+			sh->lines[i].prev = (i > 0) ? &sh->lines[i-1] : NULL;
+			sh->lines[i].next = (i < sh->size-1) ? &sh->lines[i+1] : NULL;
+		}
+		sh->mru = &sh->lines[0];
+		sh->lru = &sh->lines[sh->size-1];
+		first += sh->size;
+
+		// Size the index to the number of lines
+		for (bits = 4; bits < 16 && (1U << bits) < sh->size; bits++)
+			;
+		initHashTable(&sh->index, bits);
+	}
+
+	logMessage(LOG_INFO_LEVEL, "CRUD_CACHE : Cache initialized with %u lines in %u shards.",
+		lines, crud_cache_nshards);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_ensure
+// Description  : Setup the cache with the default size if it is not yet
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_cache_ensure(void) {
+	if (__atomic_load_n(&crud_cache_ready, __ATOMIC_ACQUIRE))
+		return;
+	pthread_mutex_lock(&crud_cache_setup_lock);
+	if (!crud_cache_ready && crud_cache_setup(CRUD_CACHE_DEFAULT_LINES) == 0)
+		__atomic_store_n(&crud_cache_ready, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&crud_cache_setup_lock);
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_init
+// Description  : Setup the cache with "lines" block sized lines (no file
+//                calls may be running)
+//
+// Inputs       : lines - the number of cache lines (0 disables caching)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_init(uint32_t lines) {
+	int ret;
+
+	if (crud_cache_ready)
+		crud_cache_close();
+
+	pthread_mutex_lock(&crud_cache_setup_lock);
+	ret = crud_cache_setup(lines);
+	if (ret == 0)
+		__atomic_store_n(&crud_cache_ready, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&crud_cache_setup_lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_close
+// Description  : Flush the cache and release its memory (no file calls may
+//                be running)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_close(void) {
+	uint32_t s;
+	int ret = 0;
+
+	pthread_mutex_lock(&crud_cache_setup_lock);
+	if (!crud_cache_ready) {
+		pthread_mutex_unlock(&crud_cache_setup_lock);
+		return (0);
+	}
+
+	// Write back the dirty lines, then drop the indices and the lines
+	ret = crud_cache_flush();
+	for (s = 0; s < crud_cache_nshards && crud_cache_size > 0; s++)
+		cleanupHashTable(&crud_cache_shards[s].index);
+	for (s = 0; s < CRUD_CACHE_SHARDS; s++) {
+		pthread_mutex_destroy(&crud_cache_shards[s].lock);
+		pthread_cond_destroy(&crud_cache_shards[s].idle);
+	}
+	free(crud_cache_lines);
+	crud_huge_free(crud_cache_data, (size_t)crud_cache_size * CRUD_BLOCK_SIZE);
+	crud_cache_lines = NULL;
+	crud_cache_data = NULL;
+	crud_cache_size = 0;
+	crud_cache_nshards = 0;
+	__atomic_store_n(&crud_cache_ready, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&crud_cache_setup_lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_read
+// Description  : Read "len" bytes at "off" within block "oid" into "buf"
+//
+// Inputs       : oid - the block object to read
+//                off - the offset within the block
+//                buf - the buffer to place the bytes into
+//                len - the number of bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_read(CrudOID oid, uint32_t off, void *buf, uint32_t len) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+	CrudResponse response;
+	CrudRequest request;
+	char blk[CRUD_BLOCK_SIZE];
+	int ret = 0;
+
+	crud_cache_ensure();
+
+	// Partial blocks and cached blocks are served from a line
+	if (crud_cache_size > 0) {
+		sh = crud_cache_shard(oid);
+		pthread_mutex_lock(&sh->lock);
+		if (len < CRUD_BLOCK_SIZE || crud_cache_find(sh, oid) != NULL) {
+			if ((line = crud_cache_fill(sh, oid, 1, 1)) == NULL)
+				ret = -1;
+			else
+				memcpy(buf, &line->data[off], len);
+			pthread_mutex_unlock(&sh->lock);
+			return (ret);
+		}
+		sh->stats.misses++;
+		pthread_mutex_unlock(&sh->lock);
+	}
+
+	// Whole uncached blocks go straight from the bus into the caller's buffer
+	// (a block is only used under its file's lock, so it can't be cached meanwhile)
+	request = construct_crud_request(oid, CRUD_READ, CRUD_BLOCK_SIZE, 0, 0);
+	response = crud_batch_request(request, (len == CRUD_BLOCK_SIZE) ? buf : blk);
+	if (response & 0x1)
+		ret = -1;
+	else if (len < CRUD_BLOCK_SIZE)
+		memcpy(buf, &blk[off], len);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_write
+// Description  : Write "len" bytes at "off" within block "oid" from "buf",
+//                deferring the bus update until the line is written back
+//
+// Inputs       : oid - the block object to write
+//                off - the offset within the block
+//                buf - the buffer to write
+//                len - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_write(CrudOID oid, uint32_t off, void *buf, uint32_t len) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+	CrudResponse response;
+	CrudRequest request;
+	char blk[CRUD_BLOCK_SIZE], *src = buf;
+	int ret = 0;
+
+	crud_cache_ensure();
+
+	// No cache, read-modify-write the block on the bus
+	if (crud_cache_size == 0) {
+		response = 0;
+		if (len < CRUD_BLOCK_SIZE) {
+			request = construct_crud_request(oid, CRUD_READ, CRUD_BLOCK_SIZE, 0, 0);
+			response = crud_batch_request(request, blk);
+			memcpy(&blk[off], buf, len);
+			src = blk;
+		}
+		if (!(response & 0x1)) {
+			request = construct_crud_request(oid, CRUD_UPDATE, CRUD_BLOCK_SIZE, 0, 0);
+			response = crud_batch_request(request, src);
+		}
+		return ((response & 0x1) ? -1 : 0);
+	}
+
+	// Whole block writes don't need the old contents
+	sh = crud_cache_shard(oid);
+	pthread_mutex_lock(&sh->lock);
+	if ((line = crud_cache_fill(sh, oid, len < CRUD_BLOCK_SIZE, 1)) == NULL) {
+		ret = -1;
+	} else {
+		memcpy(&line->data[off], buf, len);
+		line->dirty = 1;
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_insert
+// Description  : Add the contents of a freshly created block to the cache
+//
+// Inputs       : oid - the block object that was created
+//                blk - the CRUD_BLOCK_SIZE contents of the block
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_insert(CrudOID oid, void *blk) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+	int ret = 0;
+
+	crud_cache_ensure();
+	if (crud_cache_size == 0)
+		return (0);
+
+	sh = crud_cache_shard(oid);
+	pthread_mutex_lock(&sh->lock);
+	if ((line = crud_cache_fill(sh, oid, 0, 0)) == NULL) {
+		ret = -1;
+	} else {
+		memcpy(line->data, blk, CRUD_BLOCK_SIZE);
+		line->dirty = 0;
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_flush_block
+// Description  : Write back the block "oid" if it is dirty in the cache
+//
+// Inputs       : oid - the block object to flush
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_flush_block(CrudOID oid) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+	int ret = 0;
+
+	if (crud_cache_size == 0)
+		return (0);
+
+	sh = crud_cache_shard(oid);
+	pthread_mutex_lock(&sh->lock);
+	if ((line = crud_cache_find(sh, oid)) != NULL)
+		ret = crud_cache_writeback(sh, line);
+	pthread_mutex_unlock(&sh->lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_drop
+// Description  : Drop the block "oid" from the cache without writing it back
+//                (the object is about to be deleted)
+//
+// Inputs       : oid - the block to drop
+// Outputs      : none
+
+void crud_cache_drop(CrudOID oid) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+
+	if (crud_cache_size == 0)
+		return;
+
+	sh = crud_cache_shard(oid);
+	pthread_mutex_lock(&sh->lock);
+	if ((line = crud_cache_find(sh, oid)) != NULL) {
+		deleteValueFromHashTable(&sh->index, oid);
+		line->valid = 0;
+		line->dirty = 0;
+	}
+	pthread_mutex_unlock(&sh->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_flush
+// Description  : Write back all dirty lines in the cache
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_flush(void) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+	uint32_t s, i;
+	int ret = 0;
+
+	for (s = 0; s < crud_cache_nshards && ret == 0; s++) {
+		sh = &crud_cache_shards[s];
+		pthread_mutex_lock(&sh->lock);
+		for (i = 0; i < sh->size && ret == 0; i++) {
+			line = &sh->lines[i];
+			while (line->busy)
+				pthread_cond_wait(&sh->idle, &sh->lock);
+			ret = crud_cache_writeback(sh, line);
+		}
+		pthread_mutex_unlock(&sh->lock);
+	}
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_clear
+// Description  : Drop every line from the cache without writing it back
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_clear(void) {
+	CrudCacheShard *sh;
+	CrudCacheLine *line;
+	uint32_t s, i;
+
+	for (s = 0; s < crud_cache_nshards && crud_cache_size > 0; s++) {
+		sh = &crud_cache_shards[s];
+		pthread_mutex_lock(&sh->lock);
+		for (i = 0; i < sh->size; i++) {
+			line = &sh->lines[i];
+			while (line->busy)
+				pthread_cond_wait(&sh->idle, &sh->lock);
+			if (line->valid) {
+				deleteValueFromHashTable(&sh->index, line->oid);
+				line->valid = 0;
+				line->dirty = 0;
+			}
+		}
+		pthread_mutex_unlock(&sh->lock);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_get_stats
+// Description  : Get the cache hit/miss/eviction counts (of all shards)
+//
+// Inputs       : stats - the structure to fill in
+// Outputs      : none
+
+void crud_cache_get_stats(CrudCacheStats *stats) {
+	CrudCacheShard *sh;
+	uint32_t s;
+
+	memset(stats, 0x0, sizeof(CrudCacheStats));
+	for (s = 0; s < crud_cache_nshards; s++) {
+		sh = &crud_cache_shards[s];
+		pthread_mutex_lock(&sh->lock);
+		stats->hits += sh->stats.hits;
+		stats->misses += sh->stats.misses;
+		stats->evictions += sh->stats.evictions;
+		stats->writebacks += sh->stats.writebacks;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_log_stats
+// Description  : Write the cache statistics to the log
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_cache_log_stats(void) {
+	CrudCacheStats stats;
+	uint64_t accesses;
+
+	crud_cache_get_stats(&stats);
+	accesses = stats.hits + stats.misses;
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD cache : %u lines, %lu hits, %lu misses (%.2f%% hit rate), "
+		"%lu evictions, %lu writebacks", crud_cache_size,
+		stats.hits, stats.misses,
+		accesses ? (100.0 * stats.hits) / accesses : 0.0,
+		stats.evictions, stats.writebacks);
+}
@@ -0,0 +1,71 @@
+#ifndef CRUD_CACHE_INCLUDED
+#define CRUD_CACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_cache.h
+//  Description    : This is the header file for the write-back block cache
+//                   that sits between the file IO layer and the CRUD bus.
+//                   The calls are safe from any thread, but init and close
+//                   must not run alongside the others.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri Apr 21 10:12:44 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_CACHE_DEFAULT_LINES 1024
+#define CRUD_CACHE_SHARDS 16 // Most shards the lines are split over (power of two)
+
+// Cache statistics
+typedef struct {
+	uint64_t hits;       // Accesses satisfied from a cache line
+	uint64_t misses;     // Accesses that had to go to the bus
+	uint64_t evictions;  // Lines evicted to make room
+	uint64_t writebacks; // Dirty lines written back to the bus
+} CrudCacheStats;
+
+//
+// Cache interface
+
+int crud_cache_init(uint32_t lines);
+	// Setup the cache with "lines" block sized lines (0 disables caching)
+
+int crud_cache_close(void);
+	// Flush the cache and release its memory
+
+int crud_cache_read(CrudOID oid, uint32_t off, void *buf, uint32_t len);
+	// Read "len" bytes at "off" within block "oid" into "buf" (whole block
+	// misses are read directly into "buf" and not cached)
+
+int crud_cache_write(CrudOID oid, uint32_t off, void *buf, uint32_t len);
+	// Write "len" bytes at "off" within block "oid" from "buf" (write-back)
+
+int crud_cache_insert(CrudOID oid, void *blk);
+	// Add the contents of a freshly created block to the cache
+
+int crud_cache_flush_block(CrudOID oid);
+	// Write back the block "oid" if it is dirty in the cache
+
+void crud_cache_drop(CrudOID oid);
+	// Drop the block "oid" from the cache without writing it back
+
+int crud_cache_flush(void);
+	// Write back all dirty lines in the cache
+
+int crud_cache_clear(void);
+	// Drop every line from the cache without writing it back
+
+void crud_cache_get_stats(CrudCacheStats *stats);
+	// Get the cache hit/miss/eviction counts
+
+void crud_cache_log_stats(void);
+	// Write the cache statistics to the log
+
+#endif
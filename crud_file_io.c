@@ -2,38 +2,154 @@
 //
 //  File           : crud_file_io.c
 //  Description    : This is the implementation of the standardized IO functions
-//                   for used to access the CRUD storage system.
+//                   for used to access the CRUD storage system.  The file
+//                   table is guarded by a reader/writer lock (opens and the
+//                   mount operations take it exclusively), and each handle
+//                   by a mutex from a sharded lock table, so threads may
+//                   work on different files at once.
 //
 //  Author         : Samuel Atkins
 //  Last Modified  : Fri Apr 14 12:38:05 PDT 2017
 //
 
 // Includes
+#include <stdio.h>
 #include <malloc.h>
 #include <string.h>
+#include <pthread.h>
 
 // Project Includes
 #include <crud_file_io.h>
+#include <crud_cache.h>
+#include <crud_batch.h>
+#include <crud_alloc.h>
+#include <crud_rand.h>
+#include <crud_stats.h>
+#include <crud_trace.h>
 #include <cmpsc311_log.h>
+#include <crud_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
+#define CRUD_TABLE_MAGIC 0x48445243 // "CRDH", marks a formatted file table
+#define CRUD_BLOCK_MIN_SLOTS 8      // Smallest block map object, in entries
+#define CRUD_EXTENT_BLOCKS 1024     // Blocks per extent (4MB of file)
+#define CRUD_EXTENT_MAX (CRUD_MAX_OBJECT_SIZE / CRUD_BLOCK_OID_SIZE) // Extents in an extent list
+#define CRUD_MAX_FILE_BLOCKS (CRUD_EXTENT_MAX * CRUD_EXTENT_BLOCKS)
+#define CRUD_TABLE_PAGE_FILES 64    // File table entries per stored table page
+#define CRUD_HANDLE_LOCKS 64        // Handle lock shards (handles share fd % 64)
 #define CIO_UNIT_TEST_MAX_WRITE_SIZE 1024
 #define CRUD_IO_UNIT_TEST_ITERATIONS 10240
+#define CRUD_IO_UNIT_TEST_BATCH 64
+#define CRUD_IO_LARGE_LENGTH (3 * CRUD_EXTENT_BLOCKS * CRUD_BLOCK_SIZE + 12345) // Spans four extents
+#define CRUD_IO_LARGE_CHUNK (256 * 1024)
+#define CRUD_IO_LARGE_CHECKS 64
+#define CRUD_IO_STRESS_ITERATIONS 2048
+#define CRUD_IO_STRESS_MAX_LENGTH (16 * CRUD_BLOCK_SIZE)
+#define CRUD_IO_STRESS_REOPEN 256   // Iterations between close/reopen of a file
 
 // Other definitions
 int initFlag = 0; // GLOBAL INIT FLAG
+pthread_once_t crud_init_once = PTHREAD_ONCE_INIT; // Initializes the bus exactly once
 // Type for UNIT test interface
 typedef enum {
 	CIO_UNIT_TEST_READ   = 0,
 	CIO_UNIT_TEST_WRITE  = 1,
 	CIO_UNIT_TEST_APPEND = 2,
 	CIO_UNIT_TEST_SEEK   = 3,
+	CIO_UNIT_TEST_PREAD  = 4,
+	CIO_UNIT_TEST_PWRITE = 5,
+	CIO_UNIT_TEST_WRITEV = 6,
+	CIO_UNIT_TEST_TRUNCATE  = 7,
+	CIO_UNIT_TEST_FALLOCATE = 8,
 } CRUD_UNIT_TEST_TYPE;
 
+// State of one thread of the stress test
+typedef struct {
+	int32_t  id;     // The thread number, names its file
+	char    *mirror; // The expected contents of the file
+	int32_t  length; // The expected length of the file
+	int      result; // 0 if the thread's checks passed, -1 if not
+} CrudStressThread;
+
+// Cursor over a scatter/gather vector list
+typedef struct {
+	const struct iovec *iov; // The current vector
+	int                 cnt; // The number of vectors left, including current
+	size_t              off; // The offset into the current vector
+} CrudIovCursor;
+
+// The block map of a file is a list of extents, each the OIDs of up to
+// CRUD_EXTENT_BLOCKS consecutive blocks.  While the file fits in one extent
+// the file object is that extent, past that the file object lists the
+// extent objects (read in as they are touched).  Map objects are sized in
+// powers of two (see crud_block_slots) with unused entries zero, so they are
+// only recreated when they have to grow or shrink, not for every block added.
+typedef struct {
+	CrudOID   oid;    // The extent object (0 if none)
+	CrudOID  *blocks; // The OIDs of the blocks (NULL until read in)
+	uint32_t  slots;  // The number of entries allocated in blocks
+	uint32_t  saved;  // The number of entries in the stored extent object
+	uint8_t   dirty;  // Flag indicating the extent must be written back
+} CrudExtent;
+
+typedef struct {
+	CrudExtent *extents;  // The extents of the file, in file order
+	uint32_t    nextents; // The number of extents allocated
+	uint32_t    nblocks;  // The number of blocks in the file
+	uint32_t    saved;    // The entries in the stored extent list (0 if none)
+	uint8_t     loaded;   // Flag indicating the block map has been set up
+	uint8_t     dirty;    // Flag indicating the block map must be written back
+} CrudBlockTable;
+
+// The stored file table is a superblock (the priority object) naming a page
+// directory object, which lists the table page objects.  Each page holds
+// CRUD_TABLE_PAGE_FILES fixed-width records followed by a pool of the
+// filenames they reference, and is only written back when it changed.
+typedef struct {
+	uint32_t magic;     // CRUD_TABLE_MAGIC
+	uint32_t npages;    // The number of pages in the page directory
+	CrudOID  directory; // The page directory object (0 if none)
+} CrudTableSuperblock;
+
+typedef struct {
+	CrudOID  oid;    // The table page object (0 if the page is empty)
+	uint32_t length; // The size of the table page object
+} CrudTablePageRef;
+
+typedef struct {
+	uint32_t nrecords; // The number of records in the page
+	uint32_t pool;     // The size of the filename pool after the records
+} CrudTablePageHeader;
+
+typedef struct {
+	CrudOID  object_id; // The block map object of the file
+	uint32_t name;      // The offset of the filename in the page pool
+	uint64_t length;    // The length of the file
+	uint64_t capacity;  // The bytes held by the block objects of the file
+} CrudTableRecord;
+
 // File system Static Data
-// This the definition of the file table
-CrudFileAllocationType crud_file_table[CRUD_MAX_TOTAL_FILES]; // The file handle table
+// This the definition of the file table, grown as needed
+CrudFileAllocationType *crud_file_table = NULL; // The file handle table
+CrudBlockTable *crud_block_table = NULL;        // The block table of each file
+int32_t crud_table_size = 0;                    // The number of entries in the tables
+
+// Filename index (open addressing, fh+1 per slot, 0 if empty) and free entries
+int32_t *crud_name_index = NULL; // Filename hash to file handle (2x table size)
+int32_t *crud_free_slots = NULL; // Stack of unused file table entries
+int32_t crud_free_count = 0;     // The number of unused entries
+
+// Stored file table state
+CrudTableSuperblock crud_superblock; // The superblock as stored
+CrudTablePageRef *crud_page_refs = NULL; // The page directory
+uint8_t *crud_page_dirty = NULL;         // Flags of pages needing write back
+uint32_t crud_saved_pages = 0;           // The number of pages in the stored directory
+int crud_directory_dirty = 0;            // Flag indicating directory needs write back
+
+// Locking, the table lock is taken before any handle lock
+pthread_rwlock_t crud_table_lock = PTHREAD_RWLOCK_INITIALIZER; // Guards the file table layout
+pthread_mutex_t crud_handle_locks[CRUD_HANDLE_LOCKS];         // Guard the per-file state
 
 // Pick up these definitions from the unit test of the crud driver
 CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
@@ -43,32 +159,948 @@ int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
 		uint8_t *res);
 
 //
-// Implementation
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_init_bus
+// Description  : Setup the handle locks and initialize the object store
+//                (run once, by whichever thread gets there first)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_init_bus(void) {
+	CrudRequest request;
+	CrudResponse response;
+
+	for (int i = 0; i < CRUD_HANDLE_LOCKS; i++)
+		pthread_mutex_init(&crud_handle_locks[i], NULL);
+
+	request = construct_crud_request(0, CRUD_INIT, 0, 0, 0);
+	response = crud_batch_request(request, NULL); // Initialize Object Store
+	if (!(response & 0x1)) //Sucsessfull CRUD Request
+		initFlag = 1;
+}
+
+int initCheck() {
+	pthread_once(&crud_init_once, crud_init_bus);
+	return (initFlag);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_mark_dirty
+// Description  : Note that a file table entry changed and its page must be
+//                written back on unmount
+//
+// Inputs       : fh - the file handle that changed
+// Outputs      : none
+
+void crud_mark_dirty(int32_t fh) {
+	// Handles sharing a page may be marked from different threads
+	__atomic_store_n(&crud_page_dirty[fh / CRUD_TABLE_PAGE_FILES], 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_reset_blocks
+// Description  : Drop the in-memory block map of a file (not the objects)
+//
+// Inputs       : fd - the file handle of the block map
+// Outputs      : none
+
+void crud_reset_blocks(int32_t fd) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+
+	for (uint32_t e = 0; e < bt->nextents; e++)
+		free(bt->extents[e].blocks);
+	free(bt->extents);
+	memset(bt, 0x0, sizeof(CrudBlockTable));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_block_slots
+// Description  : Size a block map object for a number of entries, the next
+//                power of two so a growing file recreates it only O(log n)
+//                times
+//
+// Inputs       : nentries - the number of entries in use
+// Outputs      : the number of entries in the object (0 if none)
+
+uint32_t crud_block_slots(uint32_t nentries) {
+	uint32_t slots = CRUD_BLOCK_MIN_SLOTS;
+
+	if (nentries == 0)
+		return (0);
+	while (slots < nentries)
+		slots <<= 1;
+	return ((slots > CRUD_EXTENT_MAX) ? CRUD_EXTENT_MAX : slots);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_length
+// Description  : Get the number of blocks of a file that fall in an extent
+//
+// Inputs       : nblocks - the number of blocks in the file
+//                e - the extent number
+// Outputs      : the number of blocks in the extent
+
+uint32_t crud_extent_length(uint32_t nblocks, uint32_t e) {
+	if (nblocks <= e * CRUD_EXTENT_BLOCKS)
+		return (0);
+	nblocks -= e * CRUD_EXTENT_BLOCKS;
+	return ((nblocks > CRUD_EXTENT_BLOCKS) ? CRUD_EXTENT_BLOCKS : nblocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_grow_extents
+// Description  : Make room for "nextents" extents in the block map of a
+//                file, doubling it (new extents are empty)
+//
+// Inputs       : fd - the file handle of the block map
+//                nextents - the number of extents needed
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_grow_extents(int32_t fd, uint32_t nextents) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudExtent *extents;
+	uint32_t slots;
+
+	if (nextents <= bt->nextents)
+		return (0);
+
+	slots = crud_block_slots(nextents);
+	if ((extents = realloc(bt->extents, slots * sizeof(CrudExtent))) == NULL)
+		return (-1);
+	memset(&extents[bt->nextents], 0x0, (slots - bt->nextents) * sizeof(CrudExtent));
+	bt->extents = extents;
+	bt->nextents = slots;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_grow_extent
+// Description  : Make room for "nblocks" entries in an extent, doubling it
+//                (new entries are zero)
+//
+// Inputs       : ext - the (read in) extent
+//                nblocks - the number of entries needed
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_grow_extent(CrudExtent *ext, uint32_t nblocks) {
+	CrudOID *blocks;
+	uint32_t slots;
+
+	if (nblocks <= ext->slots)
+		return (0);
+
+	slots = crud_block_slots(nblocks);
+	if ((blocks = realloc(ext->blocks, slots * CRUD_BLOCK_OID_SIZE)) == NULL)
+		return (-1);
+	memset(&blocks[ext->slots], 0x0, (slots - ext->slots) * CRUD_BLOCK_OID_SIZE);
+	ext->blocks = blocks;
+	ext->slots = slots;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_extent
+// Description  : Read an extent of a file's block map in, if needed
+//
+// Inputs       : fd - the file handle of the block map
+//                e - the extent number
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_load_extent(int32_t fd, uint32_t e) {
+	CrudExtent *ext = &crud_block_table[fd].extents[e];
+	CrudResponse response;
+	CrudRequest request;
+
+	if (ext->blocks != NULL)
+		return (0);
+	if (crud_grow_extent(ext, ext->saved ? ext->saved : 1))
+		return (-1);
+
+	if (ext->oid != 0) {
+		request = construct_crud_request(ext->oid, CRUD_READ,
+			ext->saved * CRUD_BLOCK_OID_SIZE, 0, 0);
+		response = crud_batch_request(request, ext->blocks);
+		if (response & 0x1) { // Check for good read
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO : Extent %u read failed [%s].", e,
+				crud_file_table[fd].filename);
+			free(ext->blocks);
+			ext->blocks = NULL;
+			ext->slots = 0;
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_block_oid
+// Description  : Look up the object holding a block of a file, reading its
+//                extent in if needed
+//
+// Inputs       : fd - the (loaded) file handle
+//                bno - the block number, less than the number of blocks
+//                oid - the block object, set on success
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_block_oid(int32_t fd, uint32_t bno, CrudOID *oid) {
+	uint32_t e = bno / CRUD_EXTENT_BLOCKS;
+
+	if (crud_load_extent(fd, e))
+		return (-1);
+	*oid = crud_block_table[fd].extents[e].blocks[bno % CRUD_EXTENT_BLOCKS];
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_blocks
+// Description  : Set up the block map of a file from its object, if needed
+//                (the extents themselves are read in as they are touched)
+//
+// Inputs       : fd - the file handle of the block map
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_load_blocks(int32_t fd) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudScratchMark mark;
+	CrudResponse response;
+	CrudRequest request;
+	uint32_t nblocks, nextents, e;
+	CrudOID *list;
+
+	if (bt->loaded)
+		return (0);
+
+	nblocks = crud_file_table[fd].capacity / CRUD_BLOCK_SIZE;
+	nextents = (nblocks + CRUD_EXTENT_BLOCKS - 1) / CRUD_EXTENT_BLOCKS;
+	if (crud_grow_extents(fd, nextents ? nextents : 1))
+		return (-1);
+	bt->nblocks = nblocks;
+	bt->dirty = 0;
+
+	// A single extent is the file object itself
+	if (nextents <= 1) {
+		bt->extents[0].oid = crud_file_table[fd].object_id;
+		bt->extents[0].saved = crud_block_slots(nblocks);
+		bt->saved = 0;
+		bt->loaded = 1;
+		return (0);
+	}
+
+	// Otherwise the file object lists the extent objects
+	bt->saved = crud_block_slots(nextents);
+	mark = crud_scratch_mark();
+	if ((list = crud_scratch_alloc(bt->saved * CRUD_BLOCK_OID_SIZE)) == NULL)
+		return (-1);
+	request = construct_crud_request(crud_file_table[fd].object_id, CRUD_READ,
+		bt->saved * CRUD_BLOCK_OID_SIZE, 0, 0);
+	response = crud_batch_request(request, list);
+	if (response & 0x1) { // Check for good read
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO : Extent list read failed [%s].",
+			crud_file_table[fd].filename);
+		crud_scratch_release(mark);
+		crud_reset_blocks(fd);
+		return (-1);
+	}
+	for (e = 0; e < nextents; e++) {
+		bt->extents[e].oid = list[e];
+		bt->extents[e].saved = crud_block_slots(crud_extent_length(nblocks, e));
+	}
+	crud_scratch_release(mark);
+
+	bt->loaded = 1;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_extent
+// Description  : Write an extent back to its object if it changed,
+//                recreating the object when its size class changed (or
+//                deleting it when the extent is now empty)
+//
+// Inputs       : ext - the extent
+//                nblocks - the number of blocks now in the extent
+// Outputs      : 1 if the extent object changed, 0 if not, -1 if failure
+
+int crud_save_extent(CrudExtent *ext, uint32_t nblocks) {
+	CrudResponse response;
+	CrudRequest request;
+	uint32_t slots = crud_block_slots(nblocks);
+
+	if (!ext->dirty && slots == ext->saved)
+		return (0);
+
+	// Same size extent, just update it in place
+	if (slots == ext->saved && ext->oid != 0) {
+		request = construct_crud_request(ext->oid, CRUD_UPDATE,
+			slots * CRUD_BLOCK_OID_SIZE, 0, 0);
+		response = crud_batch_request(request, ext->blocks);
+		if (response & 0x1)
+			return (-1);
+		ext->dirty = 0;
+		return (0);
+	}
+
+	// DELETE OLD EXTENT OBJECT
+	if (ext->oid != 0) {
+		request = construct_crud_request(ext->oid, CRUD_DELETE, 0, 0, 0);
+		response = crud_batch_request(request, NULL);
+		if (response & 0x1)
+			return (-1);
+		ext->oid = 0;
+	}
+
+	// CREATE NEW EXTENT OBJECT
+	if (slots > 0) {
+		request = construct_crud_request(0, CRUD_CREATE, slots * CRUD_BLOCK_OID_SIZE, 0, 0);
+		response = crud_batch_request(request, ext->blocks);
+		if (response & 0x1)
+			return (-1);
+		ext->oid = (response >> 32);
+	}
+
+	ext->saved = slots;
+	ext->dirty = 0;
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_blocks
+// Description  : Write the block map of a file back if it changed, the
+//                extents first and then the file object (the only extent,
+//                or the list of them)
+//
+// Inputs       : fd - the file handle of the block map
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_save_blocks(int32_t fd) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudFileAllocationType *file = &crud_file_table[fd];
+	CrudScratchMark mark;
+	CrudResponse response;
+	CrudRequest request;
+	uint32_t nextents, slots, e;
+	int changed = 0, ret;
+	CrudOID *list;
+
+	if (!bt->loaded || !bt->dirty)
+		return (0);
+
+	// Extents past the end of the file are emptied, and so deleted
+	for (e = 0; e < bt->nextents; e++) {
+		if ((ret = crud_save_extent(&bt->extents[e], crud_extent_length(bt->nblocks, e))) == -1)
+			return (-1);
+		changed |= ret;
+	}
+	nextents = (bt->nblocks + CRUD_EXTENT_BLOCKS - 1) / CRUD_EXTENT_BLOCKS;
+
+	// A single extent becomes the file object, dropping any extent list
+	if (nextents <= 1) {
+		if (bt->saved > 0) {
+			request = construct_crud_request(file->object_id, CRUD_DELETE, 0, 0, 0);
+			response = crud_batch_request(request, NULL);
+			if (response & 0x1)
+				return (-1);
+			bt->saved = 0;
+		}
+		if (file->object_id != bt->extents[0].oid) {
+			file->object_id = bt->extents[0].oid;
+			crud_mark_dirty(fd);
+		}
+		bt->dirty = 0;
+		return (0);
+	}
+
+	// The extent list only changes when an extent object does
+	slots = crud_block_slots(nextents);
+	if (!changed && slots == bt->saved) {
+		bt->dirty = 0;
+		return (0);
+	}
+	mark = crud_scratch_mark();
+	if ((list = crud_scratch_alloc(slots * CRUD_BLOCK_OID_SIZE)) == NULL)
+		return (-1);
+	memset(list, 0x0, slots * CRUD_BLOCK_OID_SIZE);
+	for (e = 0; e < nextents; e++)
+		list[e] = bt->extents[e].oid;
+
+	if (slots == bt->saved) {
+		request = construct_crud_request(file->object_id, CRUD_UPDATE,
+			slots * CRUD_BLOCK_OID_SIZE, 0, 0);
+		response = crud_batch_request(request, list);
+	} else {
+		// Replace the old list (a lone extent object is now the first extent)
+		response = 0;
+		if (bt->saved > 0) {
+			request = construct_crud_request(file->object_id, CRUD_DELETE, 0, 0, 0);
+			response = crud_batch_request(request, NULL);
+		}
+		if (!(response & 0x1)) {
+			request = construct_crud_request(0, CRUD_CREATE, slots * CRUD_BLOCK_OID_SIZE, 0, 0);
+			response = crud_batch_request(request, list);
+			if (!(response & 0x1)) {
+				file->object_id = (response >> 32);
+				bt->saved = slots;
+				crud_mark_dirty(fd);
+			}
+		}
+	}
+	crud_scratch_release(mark);
+	if (response & 0x1)
+		return (-1);
+
+	bt->dirty = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_blocks
+// Description  : Write back the cached blocks of a file
+//
+// Inputs       : fd - the file handle to flush
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_flush_blocks(int32_t fd) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudExtent *ext;
+
+	// Blocks are only cached while their extent is read in
+	for (uint32_t e = 0; e < bt->nextents; e++) {
+		ext = &bt->extents[e];
+		for (uint32_t b = 0; ext->blocks != NULL && b < ext->slots; b++) {
+			if (ext->blocks[b] != 0 && crud_cache_flush_block(ext->blocks[b]))
+				return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_append_block
+// Description  : Create a new block object at the end of a file
+//
+// Inputs       : fd - the file handle to add the block to
+//                blk - the CRUD_BLOCK_SIZE contents of the new block
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_append_block(int32_t fd, char *blk) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudResponse response;
+	CrudRequest request;
+	CrudExtent *ext;
+	uint32_t e = bt->nblocks / CRUD_EXTENT_BLOCKS, b = bt->nblocks % CRUD_EXTENT_BLOCKS;
+
+	if (bt->nblocks >= CRUD_MAX_FILE_BLOCKS) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO : File too large [%s].",
+			crud_file_table[fd].filename);
+		return (-1);
+	}
+	if (crud_grow_extents(fd, e + 1) || crud_load_extent(fd, e))
+		return (-1);
+	ext = &bt->extents[e];
+	if (crud_grow_extent(ext, b + 1))
+		return (-1);
+
+	request = construct_crud_request(0, CRUD_CREATE, CRUD_BLOCK_SIZE, 0, 0);
+	response = crud_batch_request(request, blk);
+	if (response & 0x1) //MAKE SURE GOOD CREATE
+		return (-1);
+
+	ext->blocks[b] = (response >> 32);
+	ext->dirty = 1;
+	bt->nblocks++;
+	bt->dirty = 1;
+	crud_file_table[fd].capacity = (uint64_t)bt->nblocks * CRUD_BLOCK_SIZE;
+	crud_mark_dirty(fd);
+	return (crud_cache_insert(response >> 32, blk));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extend_blocks
+// Description  : Append zero filled blocks until the file has "nblocks"
+//
+// Inputs       : fd - the (checked) file handle to extend
+//                nblocks - the number of blocks wanted
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_extend_blocks(int32_t fd, uint64_t nblocks) {
+	char blk[CRUD_BLOCK_SIZE];
+
+	if (nblocks > CRUD_MAX_FILE_BLOCKS) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO : File too large [%s].",
+			crud_file_table[fd].filename);
+		return (-1);
+	}
+
+	memset(blk, 0x0, CRUD_BLOCK_SIZE);
+	while (crud_block_table[fd].nblocks < nblocks) {
+		if (crud_append_block(fd, blk))
+			return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trim_blocks
+// Description  : Delete the block objects past the first "nblocks"
+//
+// Inputs       : fd - the (checked) file handle to trim
+//                nblocks - the number of blocks to keep
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_trim_blocks(int32_t fd, uint32_t nblocks) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudResponse response;
+	CrudRequest request;
+	CrudExtent *ext;
+	uint32_t b;
+
+	while (bt->nblocks > nblocks) {
+		b = bt->nblocks - 1;
+		if (crud_load_extent(fd, b / CRUD_EXTENT_BLOCKS))
+			return (-1);
+		ext = &bt->extents[b / CRUD_EXTENT_BLOCKS];
+
+		// Cached contents of the block must never be written back
+		crud_cache_drop(ext->blocks[b % CRUD_EXTENT_BLOCKS]);
+		request = construct_crud_request(ext->blocks[b % CRUD_EXTENT_BLOCKS], CRUD_DELETE, 0, 0, 0);
+		response = crud_batch_request(request, NULL);
+		if (response & 0x1)
+			return (-1);
+		ext->blocks[b % CRUD_EXTENT_BLOCKS] = 0;
+		ext->dirty = 1;
+		bt->nblocks--;
+		bt->dirty = 1;
+	}
+	crud_file_table[fd].capacity = (uint64_t)bt->nblocks * CRUD_BLOCK_SIZE;
+	crud_mark_dirty(fd);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_name_hash
+// Description  : Hash a filename into the filename index (FNV-1a)
+//
+// Inputs       : path - the filename to hash
+// Outputs      : the starting slot in the filename index
+
+uint32_t crud_name_hash(const char *path) {
+	uint32_t hash = 2166136261U;
+
+	while (*path) {
+		hash ^= (uint8_t)*path++;
+		hash *= 16777619U;
+	}
+	return (hash & (crud_table_size * 2 - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_index_file
+// Description  : Add a file table entry to the filename index
+//
+// Inputs       : fh - the file handle to add
+// Outputs      : none
+
+void crud_index_file(int32_t fh) {
+	uint32_t slot = crud_name_hash(crud_file_table[fh].filename);
+
+	while (crud_name_index[slot] != 0)
+		slot = (slot + 1) & (crud_table_size * 2 - 1);
+	crud_name_index[slot] = fh + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_find_file
+// Description  : Look up the file table entry of a filename
+//
+// Inputs       : path - the filename to find
+// Outputs      : the file handle, or -1 if not in the table
+
+int32_t crud_find_file(const char *path) {
+	uint32_t slot = crud_name_hash(path);
+	int32_t fh;
+
+	while ((fh = crud_name_index[slot]) != 0) {
+		if (strcmp(crud_file_table[fh-1].filename, path) == 0)
+			return (fh - 1);
+		slot = (slot + 1) & (crud_table_size * 2 - 1);
+	}
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_build_index
+// Description  : Rebuild the filename index and free entry list from the
+//                file table
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_build_index(void) {
+	int32_t fh;
+
+	memset(crud_name_index, 0x0, crud_table_size * 2 * sizeof(int32_t));
+	crud_free_count = 0;
+
+	// Free entries are pushed in reverse so the lowest comes off first
+	for (fh = crud_table_size - 1; fh >= 0; fh--) {
+		if (crud_file_table[fh].filename[0] == 0x0)
+			crud_free_slots[crud_free_count++] = fh;
+		else
+			crud_index_file(fh);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_grow_table
+// Description  : Grow the in-memory file table (and its side tables) to
+//                "size" entries, which must be a multiple of the page size
+//
+// Inputs       : size - the new number of file table entries
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_grow_table(int32_t size) {
+	int32_t old = crud_table_size;
+	uint32_t opages = old / CRUD_TABLE_PAGE_FILES, npages = size / CRUD_TABLE_PAGE_FILES;
+	void *ptr;
+
+	// Grow each array in turn, keeping the ones that succeeded
+	if ((ptr = realloc(crud_file_table, size * sizeof(CrudFileAllocationType))) == NULL)
+		goto fail;
+	crud_file_table = ptr;
+	if ((ptr = realloc(crud_block_table, size * sizeof(CrudBlockTable))) == NULL)
+		goto fail;
+	crud_block_table = ptr;
+	if ((ptr = realloc(crud_free_slots, size * sizeof(int32_t))) == NULL)
+		goto fail;
+	crud_free_slots = ptr;
+	if ((ptr = realloc(crud_name_index, size * 2 * sizeof(int32_t))) == NULL)
+		goto fail;
+	crud_name_index = ptr;
+	if ((ptr = realloc(crud_page_refs, npages * sizeof(CrudTablePageRef))) == NULL)
+		goto fail;
+	crud_page_refs = ptr;
+	if ((ptr = realloc(crud_page_dirty, npages)) == NULL)
+		goto fail;
+	crud_page_dirty = ptr;
+
+	// Clear out the new entries, then re-hash everything at the new size
+	memset(&crud_file_table[old], 0x0, (size - old) * sizeof(CrudFileAllocationType));
+	memset(&crud_block_table[old], 0x0, (size - old) * sizeof(CrudBlockTable));
+	memset(&crud_page_refs[opages], 0x0, (npages - opages) * sizeof(CrudTablePageRef));
+	memset(&crud_page_dirty[opages], 0x0, npages - opages);
+	crud_table_size = size;
+	crud_build_index();
+	return (0);
+
+fail:
+	logMessage(LOG_ERROR_LEVEL, "CRUD_IO : Unable to grow file table to %d entries.", size);
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_reset_table
+// Description  : Release the in-memory file table and block tables
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_reset_table(void) {
+	for (int32_t fh = 0; fh < crud_table_size; fh++)
+		crud_reset_blocks(fh);
+	free(crud_file_table);
+	free(crud_block_table);
+	free(crud_free_slots);
+	free(crud_name_index);
+	free(crud_page_refs);
+	free(crud_page_dirty);
+	crud_file_table = NULL;
+	crud_block_table = NULL;
+	crud_free_slots = NULL;
+	crud_name_index = NULL;
+	crud_page_refs = NULL;
+	crud_page_dirty = NULL;
+	crud_table_size = crud_free_count = 0;
+	crud_saved_pages = 0;
+	crud_directory_dirty = 0;
+	memset(&crud_superblock, 0x0, sizeof(CrudTableSuperblock));
+}
 
-int initCheck() {
-	CrudRequest request;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_page
+// Description  : Encode a file table page and write it back, recreating the
+//                page object when its size changed
+//
+// Inputs       : pg - the page to write back
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_save_page(uint32_t pg) {
+	CrudFileAllocationType *ent = &crud_file_table[pg * CRUD_TABLE_PAGE_FILES];
+	CrudTablePageRef *ref = &crud_page_refs[pg];
+	CrudTablePageHeader *hdr;
+	CrudTableRecord *rec;
 	CrudResponse response;
+	CrudRequest request;
+	CrudScratchMark mark = crud_scratch_mark();
+	uint32_t i, pool, length;
+	char *page, *names;
+
+	// Size the pool, offset 0 is the empty name
+	for (i = 0, pool = 1; i < CRUD_TABLE_PAGE_FILES; i++) {
+		if (ent[i].filename[0] != 0x0)
+			pool += strlen(ent[i].filename) + 1;
+	}
+	length = sizeof(CrudTablePageHeader) + CRUD_TABLE_PAGE_FILES * sizeof(CrudTableRecord) + pool;
+	if ((page = crud_scratch_alloc(length)) == NULL)
+		return (-1);
+	memset(page, 0x0, length);
+
+	// Encode the records and names
+	hdr = (CrudTablePageHeader *)page;
+	hdr->nrecords = CRUD_TABLE_PAGE_FILES;
+	hdr->pool = pool;
+	rec = (CrudTableRecord *)&page[sizeof(CrudTablePageHeader)];
+	names = (char *)&rec[CRUD_TABLE_PAGE_FILES];
+	for (i = 0, pool = 1; i < CRUD_TABLE_PAGE_FILES; i++) {
+		rec[i].object_id = ent[i].object_id;
+		rec[i].length = ent[i].length;
+		rec[i].capacity = ent[i].capacity;
+		rec[i].name = 0;
+		if (ent[i].filename[0] != 0x0) {
+			rec[i].name = pool;
+			strcpy(&names[pool], ent[i].filename);
+			pool += strlen(ent[i].filename) + 1;
+		}
+	}
 
-	if (initFlag == 0) {
-		request = construct_crud_request(0, CRUD_INIT, 0, 0, 0);
-		response = crud_bus_request(request, NULL); // Initialize Object Store
-		if (response & 0x1) //Sucsessfull CRUD Request
-			return (0); // Failure to create new Object Store
-		initFlag = 1;
+	// Same size page, just update it in place
+	if (ref->oid != 0 && ref->length == length) {
+		request = construct_crud_request(ref->oid, CRUD_UPDATE, length, 0, 0);
+		response = crud_batch_request(request, page);
+	} else {
+		if (ref->oid != 0) {
+			request = construct_crud_request(ref->oid, CRUD_DELETE, 0, 0, 0);
+			response = crud_batch_request(request, NULL);
+			if (response & 0x1) {
+				crud_scratch_release(mark);
+				return (-1);
+			}
+		}
+		request = construct_crud_request(0, CRUD_CREATE, length, 0, 0);
+		response = crud_batch_request(request, page);
+		ref->oid = (response & 0x1) ? 0 : (response >> 32);
+		ref->length = length;
+		crud_directory_dirty = 1;
 	}
-	return (1);
+	crud_scratch_release(mark);
+
+	if (response & 0x1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO : File table page %u write failed.", pg);
+		return (-1);
+	}
+	crud_page_dirty[pg] = 0;
+	return (0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_table
+// Description  : Write back the dirty file table pages, then the page
+//                directory and superblock if they changed
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-int16_t crud_open(char *path) {
-	int fh;
-	CRUD_REQUEST_TYPES req;
-	uint32_t length;
-	uint8_t flags, res;
-	CrudOID oid;
-	char *buff;
+int crud_save_table(void) {
+	uint32_t pg, npages = crud_table_size / CRUD_TABLE_PAGE_FILES;
+	CrudResponse response;
 	CrudRequest request;
+
+	for (pg = 0; pg < npages; pg++) {
+		if (crud_page_dirty[pg] && crud_save_page(pg))
+			return (-1);
+	}
+
+	if (!crud_directory_dirty && npages == crud_saved_pages)
+		return (0);
+
+	// Same size directory, just update it in place
+	if (crud_superblock.directory != 0 && npages == crud_saved_pages) {
+		request = construct_crud_request(crud_superblock.directory, CRUD_UPDATE,
+			npages * sizeof(CrudTablePageRef), 0, 0);
+		response = crud_batch_request(request, crud_page_refs);
+		if (response & 0x1)
+			return (-1);
+		crud_directory_dirty = 0;
+		return (0);
+	}
+
+	// Table grew, move the directory to a new object and point the superblock at it
+	if (crud_superblock.directory != 0) {
+		request = construct_crud_request(crud_superblock.directory, CRUD_DELETE, 0, 0, 0);
+		response = crud_batch_request(request, NULL);
+		if (response & 0x1)
+			return (-1);
+	}
+	request = construct_crud_request(0, CRUD_CREATE, npages * sizeof(CrudTablePageRef), 0, 0);
+	response = crud_batch_request(request, crud_page_refs);
+	if (response & 0x1)
+		return (-1);
+	crud_superblock.directory = (response >> 32);
+	crud_superblock.npages = npages;
+
+	request = construct_crud_request(0, CRUD_UPDATE, sizeof(CrudTableSuperblock),
+		CRUD_PRIORITY_OBJECT, 0);
+	response = crud_batch_request(request, &crud_superblock);
+	if (response & 0x1)
+		return (-1);
+
+	crud_saved_pages = npages;
+	crud_directory_dirty = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_table
+// Description  : Read the superblock, page directory and table pages in
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_load_table(void) {
+	CrudTableSuperblock sb;
+	CrudTablePageHeader *hdr;
+	CrudTableRecord *rec;
+	CrudFileAllocationType *ent;
 	CrudResponse response;
+	CrudRequest request;
+	uint32_t pg, i;
+	char *page, *names;
+	CrudScratchMark mark;
+
+	request = construct_crud_request(0, CRUD_READ, sizeof(CrudTableSuperblock),
+		CRUD_PRIORITY_OBJECT, 0);
+	response = crud_batch_request(request, &sb);
+	if ((response & 0x1) || sb.magic != CRUD_TABLE_MAGIC) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT : No file table superblock.");
+		return (-1);
+	}
+
+	crud_reset_table();
+	if (crud_grow_table(sb.npages * CRUD_TABLE_PAGE_FILES > CRUD_MAX_TOTAL_FILES ?
+			sb.npages * CRUD_TABLE_PAGE_FILES : CRUD_MAX_TOTAL_FILES))
+		return (-1);
+	crud_superblock = sb;
+	crud_saved_pages = sb.npages;
+	if (sb.npages == 0)
+		return (0);
+
+	request = construct_crud_request(sb.directory, CRUD_READ,
+		sb.npages * sizeof(CrudTablePageRef), 0, 0);
+	response = crud_batch_request(request, crud_page_refs);
+	if (response & 0x1)
+		return (-1);
+
+	// Decode each stored page, empty pages have no object
+	for (pg = 0; pg < sb.npages; pg++) {
+		if (crud_page_refs[pg].oid == 0)
+			continue;
+		mark = crud_scratch_mark();
+		if ((page = crud_scratch_alloc(crud_page_refs[pg].length)) == NULL)
+			return (-1);
+		request = construct_crud_request(crud_page_refs[pg].oid, CRUD_READ,
+			crud_page_refs[pg].length, 0, 0);
+		response = crud_batch_request(request, page);
+		if (response & 0x1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT : File table page %u read failed.", pg);
+			crud_scratch_release(mark);
+			return (-1);
+		}
+
+		hdr = (CrudTablePageHeader *)page;
+		rec = (CrudTableRecord *)&page[sizeof(CrudTablePageHeader)];
+		names = (char *)&rec[hdr->nrecords];
+		ent = &crud_file_table[pg * CRUD_TABLE_PAGE_FILES];
+		for (i = 0; i < hdr->nrecords && i < CRUD_TABLE_PAGE_FILES; i++) {
+			ent[i].object_id = rec[i].object_id;
+			ent[i].length = rec[i].length;
+			ent[i].capacity = rec[i].capacity;
+			strncpy(ent[i].filename, &names[rec[i].name], CRUD_MAX_PATH_LENGTH - 1);
+		}
+		crud_scratch_release(mark);
+	}
+
+	crud_build_index();
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_lock_table
+// Description  : Lock the file table for a call that changes it, charging
+//                the bus requests made meanwhile to that call
+//
+// Inputs       : caller - the file IO call taking the lock
+// Outputs      : none
+
+void crud_lock_table(CRUD_STATS_CALLERS caller) {
+	pthread_rwlock_wrlock(&crud_table_lock);
+	crud_stats_set_caller(caller);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_unlock_table
+// Description  : Unlock the file table locked by crud_lock_table
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_unlock_table(void) {
+	crud_stats_set_caller(CRUD_CALL_NONE);
+	crud_stats_set_file(CRUD_TRACE_NO_FILE);
+	pthread_rwlock_unlock(&crud_table_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_open
+// Description  : This function opens the file and returns a file handle.
+//                A new file is only a table entry, with no objects (and no
+//                bus traffic) until it is first written.
+//
+// Inputs       : path - the path "in the storage array"
+// Outputs      : file handle if successful, -1 if failure
+
+int32_t crud_open(char *path) {
+	int32_t fh;
 
 	if (!initCheck())
 		return (-1);
@@ -78,127 +1110,374 @@ int16_t crud_open(char *path) {
 		return (-1); // Invalid Path
 	}
 
-	for (fh = 0; fh < CRUD_MAX_TOTAL_FILES && strcmp(crud_file_table[fh].filename, path) != 0; fh++)
-		; //Search for path in table
+	// Opening may grow the table, so nobody else may be using it
+	crud_lock_table(CRUD_CALL_OPEN);
+	if (crud_table_size == 0 && crud_grow_table(CRUD_MAX_TOTAL_FILES)) {
+		crud_unlock_table();
+		return (-1);
+	}
+	fh = crud_find_file(path); //Search for path in table
 
 	// File Not Created, Must Create it
-	if (fh == CRUD_MAX_TOTAL_FILES) {
-		fh = 0;
-		buff = malloc(CRUD_MAX_OBJECT_SIZE);
-
-		request = construct_crud_request(0, CRUD_CREATE, 0, 0, 0);
-		response = crud_bus_request(request, buff); 
-
-		//Find first empty spot in table
-		while (strcmp(crud_file_table[fh].filename, "") != 0) {
-			fh++;
-			if (fh == CRUD_MAX_TOTAL_FILES) {
-				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_OPEN : FULL FILE TABLE.");
-				return (-1); //No Room in File Table
-			}
+	if (fh == -1) {
+		//Take an empty spot in table, doubling the table when full
+		if (crud_free_count == 0 && crud_grow_table(crud_table_size * 2)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_OPEN : FULL FILE TABLE.");
+			crud_unlock_table();
+			return (-1); //No Room in File Table
 		}
+		fh = crud_free_slots[--crud_free_count];
 
-		deconstruct_crud_request(request, &oid, &req, &length, &flags, &res);
-		crud_file_table[fh].object_id = oid;
+		// Only the entry is made, the first write creates the objects
+		crud_file_table[fh].object_id = CRUD_NO_OBJECT;
 		crud_file_table[fh].position = 0;
-		crud_file_table[fh].length = length;
+		crud_file_table[fh].length = 0;
+		crud_file_table[fh].capacity = 0;
 		crud_file_table[fh].open = 1;
 		strcpy(crud_file_table[fh].filename, path);
-		free(buff);
+		crud_index_file(fh);
+		crud_mark_dirty(fh);
 	}
 	// File already Created, Must Open
 	else {
 		if (crud_file_table[fh].open == 1) {
 			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_OPEN : File Already Open.");
+			crud_unlock_table();
 			return (-1);
 		}
 
 		crud_file_table[fh].position = 0;
 		crud_file_table[fh].open = 1;
 	}
+	crud_trace_name(fh, path);
 
+	crud_unlock_table();
 	return (fh);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_close
-// Description  : This function closes the file
+// Function     : crud_release_handle
+// Description  : Unlock a handle locked by crud_lock_handle
 //
-// Inputs       : fd - the file handle of the object to close
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : fd - the file handle to unlock
+// Outputs      : none
+
+void crud_release_handle(int32_t fd) {
+	crud_stats_set_caller(CRUD_CALL_NONE);
+	crud_stats_set_file(CRUD_TRACE_NO_FILE);
+	pthread_mutex_unlock(&crud_handle_locks[fd % CRUD_HANDLE_LOCKS]);
+	pthread_rwlock_unlock(&crud_table_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_lock_handle
+// Description  : Check that a file handle refers to an open file, and lock
+//                it for the caller (released with crud_release_handle)
+//
+// Inputs       : fd - the file handle to check
+//                op - the operation label for the log message
+//                caller - the file IO call to charge bus requests to
+// Outputs      : 0 if valid (and locked), -1 if not
 
-int16_t crud_close(int16_t fd) {
+int crud_lock_handle(int32_t fd, const char *op, CRUD_STATS_CALLERS caller) {
 	if (!initCheck())
 		return (-1);
 
 	//Param Check
-	if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CLOSE : File Handle Invalid.");
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if (fd >= crud_table_size || fd < 0) {
+		logMessage(LOG_ERROR_LEVEL, "%s : File Handle Invalid.", op);
+		pthread_rwlock_unlock(&crud_table_lock);
 		return (-1);
 	}
 
+	pthread_mutex_lock(&crud_handle_locks[fd % CRUD_HANDLE_LOCKS]);
 	if (crud_file_table[fd].open == 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CLOSE : File Closed.");
+		logMessage(LOG_ERROR_LEVEL, "%s : File Closed.", op);
+		crud_release_handle(fd);
 		return (-1);
 	}
 
-	crud_file_table[fd].open = 0;
-
+	crud_stats_set_caller(caller);
+	crud_stats_set_file(fd);
 	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_read
-// Description  : Reads up to "count" bytes from the file handle "fh" into the
-//                buffer  "buf".
+// Function     : crud_check_handle
+// Description  : Lock a handle to an open file and load its block table
 //
-// Inputs       : fd - the file descriptor for the read
-//                buf - the buffer to place the bytes into
-//                count - the number of bytes to read
-// Outputs      : the number of bytes read or -1 if failures
+// Inputs       : fd - the file handle to check
+//                op - the operation label for the log message
+//                caller - the file IO call to charge bus requests to
+// Outputs      : 0 if valid (and locked), -1 if not
 
-int32_t crud_read(int16_t fd, void *buf, int32_t count) {
-	CrudResponse response;
-	CrudRequest request;
-	char *tbuf;
+int crud_check_handle(int32_t fd, const char *op, CRUD_STATS_CALLERS caller) {
+	if (crud_lock_handle(fd, op, caller))
+		return (-1);
 
-	if (!initCheck())
+	if (crud_load_blocks(fd)) {
+		crud_release_handle(fd);
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_close
+// Description  : This function closes the file
+//
+// Inputs       : fd - the file handle of the object to close
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t crud_close(int32_t fd) {
+	if (crud_lock_handle(fd, "CRUD_IO_CLOSE", CRUD_CALL_CLOSE))
 		return (-1);
 
-	//Param Check
-	if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_READ : File Handle Invalid.");
+	// Write back the cached blocks and block map before giving up the handle
+	if (crud_flush_blocks(fd)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CLOSE : Block write back failed.");
+		crud_release_handle(fd);
 		return (-1);
 	}
-	
-	if (crud_file_table[fd].open == 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_READ : File Closed.");
+	if (crud_save_blocks(fd)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CLOSE : Block map write failed.");
+		crud_release_handle(fd);
 		return (-1);
 	}
 
-	if (crud_file_table[fd].object_id == 0) //Edge Case Check
-		return (0);
-	
+	crud_file_table[fd].open = 0;
 
-	tbuf = malloc(crud_file_table[fd].length); //Size of object
-	request = construct_crud_request(
-		crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length, 0, 0);
-	response = crud_bus_request(request, tbuf); // Read Entire Object
+	crud_release_handle(fd);
+	return (0);
+}
 
-	if (response & 0x1) { // Check for good read
-		free(tbuf);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_direct
+// Description  : Get "len" contiguous bytes of the current vector, if it has
+//                that many left, and step past them
+//
+// Inputs       : cur - the vector cursor
+//                len - the number of bytes wanted
+// Outputs      : pointer to the bytes, or NULL if they span vectors
+
+char *crud_iov_direct(CrudIovCursor *cur, uint32_t len) {
+	char *ptr;
+
+	while (cur->cnt > 0 && cur->off == cur->iov->iov_len) {
+		cur->iov++;
+		cur->cnt--;
+		cur->off = 0;
+	}
+	if (cur->cnt == 0 || cur->iov->iov_len - cur->off < len)
+		return (NULL);
+
+	ptr = (char *)cur->iov->iov_base + cur->off;
+	cur->off += len;
+	return (ptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_copy
+// Description  : Copy "len" bytes between a flat buffer and the vectors at
+//                the cursor, stepping past them
+//
+// Inputs       : cur - the vector cursor
+//                buf - the flat buffer
+//                len - the number of bytes to copy
+//                gather - 1 to copy vectors into buf, 0 to copy buf out
+// Outputs      : none
+
+void crud_iov_copy(CrudIovCursor *cur, char *buf, uint32_t len, int gather) {
+	uint32_t n;
+	char *vec;
+
+	while (len > 0 && cur->cnt > 0) {
+		n = cur->iov->iov_len - cur->off;
+		if (n > len)
+			n = len;
+		vec = (char *)cur->iov->iov_base + cur->off;
+		if (gather)
+			memcpy(buf, vec, n);
+		else
+			memcpy(vec, buf, n);
+		buf += n;
+		len -= n;
+		cur->off += n;
+		if (cur->off == cur->iov->iov_len) {
+			cur->iov++;
+			cur->cnt--;
+			cur->off = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_length
+// Description  : Total up the bytes in a vector list
+//
+// Inputs       : iov - the vectors
+//                iovcnt - the number of vectors
+// Outputs      : the total bytes, or -1 if too large or invalid
+
+int32_t crud_iov_length(const struct iovec *iov, int iovcnt) {
+	size_t total = 0;
+	int i;
+
+	if (iovcnt < 0)
 		return (-1);
+	for (i = 0; i < iovcnt; i++) {
+		total += iov[i].iov_len;
+		if (total > INT32_MAX)
+			return (-1);
 	}
+	return ((int32_t)total);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_blocks
+// Description  : Read from the file at "pos" into the vectors, visiting each
+//                overlapped block once (the file position is untouched)
+//
+// Inputs       : fd - the (checked) file handle to read
+//                pos - the file offset to read from
+//                iov - the vectors to read into
+//                iovcnt - the number of vectors
+// Outputs      : the number of bytes read or -1 if failure
+
+int32_t crud_read_blocks(int32_t fd, uint64_t pos, const struct iovec *iov, int iovcnt) {
+	CrudIovCursor cur = { iov, iovcnt, 0 };
+	char blk[CRUD_BLOCK_SIZE], *dst;
+	uint32_t bno, boff, chunk;
+	int32_t count, done;
+	CrudOID oid;
+
+	if ((count = crud_iov_length(iov, iovcnt)) < 0)
+		return (-1);
 
 	// Count up to then end of the object
-	if (crud_file_table[fd].position + count > crud_file_table[fd].length)
-		count = crud_file_table[fd].length - crud_file_table[fd].position;
+	if (pos >= crud_file_table[fd].length)
+		return (0);
+	if (pos + count > crud_file_table[fd].length)
+		count = crud_file_table[fd].length - pos;
+
+	// Read only the blocks that overlap the requested range
+	for (done = 0; done < count; done += chunk, pos += chunk) {
+		bno = pos / CRUD_BLOCK_SIZE;
+		boff = pos % CRUD_BLOCK_SIZE;
+		chunk = CRUD_BLOCK_SIZE - boff;
+		if (chunk > count - done)
+			chunk = count - done;
+
+		// Straight into the vector if it holds the whole chunk, else scatter
+		if (crud_block_oid(fd, bno, &oid))
+			return (-1);
+		if ((dst = crud_iov_direct(&cur, chunk)) != NULL) {
+			if (crud_cache_read(oid, boff, dst, chunk))
+				return (-1);
+		} else {
+			if (crud_cache_read(oid, boff, blk, chunk))
+				return (-1);
+			crud_iov_copy(&cur, blk, chunk, 0);
+		}
+	}
 
-	memcpy(buf, &tbuf[crud_file_table[fd].position], count); // Copy Read data into buf
-	free(tbuf);
-	crud_file_table[fd].position += count; // UPdate pos
+	crud_stats_file_bytes(count);
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_blocks
+// Description  : Write the vectors to the file at "pos", visiting each
+//                overlapped block once (the file position is untouched)
+//
+// Inputs       : fd - the (checked) file handle to write
+//                pos - the file offset to write at (at most the length)
+//                iov - the vectors to write
+//                iovcnt - the number of vectors
+// Outputs      : the number of bytes written or -1 if failure
+
+int32_t crud_write_blocks(int32_t fd, uint64_t pos, const struct iovec *iov, int iovcnt) {
+	CrudBlockTable *bt = &crud_block_table[fd];
+	CrudIovCursor cur = { iov, iovcnt, 0 };
+	char blk[CRUD_BLOCK_SIZE], *src;
+	uint32_t bno, boff, chunk;
+	int32_t count, done;
+	CrudOID oid;
+
+	if ((count = crud_iov_length(iov, iovcnt)) < 0)
+		return (-1);
+	if (pos > crud_file_table[fd].length) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_WRITE : Position past end of file.");
+		return (-1);
+	}
+
+	// Touch only the blocks the write overlaps, appending new ones past the end
+	for (done = 0; done < count; done += chunk, pos += chunk) {
+		bno = pos / CRUD_BLOCK_SIZE;
+		boff = pos % CRUD_BLOCK_SIZE;
+		chunk = CRUD_BLOCK_SIZE - boff;
+		if (chunk > count - done)
+			chunk = count - done;
+
+		// New block at the end of the file
+		if (bno == bt->nblocks) {
+			memset(blk, 0x0, CRUD_BLOCK_SIZE);
+			crud_iov_copy(&cur, &blk[boff], chunk, 1);
+			if (crud_append_block(fd, blk))
+				return (-1);
+			continue;
+		}
+
+		// Gather the chunk if it spans vectors
+		if ((src = crud_iov_direct(&cur, chunk)) == NULL) {
+			crud_iov_copy(&cur, blk, chunk, 1);
+			src = blk;
+		}
+
+		//Update block with new data (written back by the cache)
+		if (crud_block_oid(fd, bno, &oid) || crud_cache_write(oid, boff, src, chunk))
+			return (-1);
+	}
+
+	if (pos > crud_file_table[fd].length) {
+		crud_file_table[fd].length = pos; //Update length
+		crud_mark_dirty(fd);
+	}
+	crud_stats_file_bytes(count);
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read
+// Description  : Reads up to "count" bytes from the file handle "fh" into the
+//                buffer  "buf".
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_read(int32_t fd, void *buf, int32_t count) {
+	struct iovec iov = { buf, count };
+
+	if (count < 0 || crud_check_handle(fd, "CRUD_IO_READ", CRUD_CALL_READ))
+		return (-1);
+
+	count = crud_read_blocks(fd, crud_file_table[fd].position, &iov, 1);
+	if (count > 0)
+		crud_file_table[fd].position += count; // UPdate pos
+	crud_release_handle(fd);
 	return (count);
 }
 
@@ -213,94 +1492,108 @@ int32_t crud_read(int16_t fd, void *buf, int32_t count) {
 //                count - the number of bytes to write
 // Outputs      : the number of bytes written or -1 if failure
 
-int32_t crud_write(int16_t fd, void *buf, int32_t count) {
-	CrudResponse response;
-	CrudRequest request;
-	char *tbuf;
-	char *cbuf;
+int32_t crud_write(int32_t fd, void *buf, int32_t count) {
+	struct iovec iov = { buf, count };
 
-	if (!initCheck())
+	if (count < 0 || crud_check_handle(fd, "CRUD_IO_WRITE", CRUD_CALL_WRITE))
 		return (-1);
 
-	// Param Check
-	if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_WRITE : File Handle Invalid.");
-		return (-1);
-	}
-	
-	if (crud_file_table[fd].open == 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_WRITE : File Closed.");
+	count = crud_write_blocks(fd, crud_file_table[fd].position, &iov, 1);
+	if (count > 0)
+		crud_file_table[fd].position += count; //Update pos
+	crud_release_handle(fd);
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pread
+// Description  : Reads up to "count" bytes at offset "off" without moving
+//                the file position
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+//                off - the file offset to read from
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_pread(int32_t fd, void *buf, int32_t count, uint64_t off) {
+	struct iovec iov = { buf, count };
+
+	if (count < 0 || crud_check_handle(fd, "CRUD_IO_PREAD", CRUD_CALL_PREAD))
 		return (-1);
-	}
+	count = crud_read_blocks(fd, off, &iov, 1);
+	crud_release_handle(fd);
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pwrite
+// Description  : Writes "count" bytes at offset "off" (at most the file
+//                length) without moving the file position
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                buf - the buffer to write
+//                count - the number of bytes to write
+//                off - the file offset to write at
+// Outputs      : the number of bytes written or -1 if failure
 
-	cbuf = calloc(crud_file_table[fd].length, 1); //Must zero mem in case read doesn't happen
+int32_t crud_pwrite(int32_t fd, void *buf, int32_t count, uint64_t off) {
+	struct iovec iov = { buf, count };
 
-	if (crud_file_table[fd].object_id != 0) {
+	if (count < 0 || crud_check_handle(fd, "CRUD_IO_PWRITE", CRUD_CALL_PWRITE))
+		return (-1);
+	count = crud_write_blocks(fd, off, &iov, 1);
+	crud_release_handle(fd);
+	return (count);
+}
 
-		// READ ALL OF OBJECT INTO CBUF
-		request = construct_crud_request(
-			crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length, 0, 0);
-		response = crud_bus_request(request, cbuf);
-		if (response & 0x1) { //MAKE SURE GOOD READ
-			free(cbuf);
-			return (-1);
-		}
-	}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_readv
+// Description  : Reads from the file position into several buffers in turn
+//
+// Inputs       : fd - the file descriptor for the read
+//                iov - the buffers to fill
+//                iovcnt - the number of buffers
+// Outputs      : the number of bytes read or -1 if failures
 
-	// Write to big for current Object
-	if (crud_file_table[fd].position + count > crud_file_table[fd].length) {
-		//Edge Case Check
-		if (crud_file_table[fd].object_id != 0) { 
-			// DELETE OLD OBJECT
-			request = construct_crud_request(
-				crud_file_table[fd].object_id, CRUD_DELETE, 0, 0, 0);
-			response = crud_bus_request(request, buf);
+int32_t crud_readv(int32_t fd, const struct iovec *iov, int iovcnt) {
+	int32_t count;
 
-			if (response & 0x1) { //MAKE SURE GOOD DELETE
-				free(cbuf);
-				return (-1);
-			}
-		}
+	if (crud_check_handle(fd, "CRUD_IO_READV", CRUD_CALL_READV))
+		return (-1);
 
-		tbuf = malloc(crud_file_table[fd].position + count);
-		
-		// TBUF DATA FOR NEW OBJECT
-		memcpy(tbuf, cbuf, crud_file_table[fd].length);
-		free(cbuf);
-		memcpy(&tbuf[crud_file_table[fd].position], buf, count);
-		
-		// CREATE NEW OBJECT
-		request = construct_crud_request(
-			0, CRUD_CREATE, crud_file_table[fd].position + count, 0, 0);
-		response = crud_bus_request(request, tbuf);
-		free(tbuf);
+	count = crud_read_blocks(fd, crud_file_table[fd].position, iov, iovcnt);
+	if (count > 0)
+		crud_file_table[fd].position += count;
+	crud_release_handle(fd);
+	return (count);
+}
 
-		if (response & 0x1) { //MAKE SURE GOOD CREATE
-			return (-1);
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writev
+// Description  : Writes several buffers in turn at the file position, each
+//                block they overlap being read-modify-written once
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                iov - the buffers to write
+//                iovcnt - the number of buffers
+// Outputs      : the number of bytes written or -1 if failure
 
-		crud_file_table[fd].object_id = (response >> 32); // Save new OID
-		crud_file_table[fd].length = crud_file_table[fd].position + count; //Update length
-		crud_file_table[fd].position += count; //Update pos
-		return (count);
-	}
-	else { //Object is large enough for write
-		memcpy(&cbuf[crud_file_table[fd].position], buf, count); //Copy new data into cbuf
-		
-		//Update Object with new buf
-		request = construct_crud_request(
-			crud_file_table[fd].object_id, CRUD_UPDATE, crud_file_table[fd].length, 0, 0);
-		response = crud_bus_request(request, cbuf);
-
-		if (response & 0x1) { //MAKE SURE GOOD UPDATE
-			free(cbuf);
-			return (-1);
-		}
+int32_t crud_writev(int32_t fd, const struct iovec *iov, int iovcnt) {
+	int32_t count;
+
+	if (crud_check_handle(fd, "CRUD_IO_WRITEV", CRUD_CALL_WRITEV))
+		return (-1);
 
+	count = crud_write_blocks(fd, crud_file_table[fd].position, iov, iovcnt);
+	if (count > 0)
 		crud_file_table[fd].position += count;
-		free(cbuf);
-		return (count);
-	}
+	crud_release_handle(fd);
+	return (count);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -312,31 +1605,92 @@ int32_t crud_write(int16_t fd, void *buf, int32_t count) {
 //                loc - offset from beginning of file to seek to
 // Outputs      : 0 if successful or -1 if failure
 
-int32_t crud_seek(int16_t fd, uint32_t loc) {
-	CrudResponse response;
-	CrudRequest request;
-	
-	if (!initCheck())
+int32_t crud_seek(int32_t fd, uint64_t loc) {
+	if (crud_lock_handle(fd, "CRUD_IO_SEEK", CRUD_CALL_SEEK))
 		return (-1);
 
-	if (fd >= CRUD_MAX_TOTAL_FILES || fd < 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_SEEK : File Handle Invalid.");
-		return (-1);
-	}
-	
-	if (crud_file_table[fd].open == 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_SEEK : File Closed.");
+	if (loc > crud_file_table[fd].length) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_SEEK : Loc Not Valid");
+		crud_release_handle(fd);
 		return (-1);
 	}
 
-	if (loc > crud_file_table[fd].length || loc < 0) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_SEEK : Loc Not Valid");
+	crud_file_table[fd].position = loc; //Update Position 
+	crud_release_handle(fd);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_truncate
+// Description  : Set the length of the file, deleting the blocks past a new
+//                end or zero filling up to a longer one (the position is
+//                pulled back to the end if past it)
+//
+// Inputs       : fd - the file descriptor for the file to truncate
+//                length - the new length of the file
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_truncate(int32_t fd, uint64_t length) {
+	char blk[CRUD_BLOCK_SIZE];
+	uint64_t nblocks;
+	uint32_t boff;
+	CrudOID oid;
+
+	if (crud_check_handle(fd, "CRUD_IO_TRUNCATE", CRUD_CALL_TRUNCATE))
+		return (-1);
+	nblocks = (length + CRUD_BLOCK_SIZE - 1) / CRUD_BLOCK_SIZE;
+
+	// Blocks held past the end are zero, so growing only adds missing ones
+	if (length < crud_file_table[fd].length) {
+		// Zero the rest of the new last block, it reads back past the end
+		boff = length % CRUD_BLOCK_SIZE;
+		if (boff != 0) {
+			memset(blk, 0x0, CRUD_BLOCK_SIZE - boff);
+			if (crud_block_oid(fd, length / CRUD_BLOCK_SIZE, &oid) ||
+					crud_cache_write(oid, boff, blk, CRUD_BLOCK_SIZE - boff)) {
+				crud_release_handle(fd);
+				return (-1);
+			}
+		}
+		if (crud_trim_blocks(fd, nblocks)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_TRUNCATE : Block delete failed.");
+			crud_release_handle(fd);
+			return (-1);
+		}
+	} else if (crud_extend_blocks(fd, nblocks)) {
+		crud_release_handle(fd);
 		return (-1);
 	}
 
-	crud_file_table[fd].position = loc; //Update Position 
+	crud_file_table[fd].length = length;
+	if (crud_file_table[fd].position > length)
+		crud_file_table[fd].position = length;
+	crud_mark_dirty(fd);
+	crud_release_handle(fd);
 	return (0);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fallocate
+// Description  : Create the blocks for the first "length" bytes of the file
+//                up front, so later writes up to there only update them
+//                (the length of the file does not change)
+//
+// Inputs       : fd - the file descriptor for the file to size
+//                length - the number of bytes to hold
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_fallocate(int32_t fd, uint64_t length) {
+	int32_t ret;
+
+	if (crud_check_handle(fd, "CRUD_IO_FALLOCATE", CRUD_CALL_FALLOCATE))
+		return (-1);
+	ret = crud_extend_blocks(fd, (length + CRUD_BLOCK_SIZE - 1) / CRUD_BLOCK_SIZE);
+	crud_release_handle(fd);
+	return (ret);
+}
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : crud_format
@@ -353,27 +1707,31 @@ uint16_t crud_format(void) {
 	if (!initCheck())
 		return (-1);
 
+	crud_lock_table(CRUD_CALL_FORMAT);
 	request = construct_crud_request(0, CRUD_FORMAT, 0, 0, 0);
-	response = crud_bus_request(request, NULL); // Initialize Object Store
-	if (response & 0x1) //Sucsessfull CRUD Request
+	response = crud_batch_request(request, NULL); // Initialize Object Store
+	if (response & 0x1) { //Sucsessfull CRUD Request
+		crud_unlock_table();
 		return (-1); // Failure to Format new Object Store
-
-
-	//Set Crud_File_Table to 0's
-	for (int i = 0; i < CRUD_MAX_TOTAL_FILES; i++) {
-		crud_file_table[i].length = 0;
-		crud_file_table[i].object_id = 0;
-		crud_file_table[i].position = 0;
-		crud_file_table[i].open = 0;
-		strcpy(crud_file_table[i].filename, "");
 	}
 
 
+	// Cached blocks belong to the old store
+	crud_cache_clear();
+
+	// Start over with an empty file table and no stored pages
+	crud_reset_table();
+	if (crud_grow_table(CRUD_MAX_TOTAL_FILES)) {
+		crud_unlock_table();
+		return (-1);
+	}
+	crud_superblock.magic = CRUD_TABLE_MAGIC;
 
 	request = construct_crud_request(
-		0, CRUD_CREATE, CRUD_FILE_SIZE * CRUD_MAX_TOTAL_FILES,
+		0, CRUD_CREATE, sizeof(CrudTableSuperblock),
 		CRUD_PRIORITY_OBJECT, 0);
-	response = crud_bus_request(request, crud_file_table);
+	response = crud_batch_request(request, &crud_superblock);
+	crud_unlock_table();
 
 	if (response & 0x1) //Sucsessfull CRUD Request
 		return (-1); // Failure to Create Priority object
@@ -393,20 +1751,17 @@ uint16_t crud_format(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 uint16_t crud_mount(void) {
-	CrudResponse response;
-	CrudRequest request;
-
 	if (!initCheck())
 		return (-1);
 
-	request = construct_crud_request(
-		0, CRUD_READ, CRUD_FILE_SIZE * CRUD_MAX_TOTAL_FILES,
-		CRUD_PRIORITY_OBJECT, 0);
-	response = crud_bus_request(request, crud_file_table);
-
-	if (response & 0x1) //Sucsessfull CRUD Request
-		return (-1); 
-
+	// Block tables are read in lazily on first use
+	crud_lock_table(CRUD_CALL_MOUNT);
+	crud_cache_clear();
+	if (crud_load_table()) {
+		crud_unlock_table();
+		return (-1);
+	}
+	crud_unlock_table();
 
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... mount complete.");
@@ -430,16 +1785,29 @@ uint16_t crud_unmount(void) {
 		return (0);
 	}
 
-	request = construct_crud_request(
-		0, CRUD_UPDATE, sizeof(CrudFileAllocationType) * CRUD_MAX_TOTAL_FILES,
-		CRUD_PRIORITY_OBJECT, 0);
-	response = crud_bus_request(request, crud_file_table);
+	// Write back the cache and the block tables of files still open
+	crud_lock_table(CRUD_CALL_UNMOUNT);
+	if (crud_cache_flush()) {
+		crud_unlock_table();
+		return (-1);
+	}
+	crud_cache_clear();
+	for (int32_t i = 0; i < crud_table_size; i++) {
+		if (crud_save_blocks(i)) {
+			crud_unlock_table();
+			return (-1);
+		}
+	}
 
-	if (response & 0x1) //Sucsessfull CRUD Request
-		return (-1); 
+	// Write back only the file table pages that changed
+	if (crud_save_table()) {
+		crud_unlock_table();
+		return (-1);
+	}
 
 	request = construct_crud_request(0, CRUD_CLOSE, 0, 0, 0);
-	response = crud_bus_request(request, NULL);
+	response = crud_batch_request(request, NULL);
+	crud_unlock_table();
 
 	if (response & 0x1) //Sucsessfull CRUD Request
 		return (-1); 
@@ -454,6 +1822,119 @@ uint16_t crud_unmount(void) {
 
 // Module local methods
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_large_byte
+// Description  : Get the expected contents of the large test file at an offset
+//
+// Inputs       : off - the file offset
+// Outputs      : the byte at that offset
+
+uint8_t crud_large_byte(uint64_t off) {
+	return ((uint8_t)((off * 31) ^ (off >> 13)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_large_check
+// Description  : Read a range of the large test file and check it
+//
+// Inputs       : fh - the open test file
+//                buf - a buffer of CRUD_IO_LARGE_CHUNK bytes
+//                off - the offset to read at
+//                count - the bytes to read (at most CRUD_IO_LARGE_CHUNK)
+//                length - the expected length of the file
+// Outputs      : 0 if successful or -1 if failure
+
+int crud_large_check(int32_t fh, uint8_t *buf, uint64_t off, int32_t count, uint64_t length) {
+	int32_t bytes, expected, i;
+
+	expected = (off >= length) ? 0 : ((off + count > length) ? length - off : count);
+	if ((bytes = crud_pread(fh, buf, count, off)) != expected) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : large pread at %lu of [%d!=%d]", off, bytes, expected);
+		return (-1);
+	}
+	for (i = 0; i < bytes; i++) {
+		if (buf[i] != crud_large_byte(off + i)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : large data mismatch at %lu", off + i);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudIOLargeFileTest
+// Description  : Write a file spanning several extents, check it across a
+//                remount, then truncate it back to one extent and check again
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudIOLargeFileTest(void) {
+	uint64_t length, off;
+	int32_t fh, count, i;
+	uint8_t *buf;
+	int ret = -1;
+
+	if ((buf = malloc(CRUD_IO_LARGE_CHUNK)) == NULL)
+		return (-1);
+
+	// Write the file in random sized pieces
+	if ((fh = crud_open("large_file.txt")) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure large open operation.");
+		goto done;
+	}
+	for (off = 0; off < CRUD_IO_LARGE_LENGTH; off += count) {
+		count = crud_rand_value(1, CRUD_IO_LARGE_CHUNK);
+		if (off + count > CRUD_IO_LARGE_LENGTH)
+			count = CRUD_IO_LARGE_LENGTH - off;
+		for (i = 0; i < count; i++)
+			buf[i] = crud_large_byte(off + i);
+		if (crud_write(fh, buf, count) != count) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : large write failed at %lu.", off);
+			goto done;
+		}
+	}
+
+	// Check it from a fresh mount, reading across extents and the end
+	if (crud_close(fh) || crud_unmount() || crud_mount() || ((fh = crud_open("large_file.txt")) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure large remount.");
+		goto done;
+	}
+	for (i = 0; i < CRUD_IO_LARGE_CHECKS; i++) {
+		off = crud_rand_value(0, CRUD_IO_LARGE_LENGTH);
+		if (crud_large_check(fh, buf, off, crud_rand_value(0, CRUD_IO_LARGE_CHUNK), CRUD_IO_LARGE_LENGTH))
+			goto done;
+	}
+	if (crud_large_check(fh, buf, CRUD_EXTENT_BLOCKS * CRUD_BLOCK_SIZE - 100, 200, CRUD_IO_LARGE_LENGTH))
+		goto done;
+
+	// Cut it back past the first extent, then into it, checking after each
+	for (i = 0; i < 2; i++) {
+		length = (i == 0) ? CRUD_EXTENT_BLOCKS * CRUD_BLOCK_SIZE + 1234 : 5000;
+		if (crud_truncate(fh, length) || crud_close(fh) || crud_unmount() || crud_mount() ||
+				((fh = crud_open("large_file.txt")) == -1)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure large truncate to %lu.", length);
+			goto done;
+		}
+		if (crud_large_check(fh, buf, length - 3000, CRUD_IO_LARGE_CHUNK, length) ||
+				crud_large_check(fh, buf, 0, CRUD_IO_LARGE_CHUNK, length))
+			goto done;
+	}
+
+	if (crud_truncate(fh, 0) || crud_close(fh)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure large close.");
+		goto done;
+	}
+	ret = 0;
+
+done:
+	free(buf);
+	return (ret);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : crudIOUnitTest
@@ -466,9 +1947,10 @@ int crudIOUnitTest(void) {
 
 	// Local variables
 	uint8_t ch;
-	int16_t fh, i;
-	int32_t cio_utest_length, cio_utest_position, count, bytes, expected;
+	int32_t fh, i;
+	int32_t cio_utest_length, cio_utest_position, count, bytes, expected, off;
 	char *cio_utest_buffer, *tbuf;
+	struct iovec iov[3];
 	CRUD_UNIT_TEST_TYPE cmd;
 	char lstr[1024];
 
@@ -492,21 +1974,28 @@ int crudIOUnitTest(void) {
 		return(-1);
 	}
 
-	// Now do a bunch of operations
+	// Now do a bunch of operations, queuing bus requests in batches
+	crud_batch_begin();
 	for (i=0; i<CRUD_IO_UNIT_TEST_ITERATIONS; i++) {
 
+		// Dispatch the queued requests every so often
+		if ((i % CRUD_IO_UNIT_TEST_BATCH) == 0 && crud_batch_flush()) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Batch flush failed.");
+			return(-1);
+		}
+
 		// Pick a random command
 		if (cio_utest_length == 0) {
 			cmd = CIO_UNIT_TEST_WRITE;
 		} else {
-			cmd = getRandomValue(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_SEEK);
+			cmd = crud_rand_value(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_FALLOCATE);
 		}
 
 		// Execute the command
 		switch (cmd) {
 
 		case CIO_UNIT_TEST_READ: // read a random set of data
-			count = getRandomValue(0, cio_utest_length);
+			count = crud_rand_value(0, cio_utest_length);
 			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read %d at position %d", bytes, cio_utest_position);
 			bytes = crud_read(fh, tbuf, count);
 			if (bytes == -1) {
@@ -543,9 +2032,9 @@ int crudIOUnitTest(void) {
 
 		case CIO_UNIT_TEST_APPEND: // Append data onto the end of the file
 			// Create random block, check to make sure that the write is not too large
-			ch = getRandomValue(0, 0xff);
-			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
-			if (cio_utest_length+count >= CRUD_MAX_OBJECT_SIZE) {
+			ch = crud_rand_value(0, 0xff);
+			count =  crud_rand_value(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			if (cio_utest_length+count < CRUD_MAX_OBJECT_SIZE) {
 
 				// Log, seek to end of file, create random value
 				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : append of %d bytes [%x]", count, ch);
@@ -568,8 +2057,8 @@ int crudIOUnitTest(void) {
 			break;
 
 		case CIO_UNIT_TEST_WRITE: // Write random block to the file
-			ch = getRandomValue(0, 0xff);
-			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			ch = crud_rand_value(0, 0xff);
+			count =  crud_rand_value(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
 			// Check to make sure that the write is not too large
 			if (cio_utest_length+count < CRUD_MAX_OBJECT_SIZE) {
 				// Log the write, perform it
@@ -588,7 +2077,7 @@ int crudIOUnitTest(void) {
 			break;
 
 		case CIO_UNIT_TEST_SEEK:
-			count = getRandomValue(0, cio_utest_length);
+			count = crud_rand_value(0, cio_utest_length);
 			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : seek to position %d", count);
 			if (crud_seek(fh, count)) {
 				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : seek failed [%d].", count);
@@ -597,6 +2086,99 @@ int crudIOUnitTest(void) {
 			cio_utest_position = count;
 			break;
 
+		case CIO_UNIT_TEST_PREAD: // read a random range without moving the position
+			off = crud_rand_value(0, cio_utest_length);
+			count = crud_rand_value(0, cio_utest_length);
+			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : pread %d at offset %d", count, off);
+			bytes = crud_pread(fh, tbuf, count, off);
+			expected = (off+count > cio_utest_length) ? cio_utest_length-off : count;
+			if (bytes != expected) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : short/long pread of [%d!=%d]", bytes, expected);
+				return(-1);
+			}
+			if ( (bytes > 0) && (memcmp(&cio_utest_buffer[off], tbuf, bytes)) ) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : pread data mismatch (%d)", bytes);
+				return(-1);
+			}
+			break;
+
+		case CIO_UNIT_TEST_PWRITE: // Write random block at a random offset, position stays put
+			ch = crud_rand_value(0, 0xff);
+			off = crud_rand_value(0, cio_utest_length);
+			count =  crud_rand_value(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			if (off+count < CRUD_MAX_OBJECT_SIZE) {
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : pwrite of %d bytes at %d [%x]", count, off, ch);
+				memset(&cio_utest_buffer[off], ch, count);
+				bytes = crud_pwrite(fh, &cio_utest_buffer[off], count, off);
+				if (bytes!=count) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : pwrite failed [%d].", count);
+					return(-1);
+				}
+				if (off+count > cio_utest_length) {
+					cio_utest_length = off+count;
+				}
+			}
+			break;
+
+		case CIO_UNIT_TEST_WRITEV: // Write three random blocks in one vectored write
+			count = 0;
+			for (expected=0; expected<3; expected++) {
+				ch = crud_rand_value(0, 0xff);
+				bytes = crud_rand_value(0, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+				memset(&tbuf[count], ch, bytes);
+				iov[expected].iov_base = &tbuf[count];
+				iov[expected].iov_len = bytes;
+				count += bytes;
+			}
+			if (cio_utest_position+count < CRUD_MAX_OBJECT_SIZE) {
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : writev of %d bytes", count);
+				memcpy(&cio_utest_buffer[cio_utest_position], tbuf, count);
+				bytes = crud_writev(fh, iov, 3);
+				if (bytes!=count) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : writev failed [%d].", count);
+					return(-1);
+				}
+				cio_utest_position += bytes;
+				if (cio_utest_position > cio_utest_length) {
+					cio_utest_length = cio_utest_position;
+				}
+			}
+			break;
+
+		case CIO_UNIT_TEST_TRUNCATE: // Cut the file back or zero fill it longer
+			count = crud_rand_value(cio_utest_length/2, cio_utest_length + 4*CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			if (count < CRUD_MAX_OBJECT_SIZE) {
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : truncate to %d bytes", count);
+				if (crud_truncate(fh, count)) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : truncate failed [%d].", count);
+					return(-1);
+				}
+				if (count > cio_utest_length) {
+					memset(&cio_utest_buffer[cio_utest_length], 0x0, count - cio_utest_length);
+				}
+				cio_utest_length = count;
+				if (cio_utest_position > cio_utest_length) {
+					cio_utest_position = cio_utest_length;
+				}
+			}
+			break;
+
+		case CIO_UNIT_TEST_FALLOCATE: // Hold blocks past the end, the contents must not change
+			count = crud_rand_value(0, cio_utest_length + 4*CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			if (count < CRUD_MAX_OBJECT_SIZE) {
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : fallocate %d bytes", count);
+				if (crud_fallocate(fh, count)) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : fallocate failed [%d].", count);
+					return(-1);
+				}
+				bytes = crud_pread(fh, tbuf, cio_utest_length + 1, 0);
+				if ((bytes != cio_utest_length) || memcmp(cio_utest_buffer, tbuf, bytes)) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : fallocate changed the file [%d].", bytes);
+					return(-1);
+				}
+			}
+			break;
+
 		default: // This should never happen
 			CMPSC_ASSERT0(0, "CRUD_IO_UNIT_TEST : illegal test command.");
 			break;
@@ -609,16 +2191,30 @@ int crudIOUnitTest(void) {
 		CrudResponse response;
 		CrudOID oid;
 		CRUD_REQUEST_TYPES req;
-		uint32_t length;
+		uint32_t length, b, blen;
 		uint8_t res, flags;
+		char vblk[CRUD_BLOCK_SIZE];
 
-		// Make a fake request to get file handle, then check it
-		request = construct_crud_request(crud_file_table[0].object_id, CRUD_READ, CRUD_MAX_OBJECT_SIZE, CRUD_NULL_FLAG, 0);
-		response = crud_bus_request(request, tbuf);
-		if ((deconstruct_crud_request(response, &oid, &req, &length, &flags, &res) != 0) || (res != 0))  {
-			logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
+		// Push cached and queued writes out, reassemble the file from its block objects, then check it
+		if (crud_cache_flush() || crud_batch_flush()) {
+			logMessage(LOG_ERROR_LEVEL, "Cache/batch flush failed before validation");
 			return(-1);
 		}
+		length = crud_file_table[fh].length;
+		for (b = 0; b * CRUD_BLOCK_SIZE < length; b++) {
+			if (crud_block_oid(fh, b, &oid)) {
+				logMessage(LOG_ERROR_LEVEL, "Block map read failed before validation");
+				return(-1);
+			}
+			request = construct_crud_request(oid, CRUD_READ, CRUD_BLOCK_SIZE, CRUD_NULL_FLAG, 0);
+			response = crud_batch_request(request, vblk);
+			if ((deconstruct_crud_request(response, &oid, &req, &blen, &flags, &res) != 0) || (res != 0))  {
+				logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
+				return(-1);
+			}
+			blen = (length - b*CRUD_BLOCK_SIZE < CRUD_BLOCK_SIZE) ? length - b*CRUD_BLOCK_SIZE : CRUD_BLOCK_SIZE;
+			memcpy(&tbuf[b*CRUD_BLOCK_SIZE], vblk, blen);
+		}
 		if ( (cio_utest_length != length) || (memcmp(cio_utest_buffer, tbuf, length)) ) {
 			logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed [%x]", response);
 			bufToString((unsigned char *)tbuf, length, (unsigned char *)lstr, 1024 );
@@ -636,13 +2232,18 @@ int crudIOUnitTest(void) {
 	}
 
 	// Close the files and cleanup buffers, assert on failure
-	if (crud_close(fh)) {
+	if (crud_close(fh) || crud_batch_end()) {
 		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure read comparison block.", fh);
 		return(-1);
 	}
 	free(cio_utest_buffer);
 	free(tbuf);
 
+	// Files larger than an object, spread over several extents
+	if (crudIOLargeFileTest()) {
+		return(-1);
+	}
+
 	// Format and mount the file system
 	if (crud_unmount()) {
 		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on unmount operation.");
@@ -685,3 +2286,186 @@ int crudIOUnitTest(void) {
 
 
 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stress_worker
+// Description  : Run random operations against one file, checking them
+//                against a mirror of its contents (one stress test thread)
+//
+// Inputs       : arg - the CrudStressThread of the thread
+// Outputs      : NULL (the result is left in the thread state)
+
+void *crud_stress_worker(void *arg) {
+	CrudStressThread *st = arg;
+	char fname[CRUD_MAX_PATH_LENGTH], *tbuf;
+	int32_t fh, i, position = 0, count, bytes, expected, off;
+	CRUD_UNIT_TEST_TYPE cmd;
+	uint8_t ch;
+
+	// Each thread draws from its own stream, so a seed replays the same run
+	crud_rand_stream(st->id + 1);
+	st->result = -1;
+	snprintf(fname, CRUD_MAX_PATH_LENGTH, "stress_file_%d.txt", st->id);
+	if ((tbuf = malloc(CRUD_IO_STRESS_MAX_LENGTH)) == NULL)
+		return (NULL);
+	if ((fh = crud_open(fname)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] open failed.", fname);
+		free(tbuf);
+		return (NULL);
+	}
+
+	for (i=1; i<=CRUD_IO_STRESS_ITERATIONS; i++) {
+
+		// Pick a random command, appends and vectors are just writes here
+		cmd = (st->length == 0) ? CIO_UNIT_TEST_WRITE : crud_rand_value(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_PWRITE);
+		ch = crud_rand_value(0, 0xff);
+		count = crud_rand_value(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+
+		switch (cmd) {
+
+		case CIO_UNIT_TEST_READ: // read at the position, checking the mirror
+			bytes = crud_read(fh, tbuf, count);
+			expected = (position+count > st->length) ? st->length-position : count;
+			if ((bytes != expected) || memcmp(&st->mirror[position], tbuf, bytes)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] read mismatch at %d.", fname, position);
+				goto done;
+			}
+			position += bytes;
+			break;
+
+		case CIO_UNIT_TEST_WRITE: // write at the position
+		case CIO_UNIT_TEST_APPEND:
+			if (position+count > CRUD_IO_STRESS_MAX_LENGTH)
+				break;
+			memset(&st->mirror[position], ch, count);
+			if (crud_write(fh, &st->mirror[position], count) != count) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] write failed.", fname);
+				goto done;
+			}
+			position += count;
+			if (position > st->length)
+				st->length = position;
+			break;
+
+		case CIO_UNIT_TEST_SEEK:
+			position = crud_rand_value(0, st->length);
+			if (crud_seek(fh, position)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] seek failed.", fname);
+				goto done;
+			}
+			break;
+
+		case CIO_UNIT_TEST_PREAD: // read a random range, position stays put
+			off = crud_rand_value(0, st->length);
+			bytes = crud_pread(fh, tbuf, count, off);
+			expected = (off+count > st->length) ? st->length-off : count;
+			if ((bytes != expected) || memcmp(&st->mirror[off], tbuf, bytes)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] pread mismatch at %d.", fname, off);
+				goto done;
+			}
+			break;
+
+		default: // write at a random offset, position stays put
+			off = crud_rand_value(0, st->length);
+			if (off+count > CRUD_IO_STRESS_MAX_LENGTH)
+				break;
+			memset(&st->mirror[off], ch, count);
+			if (crud_pwrite(fh, &st->mirror[off], count, off) != count) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] pwrite failed.", fname);
+				goto done;
+			}
+			if (off+count > st->length)
+				st->length = off+count;
+			break;
+		}
+
+		// Close and reopen now and then, opens lock out every other thread
+		if ((i % CRUD_IO_STRESS_REOPEN) == 0) {
+			if (crud_close(fh) || ((fh = crud_open(fname)) == -1)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] reopen failed.", fname);
+				free(tbuf);
+				return (NULL);
+			}
+			position = 0;
+		}
+	}
+	st->result = 0;
+
+done:
+	if (crud_close(fh))
+		st->result = -1;
+	free(tbuf);
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudIOStressTest
+// Description  : Run random operations on "threads" files from as many
+//                threads at once, then remount and check every file
+//
+// Inputs       : threads - the number of threads (and files)
+// Outputs      : 0 if successful or -1 if failure
+
+int crudIOStressTest(int threads) {
+	CrudStressThread *st;
+	pthread_t *tids;
+	char fname[CRUD_MAX_PATH_LENGTH], *tbuf;
+	int32_t fh, i, failed = 0;
+
+	// Setup the thread state and a clean file system
+	st = calloc(threads, sizeof(CrudStressThread));
+	tids = calloc(threads, sizeof(pthread_t));
+	tbuf = malloc(CRUD_IO_STRESS_MAX_LENGTH);
+	if (st == NULL || tids == NULL || tbuf == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : Unable to allocate thread state.");
+		return(-1);
+	}
+	if (crud_format() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : Failure on format or mount operation.");
+		return(-1);
+	}
+
+	// Run the threads against the shared cache and request batch
+	crud_batch_begin();
+	for (i=0; i<threads; i++) {
+		st[i].id = i;
+		st[i].mirror = calloc(1, CRUD_IO_STRESS_MAX_LENGTH);
+		if (pthread_create(&tids[i], NULL, crud_stress_worker, &st[i])) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : Unable to start thread %d.", i);
+			return(-1);
+		}
+	}
+	for (i=0; i<threads; i++) {
+		pthread_join(tids[i], NULL);
+		failed |= st[i].result;
+	}
+	if (crud_batch_end() || failed || crud_unmount() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : Threaded operations failed.");
+		return(-1);
+	}
+
+	// Every file must have come through the remount intact
+	for (i=0; i<threads && !failed; i++) {
+		snprintf(fname, CRUD_MAX_PATH_LENGTH, "stress_file_%d.txt", i);
+		if (((fh = crud_open(fname)) == -1) ||
+				(crud_read(fh, tbuf, CRUD_IO_STRESS_MAX_LENGTH) != st[i].length) ||
+				memcmp(tbuf, st[i].mirror, st[i].length) || crud_close(fh)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : [%s] contents lost on remount.", fname);
+			failed = -1;
+		}
+	}
+	for (i=0; i<threads; i++)
+		free(st[i].mirror);
+	free(st);
+	free(tids);
+	free(tbuf);
+
+	if (failed || crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_STRESS_TEST : Failure on final check or unmount.");
+		return(-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_STRESS_TEST : %d threads completed successfully.", threads);
+	return(0);
+}
@@ -13,22 +13,30 @@
 
 // Include files
 #include <stdint.h>
+#include <sys/uio.h>
 
 // Project include files
 #include <crud_driver.h>
 
 // Defines
-#define CRUD_MAX_TOTAL_FILES 1024
+#define CRUD_MAX_TOTAL_FILES 1024 // Initial file table size, grown as needed
 #define CRUD_MAX_PATH_LENGTH 128
 #define CRUD_FILE_SIZE sizeof(CrudFileAllocationType)
+#define CRUD_BLOCK_SIZE 4096
+#define CRUD_BLOCK_OID_SIZE sizeof(CrudOID)
 // Type definitions
 
 // This is the basic file handle structure (note: index into file table is fh)
+//  The file contents are stored as a sequence of CRUD_BLOCK_SIZE block objects,
+//  and object_id is the root of the map of their OIDs (0 if empty), so a file
+//  may be far larger than CRUD_MAX_OBJECT_SIZE.  The blocks may run past the
+//  end of the file (capacity), reading as zeros.
 typedef struct {
 	char      filename[CRUD_MAX_PATH_LENGTH]; // The filename of the data to be manipulated
-	CrudOID   object_id;                      // The handle of the object
-	uint32_t  position;                       // This is the position of the file
-	uint32_t  length;                         // This is the length of the file
+	CrudOID   object_id;                      // The handle of the block map object
+	uint64_t  position;                       // This is the position of the file
+	uint64_t  length;                         // This is the length of the file
+	uint64_t  capacity;                       // The bytes held by the block objects
 	uint8_t   open;                           // Flag indicating the file is currently open
 } CrudFileAllocationType;
 
@@ -48,27 +56,48 @@ uint16_t crud_unmount(void);
 //
 // Interface functions
 
-int16_t crud_open(char *path);
+int32_t crud_open(char *path);
 	// This function opens the file and returns a file handle
 
-int16_t crud_close(int16_t fd);
+int16_t crud_close(int32_t fd);
 	// This function closes the file
 
-int32_t crud_read(int16_t fd, void *buf, int32_t count);
+int32_t crud_read(int32_t fd, void *buf, int32_t count);
 	// Reads "count" bytes from the file handle "fh" into the buffer  "buf"
 
-int32_t crud_write(int16_t fd, void *buf, int32_t count);
+int32_t crud_write(int32_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
-int32_t crud_seek(int16_t fd, uint32_t loc);
+int32_t crud_seek(int32_t fd, uint64_t loc);
 	// Seek to specific point in the file
 
+int32_t crud_truncate(int32_t fd, uint64_t length);
+	// Set the length of the file, zero filling it when it grows
+
+int32_t crud_fallocate(int32_t fd, uint64_t length);
+	// Create the blocks for the first "length" bytes without changing the length
+
+int32_t crud_pread(int32_t fd, void *buf, int32_t count, uint64_t off);
+	// Reads "count" bytes at offset "off" without moving the file position
+
+int32_t crud_pwrite(int32_t fd, void *buf, int32_t count, uint64_t off);
+	// Writes "count" bytes at offset "off" without moving the file position
+
+int32_t crud_readv(int32_t fd, const struct iovec *iov, int iovcnt);
+	// Reads from the file position into the "iovcnt" buffers of "iov"
+
+int32_t crud_writev(int32_t fd, const struct iovec *iov, int iovcnt);
+	// Writes the "iovcnt" buffers of "iov" at the file position
+
 //
 // Unit testing for the module
 
 int crudIOUnitTest(void);
 	// Perform a test of the CRUD IO implementation
 
+int crudIOStressTest(int threads);
+	// Run random operations on "threads" files from as many threads at once
+
 #endif
 
 
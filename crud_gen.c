@@ -0,0 +1,612 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_gen.c
+//  Description    : This is the implementation of the CRUD workload
+//                   generator.  It keeps a model of every file (contents,
+//                   length and position) while it writes the commands, so
+//                   each command is one the simulator can carry out (seeks
+//                   and reads stay inside the file), and the model is what
+//                   the file should hold once the workload has run.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Wed May 31 16:20:52 PDT 2017
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <crud_gen.h>
+#include <crud_rand.h>
+#include <crud_file_io.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+
+// Defines
+#define CRUD_GEN_NAME_LENGTH (CRUD_GEN_MAX_PREFIX + 16)
+#define CRUD_GEN_UNIT_TEST_FILES 100
+#define CRUD_GEN_UNIT_TEST_DRAWS 200000
+
+// Type definitions
+
+// The model of a generated file
+typedef struct {
+	char     *data;     // What the file should hold
+	uint32_t  length;   // The file length
+	uint32_t  alloc;    // The bytes allocated for data
+	uint32_t  position; // The file position
+} CrudGenFile;
+
+// The generator state
+typedef struct {
+	CrudGenParams *params;    // The workload parameters
+	CrudGenFile   *files;     // The file models
+	double        *cdf;       // Cumulative Zipf weights of the files (zipf only)
+	uint32_t       next;      // The next file of the sequential skew
+	uint32_t       mix_total; // The sum of the command weights
+	char          *text;      // The text of the write being generated
+	uint64_t       written;   // The bytes the workload writes
+	FILE          *out;       // The workload
+} CrudGenState;
+
+// The characters of the write text ('*' is a newline in the workload)
+const char crud_gen_alphabet[64] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789 *";
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_name
+// Description  : Make the name of a generated file
+//
+// Inputs       : params - the workload parameters
+//                idx - the file number
+//                name - the buffer for the name (CRUD_GEN_NAME_LENGTH bytes)
+// Outputs      : the name
+
+char *crud_gen_name(CrudGenParams *params, uint32_t idx, char *name) {
+	snprintf(name, CRUD_GEN_NAME_LENGTH, "%s%05u.txt", params->prefix, idx);
+	return (name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_uniform
+// Description  : Get a random real in [0, 1)
+//
+// Inputs       : none
+// Outputs      : the number
+
+double crud_gen_uniform(void) {
+	return ((crud_rand_next() >> 11) * (1.0 / 9007199254740992.0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_setup
+// Description  : Setup the generator state (file models and Zipf weights)
+//
+// Inputs       : st - the state
+//                params - the workload parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_gen_setup(CrudGenState *st, CrudGenParams *params) {
+	uint32_t i;
+
+	memset(st, 0x0, sizeof(CrudGenState));
+	st->params = params;
+	for (i = 0; i < CRUD_GEN_MAX_COMMAND; i++)
+		st->mix_total += params->mix[i];
+	if ((st->files = calloc(params->files, sizeof(CrudGenFile))) == NULL ||
+			(st->text = malloc(CRUD_GEN_MAX_WRITE + 1)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to allocate %u file models.", params->files);
+		return (-1);
+	}
+
+	if (params->skew == CRUD_GEN_ZIPF) {
+		if ((st->cdf = malloc(params->files * sizeof(double))) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to allocate the Zipf weights.");
+			return (-1);
+		}
+		for (i = 0; i < params->files; i++)
+			st->cdf[i] = (i ? st->cdf[i - 1] : 0.0) + 1.0 / pow(i + 1, params->theta);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_release
+// Description  : Free the generator state
+//
+// Inputs       : st - the state
+// Outputs      : none
+
+void crud_gen_release(CrudGenState *st) {
+	uint32_t i;
+
+	for (i = 0; st->files != NULL && i < st->params->files; i++)
+		free(st->files[i].data);
+	free(st->files);
+	free(st->cdf);
+	free(st->text);
+	st->files = NULL;
+	st->cdf = NULL;
+	st->text = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_pick_file
+// Description  : Choose the file of the next command
+//
+// Inputs       : st - the generator state
+// Outputs      : the file number
+
+uint32_t crud_gen_pick_file(CrudGenState *st) {
+	uint32_t lo = 0, hi = st->params->files - 1, mid;
+	double x;
+
+	switch (st->params->skew) {
+	case CRUD_GEN_ZIPF: // The first file whose cumulative weight reaches x
+		x = crud_gen_uniform() * st->cdf[hi];
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (st->cdf[mid] < x)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return (lo);
+
+	case CRUD_GEN_SEQUENTIAL:
+		lo = st->next;
+		st->next = (st->next + 1) % st->params->files;
+		return (lo);
+
+	default:
+		return (crud_rand_value(0, hi));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_pick_command
+// Description  : Choose a command by the mix weights
+//
+// Inputs       : st - the generator state
+// Outputs      : the command
+
+CRUD_GEN_COMMANDS crud_gen_pick_command(CrudGenState *st) {
+	uint32_t x = crud_rand_value(0, st->mix_total - 1);
+	int cmd;
+
+	for (cmd = 0; cmd < CRUD_GEN_MAX_COMMAND - 1 && x >= st->params->mix[cmd]; cmd++)
+		x -= st->params->mix[cmd];
+	return (cmd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_write_size
+// Description  : Draw the size of a write
+//
+// Inputs       : params - the workload parameters
+// Outputs      : the size (at least 1, at most the file and write limits)
+
+uint32_t crud_gen_write_size(CrudGenParams *params) {
+	double size;
+	uint32_t max = (params->max_length < CRUD_GEN_MAX_WRITE) ? params->max_length : CRUD_GEN_MAX_WRITE;
+
+	switch (params->size) {
+	case CRUD_GEN_SIZE_UNIFORM:
+		size = crud_rand_value(params->size_min, params->size_max);
+		break;
+
+	case CRUD_GEN_SIZE_EXP:
+		size = 1.0 - params->size_min * log(1.0 - crud_gen_uniform());
+		break;
+
+	default:
+		size = params->size_min;
+		break;
+	}
+	return ((size < 1.0) ? 1 : (size > max) ? max : (uint32_t)size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_write
+// Description  : Emit a write of random text and apply it to the file model
+//
+// Inputs       : st - the generator state
+//                name - the filename
+//                f - the file model
+//                at - 1 for a WRITEAT, 0 for a WRITE (at the position)
+//                off - where the write lands
+//                len - the length of the write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_gen_write(CrudGenState *st, const char *name, CrudGenFile *f, int at, uint32_t off, uint32_t len) {
+	uint64_t bits = 0;
+	uint32_t i, alloc;
+	char *data;
+
+	// Make sure the model has room for it
+	if (off + len > f->alloc) {
+		alloc = (f->alloc * 2 > off + len) ? f->alloc * 2 : off + len;
+		if ((data = realloc(f->data, alloc)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to grow the model of [%s].", name);
+			return (-1);
+		}
+		f->data = data;
+		f->alloc = alloc;
+	}
+
+	// Six random bits a character, the model gets the newlines '*' stands for
+	for (i = 0; i < len; i++) {
+		if ((i % 10) == 0)
+			bits = crud_rand_next();
+		st->text[i] = crud_gen_alphabet[bits & 0x3f];
+		bits >>= 6;
+		f->data[off + i] = (st->text[i] == '*') ? '\n' : st->text[i];
+	}
+	st->text[len] = 0x0;
+
+	if (at)
+		fprintf(st->out, "%s WRITEAT %u %u :%s\n", name, len, off, st->text);
+	else
+		fprintf(st->out, "%s WRITE %u 0 :%s\n", name, len, st->text);
+	f->position = off + len;
+	if (f->position > f->length)
+		f->length = f->position;
+	st->written += len;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_command
+// Description  : Emit the next command (or two, a read at the end of a file
+//                seeks first), keeping it within what the file allows
+//
+// Inputs       : st - the generator state
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_gen_command(CrudGenState *st) {
+	CrudGenParams *params = st->params;
+	char name[CRUD_GEN_NAME_LENGTH];
+	uint32_t idx = crud_gen_pick_file(st), len, off, room;
+	CrudGenFile *f = &st->files[idx];
+	int seq = (params->skew == CRUD_GEN_SEQUENTIAL);
+	CRUD_GEN_COMMANDS cmd = crud_gen_pick_command(st);
+
+	crud_gen_name(params, idx, name);
+	if (f->length == 0)
+		cmd = CRUD_GEN_WRITE; // Nothing to read or seek in yet
+
+	switch (cmd) {
+	case CRUD_GEN_READ:
+		if (f->position == f->length) {
+			off = seq ? 0 : crud_rand_value(0, f->length - 1);
+			fprintf(st->out, "%s SEEK 0 %u :\n", name, off);
+			f->position = off;
+		}
+		len = crud_gen_write_size(params);
+		if (len > f->length - f->position)
+			len = f->length - f->position;
+		fprintf(st->out, "%s READ %u 0 :\n", name, len);
+		f->position += len;
+		return (0);
+
+	case CRUD_GEN_SEEK:
+		off = seq ? 0 : crud_rand_value(0, f->length);
+		fprintf(st->out, "%s SEEK 0 %u :\n", name, off);
+		f->position = off;
+		return (0);
+
+	case CRUD_GEN_WRITE:
+	case CRUD_GEN_WRITEAT:
+		len = crud_gen_write_size(params);
+		off = (cmd == CRUD_GEN_WRITE || seq) ? f->position : crud_rand_value(0, f->length);
+
+		// A write that would run past the largest file moves back into it
+		if (off + len > params->max_length) {
+			room = params->max_length - len;
+			off = crud_rand_value(0, (f->length < room) ? f->length : room);
+			cmd = CRUD_GEN_WRITEAT;
+		}
+		return (crud_gen_write(st, name, f, cmd == CRUD_GEN_WRITEAT, off, len));
+
+	default:
+		return (-1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_finish
+// Description  : Write each file's expected contents beside the workload,
+//                and the script that replays the workload and checks them
+//
+// Inputs       : st - the generator state
+//                out - the workload filename
+//                replay - the workload the script replays
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_gen_finish(CrudGenState *st, const char *out, const char *replay) {
+	char path[CRUD_MAX_PATH_LENGTH + CRUD_GEN_NAME_LENGTH], name[CRUD_GEN_NAME_LENGTH];
+	const char *base = strrchr(replay, '/');
+	int dirlen = (strrchr(out, '/') != NULL) ? (int)(strrchr(out, '/') - out) + 1 : 0;
+	CrudGenFile *f;
+	FILE *fh, *check;
+	uint32_t i, listed = 0;
+
+	snprintf(path, sizeof(path), "%s.check", out);
+	if ((check = fopen(path, "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to create [%s], error: %s.", path, strerror(errno));
+		return (-1);
+	}
+	fprintf(check, "#!/bin/sh\n"
+		"# Replay %s and check the files it leaves against their .orig copies\n"
+		"# (run from the directory holding them, SIM names the simulator)\n"
+		"SIM=${SIM:-./crud_sim}\nFILES=\"", (base != NULL) ? base + 1 : replay);
+
+	// Only the files the workload touched
+	for (i = 0; i < st->params->files; i++) {
+		f = &st->files[i];
+		if (f->length == 0)
+			continue;
+		crud_gen_name(st->params, i, name);
+		snprintf(path, sizeof(path), "%.*s%s.orig", dirlen, out, name);
+		if ((fh = fopen(path, "w")) == NULL || fwrite(f->data, 1, f->length, fh) != f->length || fclose(fh)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to write expected contents [%s].", path);
+			fclose(check);
+			return (-1);
+		}
+		fprintf(check, "%s%s", (listed++ % 8) ? " " : " \\\n", name);
+	}
+
+	fprintf(check, "\"\nrm -f $FILES\n"
+		"$SIM %s || exit 1\n"
+		"$SIM -x $FILES\n"
+		"for f in $FILES; do\n"
+		"\tcmp -s $f $f.orig || echo \"Mismatch $f\"\n"
+		"done\n", (base != NULL) ? base + 1 : replay);
+	snprintf(path, sizeof(path), "%s.check", out);
+	if (fclose(check) || chmod(path, 0755)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to finish [%s].", path);
+		return (-1);
+	}
+	return (0);
+}
+
+//
+// Generator interface
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_defaults
+// Description  : Set the default workload parameters
+//
+// Inputs       : params - the parameters to set
+// Outputs      : none
+
+void crud_gen_defaults(CrudGenParams *params) {
+	memset(params, 0x0, sizeof(CrudGenParams));
+	params->files = 16;
+	params->ops = 10000;
+	params->skew = CRUD_GEN_UNIFORM;
+	params->theta = 0.99;
+	params->mix[CRUD_GEN_READ] = 10;
+	params->mix[CRUD_GEN_WRITE] = 30;
+	params->mix[CRUD_GEN_WRITEAT] = 50;
+	params->mix[CRUD_GEN_SEEK] = 10;
+	params->size = CRUD_GEN_SIZE_EXP;
+	params->size_min = 256;
+	params->size_max = 0;
+	params->max_length = 1 << 20;
+	strcpy(params->prefix, "gen_");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_parse
+// Description  : Update the parameters from a "key=value,..." specification
+//                (see CRUD_GEN_SPEC_HELP)
+//
+// Inputs       : spec - the specification
+//                params - the parameters to update
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_gen_parse(const char *spec, CrudGenParams *params) {
+	char buf[strlen(spec) + 1], *save, *key, *val, tail;
+	uint32_t *mix = params->mix;
+	int ok;
+
+	strcpy(buf, spec);
+	for (key = strtok_r(buf, ",", &save); key != NULL; key = strtok_r(NULL, ",", &save)) {
+		if ((val = strchr(key, '=')) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : [%s] is not key=value.", key);
+			return (-1);
+		}
+		*val++ = 0x0;
+
+		if (!strcmp(key, "files")) {
+			ok = (sscanf(val, "%u%c", &params->files, &tail) == 1 && params->files > 0);
+		} else if (!strcmp(key, "ops")) {
+			ok = (sscanf(val, "%u%c", &params->ops, &tail) == 1);
+		} else if (!strcmp(key, "skew")) {
+			ok = 1;
+			if (!strcmp(val, "uniform"))
+				params->skew = CRUD_GEN_UNIFORM;
+			else if (!strcmp(val, "zipf"))
+				params->skew = CRUD_GEN_ZIPF;
+			else if (!strcmp(val, "seq"))
+				params->skew = CRUD_GEN_SEQUENTIAL;
+			else
+				ok = 0;
+		} else if (!strcmp(key, "theta")) {
+			ok = (sscanf(val, "%lf%c", &params->theta, &tail) == 1 && params->theta >= 0.0);
+		} else if (!strcmp(key, "mix")) {
+			ok = (sscanf(val, "%u:%u:%u:%u%c", &mix[0], &mix[1], &mix[2], &mix[3], &tail) == 4 &&
+				mix[0] + mix[1] + mix[2] + mix[3] > 0);
+		} else if (!strcmp(key, "size")) {
+			if (sscanf(val, "fixed:%u%c", &params->size_min, &tail) == 1) {
+				params->size = CRUD_GEN_SIZE_FIXED;
+				ok = (params->size_min > 0);
+			} else if (sscanf(val, "uniform:%u:%u%c", &params->size_min, &params->size_max, &tail) == 2) {
+				params->size = CRUD_GEN_SIZE_UNIFORM;
+				ok = (params->size_min > 0 && params->size_min <= params->size_max);
+			} else if (sscanf(val, "exp:%u%c", &params->size_min, &tail) == 1) {
+				params->size = CRUD_GEN_SIZE_EXP;
+				ok = (params->size_min > 0);
+			} else {
+				ok = 0;
+			}
+		} else if (!strcmp(key, "maxlen")) {
+			ok = (sscanf(val, "%u%c", &params->max_length, &tail) == 1 &&
+				params->max_length > 0 && params->max_length <= INT32_MAX);
+		} else if (!strcmp(key, "prefix")) {
+			ok = (strlen(val) < CRUD_GEN_MAX_PREFIX && strchr(val, ' ') == NULL && strchr(val, ':') == NULL);
+			if (ok)
+				strcpy(params->prefix, val);
+		} else {
+			ok = 0;
+		}
+
+		if (!ok) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Bad workload parameter [%s=%s].", key, val);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_gen_workload
+// Description  : Write a workload, each file's expected contents
+//                ("<file>.orig" beside the workload) and the check script
+//                ("<out>.check")
+//
+// Inputs       : params - the workload parameters
+//                out - the workload filename
+//                replay - the workload the check script replays (out, or
+//                         the compiled form of it)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_gen_workload(CrudGenParams *params, const char *out, const char *replay) {
+	CrudGenState st;
+	uint32_t i, touched = 0;
+	int ret = -1;
+
+	if (crud_gen_setup(&st, params))
+		goto done;
+	if ((st.out = fopen(out, "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to create [%s], error: %s.", out, strerror(errno));
+		goto done;
+	}
+
+	fprintf(st.out, "x FORMAT 0 0:\nx MOUNT 0 0:\n");
+	for (i = 0; i < params->ops; i++) {
+		if (crud_gen_command(&st))
+			goto done;
+	}
+	fprintf(st.out, "x UNMOUNT 0 0:\n");
+	if (fclose(st.out)) {
+		st.out = NULL;
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN : Unable to write [%s].", out);
+		goto done;
+	}
+	st.out = NULL;
+	if (crud_gen_finish(&st, out, replay))
+		goto done;
+
+	for (i = 0; i < params->files; i++)
+		touched += (st.files[i].length > 0);
+	logMessage(LOG_INFO_LEVEL, "CRUD_GEN : [%s] has %u commands on %u files, %lu bytes written (seed %lu).",
+		out, params->ops, touched, st.written, crud_rand_get_seed());
+	ret = 0;
+
+done:
+	if (st.out != NULL)
+		fclose(st.out);
+	crud_gen_release(&st);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudGenUnitTest
+// Description  : Check the specification parsing, that Zipf choices follow
+//                their weights and sequential ones take each file in turn
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudGenUnitTest(void) {
+	const char *bad[] = { "files=0", "skew=bogus", "mix=1:2", "mix=0:0:0:0", "size=exp:0",
+		"size=uniform:9:3", "maxlen=x", "prefix=a b", "nokey", "color=red", NULL };
+	uint32_t counts[CRUD_GEN_UNIT_TEST_FILES], i;
+	CrudGenParams params;
+	CrudGenState st;
+	double p0;
+
+	logMessage(LOG_INFO_LEVEL, "CRUD_GEN_UNIT_TEST : Starting workload generator unit test.");
+
+	// Good and bad specifications (errors are expected in the log)
+	crud_gen_defaults(&params);
+	if (crud_gen_parse("files=100,ops=5,skew=zipf,theta=1.0,mix=1:2:3:4,size=uniform:10:20,maxlen=5000,prefix=t_",
+			&params) || params.files != 100 || params.ops != 5 || params.skew != CRUD_GEN_ZIPF ||
+			params.theta != 1.0 || params.mix[3] != 4 || params.size != CRUD_GEN_SIZE_UNIFORM ||
+			params.size_max != 20 || params.max_length != 5000 || strcmp(params.prefix, "t_")) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN_UNIT_TEST : Specification not parsed.");
+		return (-1);
+	}
+	for (i = 0; bad[i] != NULL; i++) {
+		CrudGenParams scratch = params;
+		if (crud_gen_parse(bad[i], &scratch) == 0) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN_UNIT_TEST : Bad specification [%s] accepted.", bad[i]);
+			return (-1);
+		}
+	}
+
+	// With theta 1, file 0 takes 1/H(100) of the choices and file 9 a tenth of that
+	memset(counts, 0x0, sizeof(counts));
+	if (crud_gen_setup(&st, &params))
+		return (-1);
+	for (i = 0; i < CRUD_GEN_UNIT_TEST_DRAWS; i++)
+		counts[crud_gen_pick_file(&st)]++;
+	p0 = CRUD_GEN_UNIT_TEST_DRAWS / st.cdf[CRUD_GEN_UNIT_TEST_FILES - 1];
+	crud_gen_release(&st);
+	if (fabs(counts[0] - p0) > p0 * 0.05 || fabs(counts[9] - p0 / 10) > p0 / 10 * 0.15 ||
+			counts[1] <= counts[9] || counts[9] <= counts[99]) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_GEN_UNIT_TEST : Zipf choices %u, %u, %u, expected about %.0f, %.0f.",
+			counts[0], counts[9], counts[99], p0, p0 / 10);
+		return (-1);
+	}
+
+	// Sequential choices wrap round the files in order
+	params.skew = CRUD_GEN_SEQUENTIAL;
+	if (crud_gen_setup(&st, &params))
+		return (-1);
+	for (i = 0; i < 3 * CRUD_GEN_UNIT_TEST_FILES; i++) {
+		if (crud_gen_pick_file(&st) != i % CRUD_GEN_UNIT_TEST_FILES) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_GEN_UNIT_TEST : Sequential choice %u out of order.", i);
+			crud_gen_release(&st);
+			return (-1);
+		}
+	}
+	crud_gen_release(&st);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD_GEN_UNIT_TEST : Workload generator unit test completed successfully.");
+	return (0);
+}
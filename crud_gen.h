@@ -0,0 +1,82 @@
+#ifndef CRUD_GEN_INCLUDED
+#define CRUD_GEN_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_gen.h
+//  Description    : This is the header file for the CRUD workload generator,
+//                   which writes text workloads ("<file> <command> <len>
+//                   <off> :<text>") over any number of files, with skewed
+//                   file and offset choices, a command mix and a write size
+//                   distribution, along with the contents each file should
+//                   be left with and a script that checks them.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Wed May 31 16:20:52 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_GEN_MAX_WRITE (1 << 20)    // Largest single write
+#define CRUD_GEN_MAX_PREFIX 64          // Longest filename prefix
+#define CRUD_GEN_SPEC_HELP \
+	"files=<n>,ops=<n>,skew=uniform|zipf|seq,theta=<t>,mix=<read>:<write>:<writeat>:<seek>,\n" \
+	"    size=fixed:<n>|uniform:<min>:<max>|exp:<mean>,maxlen=<bytes>,prefix=<name>"
+
+// How the files (and the offsets within them) are chosen
+typedef enum {
+	CRUD_GEN_UNIFORM    = 0, // Any file, any offset
+	CRUD_GEN_ZIPF       = 1, // File i+1 chosen in proportion to 1/(i+1)^theta, any offset
+	CRUD_GEN_SEQUENTIAL = 2, // Each file in turn, writes continue where the last ended
+} CRUD_GEN_SKEWS;
+
+// The write size distributions
+typedef enum {
+	CRUD_GEN_SIZE_FIXED   = 0, // Always size_min
+	CRUD_GEN_SIZE_UNIFORM = 1, // Between size_min and size_max
+	CRUD_GEN_SIZE_EXP     = 2, // Exponential with mean size_min (capped at CRUD_GEN_MAX_WRITE)
+} CRUD_GEN_SIZES;
+
+// The file commands, in the order of the mix weights
+typedef enum {
+	CRUD_GEN_READ    = 0,
+	CRUD_GEN_WRITE   = 1,
+	CRUD_GEN_WRITEAT = 2,
+	CRUD_GEN_SEEK    = 3,
+	CRUD_GEN_MAX_COMMAND
+} CRUD_GEN_COMMANDS;
+
+// The workload parameters
+typedef struct {
+	uint32_t       files;       // The files to spread the commands over
+	uint32_t       ops;         // The file commands to generate
+	CRUD_GEN_SKEWS skew;        // How files and offsets are chosen
+	double         theta;       // The Zipf exponent
+	uint32_t       mix[CRUD_GEN_MAX_COMMAND]; // The command weights
+	CRUD_GEN_SIZES size;        // The write size distribution
+	uint32_t       size_min;    // Its size (fixed), minimum (uniform) or mean (exp)
+	uint32_t       size_max;    // Its maximum (uniform)
+	uint32_t       max_length;  // The largest a file may grow
+	char           prefix[CRUD_GEN_MAX_PREFIX]; // The filename prefix
+} CrudGenParams;
+
+//
+// Generator interface
+
+void crud_gen_defaults(CrudGenParams *params);
+	// Set the default workload parameters
+
+int crud_gen_parse(const char *spec, CrudGenParams *params);
+	// Update the parameters from a "key=value,..." specification
+
+int crud_gen_workload(CrudGenParams *params, const char *out, const char *replay);
+	// Write the workload to "out", each file's contents to "<file>.orig"
+	// beside it and a script replaying "replay" and checking them to
+	// "<out>.check" (numbers are drawn from the crud_rand seed)
+
+int crudGenUnitTest(void);
+	// Check the specification parsing and the file choice distributions
+
+#endif
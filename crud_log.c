@@ -0,0 +1,825 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_log.c
+//  Description    : This is the implementation of the CRUD logging front
+//                   end.  While the writer runs, a log call packs its level,
+//                   format pointer and arguments (strings copied) into a
+//                   record of a bounded lock-free ring, claimed with a
+//                   compare-and-swap on the head and published through the
+//                   record's sequence number.  The single writer thread
+//                   formats the records in order, one conversion at a time,
+//                   and writes them out a batch at a time.  Anything that
+//                   will not pack is formatted by the caller, and anything
+//                   too long for a record is logged directly once the ring
+//                   has drained.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Thu May 25 10:12:44 PDT 2017
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_log.h>
+#include <crud_alloc.h>
+
+// Defines
+#define CRUD_LOG_DATA_SIZE (CRUD_LOG_RECORD_SIZE - 32)  // Packed argument bytes per record
+#define CRUD_LOG_LINE_SIZE (MAX_LOG_MESSAGE_SIZE + 64) // Longest formatted line
+#define CRUD_LOG_SPEC_SIZE 32        // Longest conversion specification
+#define CRUD_LOG_IDLE_NS 1000000     // Writer sleep when the ring is empty
+#define CRUD_LOG_WAIT_NS 50000       // Caller sleep when the ring is full
+#define CRUD_LOG_UNIT_TEST_THREADS 4
+#define CRUD_LOG_UNIT_TEST_RECORDS 5000
+
+// Type definitions
+
+// The argument a conversion takes
+typedef enum {
+	CRUD_LOG_ARG_NONE    = 0, // "%%"
+	CRUD_LOG_ARG_INT     = 1,
+	CRUD_LOG_ARG_DOUBLE  = 2,
+	CRUD_LOG_ARG_LDOUBLE = 3,
+	CRUD_LOG_ARG_STRING  = 4,
+	CRUD_LOG_ARG_POINTER = 5,
+} CRUD_LOG_ARG_TYPES;
+
+// The length modifier of an integer conversion
+typedef enum {
+	CRUD_LOG_LEN_INT      = 0, // none, "h" or "hh" (promoted to int)
+	CRUD_LOG_LEN_LONG     = 1, // "l"
+	CRUD_LOG_LEN_LLONG    = 2, // "ll" or "q"
+	CRUD_LOG_LEN_SIZE     = 3, // "z"
+	CRUD_LOG_LEN_INTMAX   = 4, // "j"
+	CRUD_LOG_LEN_PTRDIFF  = 5, // "t"
+	CRUD_LOG_LEN_LDOUBLE  = 6, // "L"
+} CRUD_LOG_LENGTHS;
+
+// A parsed conversion specification
+typedef struct {
+	int size;   // The length of the specification, from the '%'
+	int nstar;  // The '*' width and precision arguments before the value
+	int length; // The length modifier (CRUD_LOG_LENGTHS)
+	int type;   // The argument (CRUD_LOG_ARG_TYPES)
+} CrudLogSpec;
+
+// A record of the ring
+typedef struct {
+	uint64_t       seq;  // Ring sequence, one past the slot position when ready
+	unsigned long  lvl;  // The log level
+	const char    *fmt;  // The format (NULL if data holds the message itself)
+	int64_t        time; // When the message was logged
+	uint8_t        data[CRUD_LOG_DATA_SIZE]; // The packed arguments
+} CrudLogRecord;
+
+// Log Static Data
+CrudLogRecord *crud_log_ring = NULL; // The record ring
+uint64_t crud_log_head = 0;          // The next record to claim
+uint64_t crud_log_tail = 0;          // The next record to write (writer only)
+uint64_t crud_log_done = 0;          // The records written out
+int crud_log_fd = -1;                // Where the writer sends the lines
+int crud_log_running = 0;            // Flag indicating records are queued
+int crud_log_stopping = 0;           // Flag asking the writer to drain and exit
+int crud_log_registered = 0;         // Flag indicating the exit hook is set
+pthread_t crud_log_writer;           // The writer thread
+CrudLogStats crud_log_stats;         // The logging statistics
+pthread_mutex_t crud_log_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes start and stop
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_sleep
+// Description  : Sleep for a short while
+//
+// Inputs       : ns - the nanoseconds to sleep
+// Outputs      : none
+
+void crud_log_sleep(long ns) {
+	struct timespec ts = { 0, ns };
+
+	nanosleep(&ts, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_level_name
+// Description  : Name one of the default log levels
+//
+// Inputs       : lvl - the level
+// Outputs      : the level descriptor, or NULL if not a default level
+
+const char *crud_log_level_name(unsigned long lvl) {
+	switch (lvl) {
+	case LOG_ERROR_LEVEL:   return (LOG_ERROR_LEVEL_DESC);
+	case LOG_WARNING_LEVEL: return (LOG_WARNING_LEVEL_DESC);
+	case LOG_INFO_LEVEL:    return (LOG_INFO_LEVEL_DESC);
+	case LOG_OUTPUT_LEVEL:  return (LOG_OUTPUT_LEVEL_DESC);
+	}
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_parse
+// Description  : Parse the conversion specification at a '%'
+//
+// Inputs       : p - the '%' starting the specification
+//                spec - the specification, filled in
+// Outputs      : 0 if successful, -1 if not one that can be packed
+
+int crud_log_parse(const char *p, CrudLogSpec *spec) {
+	const char *s = p + 1;
+
+	memset(spec, 0x0, sizeof(CrudLogSpec));
+	if (*s == '%') {
+		spec->size = 2;
+		spec->type = CRUD_LOG_ARG_NONE;
+		return (0);
+	}
+
+	// Flags, width and precision
+	while (*s && strchr("-+ #0'", *s))
+		s++;
+	if (*s == '*') {
+		spec->nstar++;
+		s++;
+	}
+	while (*s >= '0' && *s <= '9')
+		s++;
+	if (*s == '.') {
+		s++;
+		if (*s == '*') {
+			spec->nstar++;
+			s++;
+		}
+		while (*s >= '0' && *s <= '9')
+			s++;
+	}
+
+	// Length modifier
+	if (s[0] == 'h') {
+		s += (s[1] == 'h') ? 2 : 1;
+	} else if (s[0] == 'l' && s[1] == 'l') {
+		spec->length = CRUD_LOG_LEN_LLONG;
+		s += 2;
+	} else if (*s && strchr("lqLzjt", *s)) {
+		spec->length = (*s == 'l') ? CRUD_LOG_LEN_LONG : (*s == 'q') ? CRUD_LOG_LEN_LLONG :
+			(*s == 'L') ? CRUD_LOG_LEN_LDOUBLE : (*s == 'z') ? CRUD_LOG_LEN_SIZE :
+			(*s == 'j') ? CRUD_LOG_LEN_INTMAX : CRUD_LOG_LEN_PTRDIFF;
+		s++;
+	}
+
+	// Conversion (wide characters, %n, %m and positional arguments are not packed)
+	if (*s && strchr("diouxXc", *s) && spec->length != CRUD_LOG_LEN_LDOUBLE &&
+			!(*s == 'c' && spec->length != CRUD_LOG_LEN_INT)) {
+		spec->type = CRUD_LOG_ARG_INT;
+	} else if (*s && strchr("fFeEgGaA", *s) && (spec->length == CRUD_LOG_LEN_INT ||
+			spec->length == CRUD_LOG_LEN_LONG || spec->length == CRUD_LOG_LEN_LDOUBLE)) {
+		spec->type = (spec->length == CRUD_LOG_LEN_LDOUBLE) ? CRUD_LOG_ARG_LDOUBLE : CRUD_LOG_ARG_DOUBLE;
+	} else if (*s == 's' && spec->length == CRUD_LOG_LEN_INT) {
+		spec->type = CRUD_LOG_ARG_STRING;
+	} else if (*s == 'p' && spec->length == CRUD_LOG_LEN_INT) {
+		spec->type = CRUD_LOG_ARG_POINTER;
+	} else {
+		return (-1);
+	}
+
+	spec->size = s + 1 - p;
+	return ((spec->size < CRUD_LOG_SPEC_SIZE) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_pack
+// Description  : Pack the arguments of a format into a record
+//
+// Inputs       : fmt - the format
+//                args - the arguments
+//                data - the record data to fill
+//                size - the size of data
+// Outputs      : the bytes packed, or -1 if the arguments will not pack
+
+int crud_log_pack(const char *fmt, va_list args, uint8_t *data, size_t size) {
+	const char *p, *str;
+	CrudLogSpec spec;
+	size_t used = 0, n;
+	int64_t ival;
+	double dval;
+	long double ldval;
+	void *ptr;
+	int i;
+
+#define CRUD_LOG_PUT(v) do { \
+		if (used + sizeof(v) > size) \
+			return (-1); \
+		memcpy(&data[used], &(v), sizeof(v)); \
+		used += sizeof(v); \
+	} while (0)
+
+	for (p = fmt; (p = strchr(p, '%')) != NULL; p += spec.size) {
+		if (crud_log_parse(p, &spec))
+			return (-1);
+		for (i = 0; i < spec.nstar; i++) {
+			ival = va_arg(args, int);
+			CRUD_LOG_PUT(ival);
+		}
+
+		switch (spec.type) {
+		case CRUD_LOG_ARG_INT:
+			switch (spec.length) {
+			case CRUD_LOG_LEN_LONG:    ival = va_arg(args, long); break;
+			case CRUD_LOG_LEN_LLONG:   ival = va_arg(args, long long); break;
+			case CRUD_LOG_LEN_SIZE:    ival = va_arg(args, size_t); break;
+			case CRUD_LOG_LEN_INTMAX:  ival = va_arg(args, intmax_t); break;
+			case CRUD_LOG_LEN_PTRDIFF: ival = va_arg(args, ptrdiff_t); break;
+			default:                   ival = va_arg(args, int); break;
+			}
+			CRUD_LOG_PUT(ival);
+			break;
+
+		case CRUD_LOG_ARG_DOUBLE:
+			dval = va_arg(args, double);
+			CRUD_LOG_PUT(dval);
+			break;
+
+		case CRUD_LOG_ARG_LDOUBLE:
+			ldval = va_arg(args, long double);
+			CRUD_LOG_PUT(ldval);
+			break;
+
+		case CRUD_LOG_ARG_STRING: // Copied, the caller's buffer may not last
+			if ((str = va_arg(args, const char *)) == NULL)
+				str = "(null)";
+			n = strlen(str) + 1;
+			if (used + n > size)
+				return (-1);
+			memcpy(&data[used], str, n);
+			used += n;
+			break;
+
+		case CRUD_LOG_ARG_POINTER:
+			ptr = va_arg(args, void *);
+			CRUD_LOG_PUT(ptr);
+			break;
+		}
+	}
+#undef CRUD_LOG_PUT
+
+	return ((int)used);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_format
+// Description  : Format a message from a format and its packed arguments
+//
+// Inputs       : fmt - the format
+//                data - the packed arguments
+//                out - the buffer to format into
+//                size - the size of out
+// Outputs      : the length of the message
+
+size_t crud_log_format(const char *fmt, const uint8_t *data, char *out, size_t size) {
+	char sbuf[CRUD_LOG_SPEC_SIZE];
+	const char *p = fmt;
+	size_t len = 0, used = 0, room;
+	CrudLogSpec spec;
+	int star[2] = { 0, 0 }, i, n = 0;
+	int64_t ival;
+	double dval;
+	long double ldval;
+	void *ptr;
+
+#define CRUD_LOG_GET(v) do { \
+		memcpy(&(v), &data[used], sizeof(v)); \
+		used += sizeof(v); \
+	} while (0)
+#define CRUD_LOG_PRINT(v) \
+	((spec.nstar == 0) ? snprintf(&out[len], room, sbuf, v) : \
+	 (spec.nstar == 1) ? snprintf(&out[len], room, sbuf, star[0], v) : \
+	 snprintf(&out[len], room, sbuf, star[0], star[1], v))
+
+	while (*p && len < size - 1) {
+		if (*p != '%') {
+			out[len++] = *p++;
+			continue;
+		}
+
+		// One conversion at a time, with its own arguments
+		crud_log_parse(p, &spec);
+		memcpy(sbuf, p, spec.size);
+		sbuf[spec.size] = 0x0;
+		p += spec.size;
+		for (i = 0; i < spec.nstar; i++) {
+			CRUD_LOG_GET(ival);
+			star[i] = (int)ival;
+		}
+		room = size - len;
+
+		switch (spec.type) {
+		case CRUD_LOG_ARG_NONE:
+			n = snprintf(&out[len], room, "%%");
+			break;
+
+		case CRUD_LOG_ARG_INT:
+			CRUD_LOG_GET(ival);
+			switch (spec.length) {
+			case CRUD_LOG_LEN_LONG:    n = CRUD_LOG_PRINT((long)ival); break;
+			case CRUD_LOG_LEN_LLONG:   n = CRUD_LOG_PRINT((long long)ival); break;
+			case CRUD_LOG_LEN_SIZE:    n = CRUD_LOG_PRINT((size_t)ival); break;
+			case CRUD_LOG_LEN_INTMAX:  n = CRUD_LOG_PRINT((intmax_t)ival); break;
+			case CRUD_LOG_LEN_PTRDIFF: n = CRUD_LOG_PRINT((ptrdiff_t)ival); break;
+			default:                   n = CRUD_LOG_PRINT((int)ival); break;
+			}
+			break;
+
+		case CRUD_LOG_ARG_DOUBLE:
+			CRUD_LOG_GET(dval);
+			n = CRUD_LOG_PRINT(dval);
+			break;
+
+		case CRUD_LOG_ARG_LDOUBLE:
+			CRUD_LOG_GET(ldval);
+			n = CRUD_LOG_PRINT(ldval);
+			break;
+
+		case CRUD_LOG_ARG_STRING:
+			n = CRUD_LOG_PRINT((const char *)&data[used]);
+			used += strlen((const char *)&data[used]) + 1;
+			break;
+
+		case CRUD_LOG_ARG_POINTER:
+			CRUD_LOG_GET(ptr);
+			n = CRUD_LOG_PRINT(ptr);
+			break;
+		}
+		if (n > 0)
+			len += ((size_t)n < room) ? (size_t)n : room - 1;
+	}
+#undef CRUD_LOG_GET
+#undef CRUD_LOG_PRINT
+
+	out[len] = 0x0;
+	return (len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_line
+// Description  : Format a record as a log line, as the log service would
+//
+// Inputs       : rec - the record
+//                out - the buffer to format into (CRUD_LOG_LINE_SIZE bytes)
+// Outputs      : the length of the line
+
+size_t crud_log_line(CrudLogRecord *rec, char *out) {
+	static char stamp[32];
+	static int64_t stamped = -1;
+	time_t when = rec->time;
+	size_t len;
+
+	// The writer formats the time once a second
+	if (rec->time != stamped) {
+		ctime_r(&when, stamp);
+		stamp[strcspn(stamp, "\n")] = 0x0;
+		stamped = rec->time;
+	}
+	len = snprintf(out, CRUD_LOG_LINE_SIZE, "%s [%s] ", stamp, crud_log_level_name(rec->lvl));
+
+	if (rec->fmt != NULL) {
+		len += crud_log_format(rec->fmt, rec->data, &out[len], MAX_LOG_MESSAGE_SIZE);
+	} else {
+		len += snprintf(&out[len], MAX_LOG_MESSAGE_SIZE, "%s", (char *)rec->data);
+	}
+	if (out[len - 1] != '\n')
+		out[len++] = '\n';
+	return (len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_write
+// Description  : Write a batch of lines out
+//
+// Inputs       : buf - the lines
+//                len - the number of bytes
+// Outputs      : none
+
+void crud_log_write(const char *buf, size_t len) {
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = write(crud_log_fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return; // Nowhere left to report it
+		}
+		buf += ret;
+		len -= ret;
+	}
+	__atomic_add_fetch(&crud_log_stats.writes, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_writer_main
+// Description  : Format the ready records in order and write them out in
+//                batches, until asked to stop and the ring is empty
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *crud_log_writer_main(void *arg) {
+	CrudLogRecord *rec;
+	char *batch;
+	size_t len;
+
+	if ((batch = malloc(CRUD_LOG_BATCH_SIZE)) == NULL)
+		return (NULL);
+
+	for (;;) {
+		len = 0;
+		while (len + CRUD_LOG_LINE_SIZE <= CRUD_LOG_BATCH_SIZE) {
+			rec = &crud_log_ring[crud_log_tail & (CRUD_LOG_RING_SIZE - 1)];
+			if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != crud_log_tail + 1)
+				break;
+			len += crud_log_line(rec, &batch[len]);
+
+			// Hand the record back for the next pass round the ring
+			__atomic_store_n(&rec->seq, crud_log_tail + CRUD_LOG_RING_SIZE, __ATOMIC_RELEASE);
+			crud_log_tail++;
+		}
+		if (len > 0)
+			crud_log_write(batch, len);
+		__atomic_store_n(&crud_log_done, crud_log_tail, __ATOMIC_RELEASE);
+
+		if (len == 0) {
+			if (__atomic_load_n(&crud_log_stopping, __ATOMIC_ACQUIRE) &&
+					__atomic_load_n(&crud_log_head, __ATOMIC_ACQUIRE) == crud_log_tail)
+				break;
+			crud_log_sleep(CRUD_LOG_IDLE_NS);
+		}
+	}
+
+	free(batch);
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_enqueue
+// Description  : Claim a record of the ring, fill it in and publish it,
+//                waiting for the writer if the ring is full
+//
+// Inputs       : lvl - the log level
+//                fmt - the format (NULL if data is the message)
+//                data - the packed arguments
+//                len - the bytes in data
+// Outputs      : none
+
+void crud_log_enqueue(unsigned long lvl, const char *fmt, const uint8_t *data, size_t len) {
+	uint64_t pos = __atomic_load_n(&crud_log_head, __ATOMIC_RELAXED), seq;
+	CrudLogRecord *rec;
+	int waited = 0;
+
+	for (;;) {
+		rec = &crud_log_ring[pos & (CRUD_LOG_RING_SIZE - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			// Free, try to claim it (a failed claim reloads pos)
+			if (__atomic_compare_exchange_n(&crud_log_head, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((int64_t)(seq - pos) < 0) {
+			// Still holding the record from the last pass, the ring is full
+			if (!waited++)
+				__atomic_add_fetch(&crud_log_stats.waits, 1, __ATOMIC_RELAXED);
+			crud_log_sleep(CRUD_LOG_WAIT_NS);
+			pos = __atomic_load_n(&crud_log_head, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&crud_log_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	rec->lvl = lvl;
+	rec->fmt = fmt;
+	rec->time = time(NULL);
+	memcpy(rec->data, data, len);
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&crud_log_stats.records, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_drain
+// Description  : Wait for the writer to write out every record claimed so far
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_log_drain(void) {
+	uint64_t target = __atomic_load_n(&crud_log_head, __ATOMIC_ACQUIRE);
+
+	while (__atomic_load_n(&crud_log_done, __ATOMIC_ACQUIRE) < target)
+		crud_log_sleep(CRUD_LOG_WAIT_NS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_exit
+// Description  : Drain the ring as the program exits
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_log_exit(void) {
+	crud_log_stop();
+}
+
+//
+// Logging interface
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_start
+// Description  : Start the writer thread, sending the log lines to "fd"
+//                (the descriptor the log service writes to, so messages
+//                logged directly land in the same place)
+//
+// Inputs       : fd - the file descriptor to write to
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_log_start(int fd) {
+	uint32_t i;
+
+	pthread_mutex_lock(&crud_log_lock);
+	if (crud_log_running) {
+		pthread_mutex_unlock(&crud_log_lock);
+		return (-1);
+	}
+	if (crud_log_ring == NULL &&
+			(crud_log_ring = crud_huge_alloc(CRUD_LOG_RING_SIZE * sizeof(CrudLogRecord))) == NULL) {
+		pthread_mutex_unlock(&crud_log_lock);
+		return (-1);
+	}
+
+	for (i = 0; i < CRUD_LOG_RING_SIZE; i++)
+		crud_log_ring[i].seq = i;
+	crud_log_head = crud_log_tail = crud_log_done = 0;
+	crud_log_fd = fd;
+	crud_log_stopping = 0;
+	if (pthread_create(&crud_log_writer, NULL, crud_log_writer_main, NULL)) {
+		pthread_mutex_unlock(&crud_log_lock);
+		return (-1);
+	}
+	if (!crud_log_registered) {
+		atexit(crud_log_exit);
+		crud_log_registered = 1;
+	}
+	__atomic_store_n(&crud_log_running, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&crud_log_lock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_stop
+// Description  : Write out the queued records and stop the writer thread
+//                (once the other threads are done logging)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_log_stop(void) {
+	pthread_mutex_lock(&crud_log_lock);
+	if (crud_log_running) {
+		__atomic_store_n(&crud_log_stopping, 1, __ATOMIC_RELEASE);
+		pthread_join(crud_log_writer, NULL);
+		__atomic_store_n(&crud_log_running, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&crud_log_lock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_message
+// Description  : Log a "printf"-style message, queued for the writer if it
+//                is running, otherwise straight to the log service
+//
+// Inputs       : lvl - the log level
+//                fmt - the format
+//                ... - the arguments
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_log_message(unsigned long lvl, const char *fmt, ...) {
+	uint8_t data[CRUD_LOG_DATA_SIZE];
+	char msg[MAX_LOG_MESSAGE_SIZE];
+	va_list args, copy;
+	int used, ret = 0;
+
+	if (!levelEnabled(lvl))
+		return (0);
+
+	va_start(args, fmt);
+	if (!__atomic_load_n(&crud_log_running, __ATOMIC_ACQUIRE) || crud_log_level_name(lvl) == NULL) {
+		__atomic_add_fetch(&crud_log_stats.direct, 1, __ATOMIC_RELAXED);
+		ret = vlogMessage(lvl, fmt, args);
+		va_end(args);
+		return (ret);
+	}
+
+	// Pack the arguments, or failing that the message itself
+	va_copy(copy, args);
+	used = crud_log_pack(fmt, copy, data, CRUD_LOG_DATA_SIZE);
+	va_end(copy);
+	if (used >= 0) {
+		crud_log_enqueue(lvl, fmt, data, used);
+	} else if ((used = vsnprintf(msg, MAX_LOG_MESSAGE_SIZE, fmt, args)) < CRUD_LOG_DATA_SIZE) {
+		crud_log_enqueue(lvl, NULL, (uint8_t *)msg, used + 1);
+	} else {
+		// Too long for a record, log it in its place once the ring is out
+		__atomic_add_fetch(&crud_log_stats.direct, 1, __ATOMIC_RELAXED);
+		crud_log_drain();
+		ret = (logMessage)(lvl, "%s", msg);
+	}
+	va_end(args);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_get_stats
+// Description  : Get the logging counts
+//
+// Inputs       : stats - the structure to fill in
+// Outputs      : none
+
+void crud_log_get_stats(CrudLogStats *stats) {
+	stats->records = __atomic_load_n(&crud_log_stats.records, __ATOMIC_RELAXED);
+	stats->direct = __atomic_load_n(&crud_log_stats.direct, __ATOMIC_RELAXED);
+	stats->waits = __atomic_load_n(&crud_log_stats.waits, __ATOMIC_RELAXED);
+	stats->writes = __atomic_load_n(&crud_log_stats.writes, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_log_stats
+// Description  : Write the logging statistics to the log
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_log_log_stats(void) {
+	CrudLogStats stats;
+
+	crud_log_get_stats(&stats);
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD log : %lu records queued, %lu logged directly, "
+		"%lu waits on a full ring, %lu batch writes", stats.records, stats.direct,
+		stats.waits, stats.writes);
+}
+
+//
+// Unit test
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_utest_case
+// Description  : Check that packing and formatting a message gives what
+//                vsnprintf does
+//
+// Inputs       : fmt - the format
+//                ... - the arguments
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_log_utest_case(const char *fmt, ...) {
+	char expected[MAX_LOG_MESSAGE_SIZE], got[MAX_LOG_MESSAGE_SIZE];
+	uint8_t data[CRUD_LOG_DATA_SIZE];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(expected, MAX_LOG_MESSAGE_SIZE, fmt, args);
+	va_end(args);
+
+	va_start(args, fmt);
+	if (crud_log_pack(fmt, args, data, CRUD_LOG_DATA_SIZE) < 0) {
+		va_end(args);
+		logMessage(LOG_ERROR_LEVEL, "CRUD_LOG_UNIT_TEST : [%s] did not pack.", fmt);
+		return (-1);
+	}
+	va_end(args);
+
+	crud_log_format(fmt, data, got, MAX_LOG_MESSAGE_SIZE);
+	if (strcmp(expected, got)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_LOG_UNIT_TEST : [%s] gave [%s] not [%s].", fmt, got, expected);
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_log_worker
+// Description  : Log a numbered run of records (a unit test thread)
+//
+// Inputs       : arg - the thread number
+// Outputs      : NULL
+
+void *crud_log_worker(void *arg) {
+	int id = (int)(intptr_t)arg;
+
+	for (int i = 0; i < CRUD_LOG_UNIT_TEST_RECORDS; i++)
+		logMessage(LOG_OUTPUT_LEVEL, "CRUD_LOG_UNIT_TEST %d %d [%s]", id, i, (i % 2) ? "odd" : "even");
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudLogUnitTest
+// Description  : Check the record encoding, then log from several threads
+//                through the ring into a temporary file and check every
+//                thread's records came out, in order
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudLogUnitTest(void) {
+	pthread_t tids[CRUD_LOG_UNIT_TEST_THREADS];
+	int next[CRUD_LOG_UNIT_TEST_THREADS];
+	char line[CRUD_LOG_LINE_SIZE], *msg;
+	int prev, id, n, i, ret = 0;
+	CrudLogSpec spec;
+	FILE *tmp;
+
+	logMessage(LOG_INFO_LEVEL, "CRUD_LOG_UNIT_TEST : Starting logging unit test.");
+	if (crud_log_utest_case("plain text, no conversions") ||
+			crud_log_utest_case("%d %i %u %o %x %X %c %%", -5, 7, 3000000000U, 8, 255, 255, 'q') ||
+			crud_log_utest_case("[%5d] [%-5d] [%05d] [%+d] [% d]", 42, 42, 42, 42, 42) ||
+			crud_log_utest_case("%hhd %hd %ld %lu %lld %llu %zu %jd %td", 300, 70000, -1L,
+				18446744073709551615UL, -9LL, 9ULL, (size_t)12, (intmax_t)-3, (ptrdiff_t)4) ||
+			crud_log_utest_case("%f %.3f %10.2e %g %Lf", 3.25, 1.0 / 3, 12345.678, 0.0001, (long double)2.5) ||
+			crud_log_utest_case("[%s] [%10s] [%-10s] [%.3s] [%s]", "abc", "right", "left", "truncate", "") ||
+			crud_log_utest_case("[%*d] [%-*d] [%.*s] [%*.*f]", 6, 1, 6, 2, 2, "xyz", 8, 2, 1.5) ||
+			crud_log_utest_case("%p", (void *)&next)) {
+		return (-1);
+	}
+
+	// Positional arguments and %n are left to the caller
+	if (crud_log_parse("%1$d", &spec) != -1 || crud_log_parse("%n", &spec) != -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_LOG_UNIT_TEST : unsupported conversion accepted.");
+		return (-1);
+	}
+
+	// Run the threads against a temporary file, putting any running writer back after
+	prev = __atomic_load_n(&crud_log_running, __ATOMIC_ACQUIRE) ? crud_log_fd : -1;
+	crud_log_stop();
+	if ((tmp = tmpfile()) == NULL || crud_log_start(fileno(tmp))) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_LOG_UNIT_TEST : Unable to start the writer.");
+		return (-1);
+	}
+	for (i = 0; i < CRUD_LOG_UNIT_TEST_THREADS; i++) {
+		next[i] = 0;
+		if (pthread_create(&tids[i], NULL, crud_log_worker, (void *)(intptr_t)i)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_LOG_UNIT_TEST : Thread create failed.");
+			return (-1);
+		}
+	}
+	for (i = 0; i < CRUD_LOG_UNIT_TEST_THREADS; i++)
+		pthread_join(tids[i], NULL);
+	crud_log_stop();
+
+	rewind(tmp);
+	while (fgets(line, CRUD_LOG_LINE_SIZE, tmp) != NULL) {
+		if ((msg = strstr(line, "] CRUD_LOG_UNIT_TEST ")) == NULL ||
+				sscanf(msg, "] CRUD_LOG_UNIT_TEST %d %d", &id, &n) != 2 ||
+				id < 0 || id >= CRUD_LOG_UNIT_TEST_THREADS || n != next[id]++ ||
+				strstr(msg, (n % 2) ? "[odd]" : "[even]") == NULL) {
+			ret = -1;
+			break;
+		}
+	}
+	for (i = 0; i < CRUD_LOG_UNIT_TEST_THREADS; i++) {
+		if (next[i] != CRUD_LOG_UNIT_TEST_RECORDS)
+			ret = -1;
+	}
+	fclose(tmp);
+	if (prev != -1)
+		crud_log_start(prev);
+
+	if (ret == 0)
+		logMessage(LOG_INFO_LEVEL, "CRUD_LOG_UNIT_TEST : Logging unit test completed successfully.");
+	else
+		logMessage(LOG_ERROR_LEVEL, "CRUD_LOG_UNIT_TEST : Records missing or out of order.");
+	return (ret);
+}
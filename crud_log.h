@@ -0,0 +1,68 @@
+#ifndef CRUD_LOG_INCLUDED
+#define CRUD_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_log.h
+//  Description    : This is the header file for the CRUD logging front end.
+//                   Including it routes the logMessage calls of a module
+//                   through a compile time level mask and, once started, an
+//                   asynchronous writer: callers pack their arguments into
+//                   a lock-free ring and a background thread formats the
+//                   records and writes them out in batches.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Thu May 25 10:12:44 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files (the logMessage prototype must come first)
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_LOG_RING_SIZE 4096     // Records in the ring (power of two)
+#define CRUD_LOG_RECORD_SIZE 256    // Bytes per ring record
+#define CRUD_LOG_BATCH_SIZE (64 * 1024) // Bytes formatted per write
+
+// The levels compiled in, e.g. -DCRUD_LOG_LEVELS=0xb drops LOG_INFO_LEVEL
+// (logMessage calls at other levels compile away, arguments and all)
+#ifndef CRUD_LOG_LEVELS
+#define CRUD_LOG_LEVELS (~0UL)
+#endif
+
+// Logging statistics
+typedef struct {
+	uint64_t records; // Records queued for the writer
+	uint64_t direct;  // Messages logged by the caller (writer stopped, or unsuitable)
+	uint64_t waits;   // Times a caller found the ring full
+	uint64_t writes;  // Batches written by the writer
+} CrudLogStats;
+
+//
+// Logging interface
+
+int crud_log_start(int fd);
+	// Start the writer thread, sending the log lines to "fd"
+
+int crud_log_stop(void);
+	// Write out the queued records and stop the writer thread
+
+int crud_log_message(unsigned long lvl, const char *fmt, ...);
+	// Log a "printf"-style message, queued if the writer is running
+
+void crud_log_get_stats(CrudLogStats *stats);
+	// Get the logging counts
+
+void crud_log_log_stats(void);
+	// Write the logging statistics to the log
+
+int crudLogUnitTest(void);
+	// Check the record encoding and the ring, from several threads
+
+// Module log calls go through the compiled in levels and the ring
+#define logMessage(lvl, ...) \
+	((((lvl) & CRUD_LOG_LEVELS) != 0) ? crud_log_message((lvl), __VA_ARGS__) : 0)
+
+#endif
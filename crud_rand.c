@@ -0,0 +1,269 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_rand.c
+//  Description    : This is the implementation of the CRUD pseudo random
+//                   numbers.  Each thread runs its own xoshiro256** state,
+//                   seeded by splitmix64 from the seed and a stream number,
+//                   so no locks are taken and a thread's numbers depend only
+//                   on the seed and its stream.  Threads that never choose a
+//                   stream are given the next free one on first use.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Mon May 29 11:05:37 PDT 2017
+//
+
+// Includes
+#include <string.h>
+#include <time.h>
+
+// Project Includes
+#include <crud_rand.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_RAND_FIRST_FREE_STREAM 0x10000 // Streams below this are chosen by the callers
+#define CRUD_RAND_UNIT_TEST_SEED 0x0123456789abcdefULL
+#define CRUD_RAND_UNIT_TEST_DRAWS 1000
+#define CRUD_RAND_UNIT_TEST_BUCKETS 16
+#define CRUD_RAND_UNIT_TEST_PER_BUCKET 10000
+#define CRUD_RAND_UNIT_TEST_SLOW_DRAWS 1000 // getRandomValue calls timed
+
+// Type definitions
+typedef struct {
+	uint64_t s[4];       // The xoshiro256** state
+	uint32_t generation; // The seed generation the state was seeded in
+} CrudRandState;
+
+// Random number Static Data
+uint64_t crud_rand_base = CRUD_RAND_DEFAULT_SEED; // The seed
+uint32_t crud_rand_generation = 1; // Bumped by each crud_rand_seed, stale states reseed
+uint32_t crud_rand_free_stream = CRUD_RAND_FIRST_FREE_STREAM; // The next stream to give out
+__thread CrudRandState crud_rand_state; // The calling thread's generator
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_splitmix
+// Description  : Step a splitmix64 generator (spreads a seed over a state)
+//
+// Inputs       : x - the generator
+// Outputs      : the next value
+
+uint64_t crud_rand_splitmix(uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (z ^ (z >> 31));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_init
+// Description  : Seed the calling thread's state for a stream
+//
+// Inputs       : stream - the stream number
+// Outputs      : none
+
+void crud_rand_init(uint32_t stream) {
+	uint64_t x = __atomic_load_n(&crud_rand_base, __ATOMIC_RELAXED) + stream * 0xd1b54a32d192ed03ULL;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		crud_rand_state.s[i] = crud_rand_splitmix(&x);
+	crud_rand_state.generation = __atomic_load_n(&crud_rand_generation, __ATOMIC_ACQUIRE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_clock
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in ns
+
+uint64_t crud_rand_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+//
+// Random number interface
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_seed
+// Description  : Set the seed, restarting the calling thread on stream 0
+//                (other threads move to a new stream on their next draw)
+//
+// Inputs       : seed - the seed
+// Outputs      : none
+
+void crud_rand_seed(uint64_t seed) {
+	__atomic_store_n(&crud_rand_base, seed, __ATOMIC_RELAXED);
+	__atomic_store_n(&crud_rand_free_stream, CRUD_RAND_FIRST_FREE_STREAM, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&crud_rand_generation, 1, __ATOMIC_RELEASE);
+	crud_rand_init(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_get_seed
+// Description  : Get the seed
+//
+// Inputs       : none
+// Outputs      : the seed
+
+uint64_t crud_rand_get_seed(void) {
+	return (__atomic_load_n(&crud_rand_base, __ATOMIC_RELAXED));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_stream
+// Description  : Put the calling thread on its own numbered stream of the
+//                seed (so a thread's numbers do not depend on the order the
+//                threads were started in)
+//
+// Inputs       : stream - the stream number (below 65536, 0 is the main thread's)
+// Outputs      : none
+
+void crud_rand_stream(uint32_t stream) {
+	crud_rand_init(stream);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_next
+// Description  : Get the next 64 random bits of the calling thread's stream
+//
+// Inputs       : none
+// Outputs      : the random bits
+
+uint64_t crud_rand_next(void) {
+	uint64_t *s = crud_rand_state.s, result, t;
+
+	if (crud_rand_state.generation != __atomic_load_n(&crud_rand_generation, __ATOMIC_ACQUIRE))
+		crud_rand_init(__atomic_fetch_add(&crud_rand_free_stream, 1, __ATOMIC_RELAXED));
+
+	result = s[1] * 5;
+	result = ((result << 7) | (result >> 57)) * 9;
+	t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_rand_value
+// Description  : Get a random value between min and max (inclusive), as
+//                getRandomValue does
+//
+// Inputs       : min - the smallest value
+//                max - the largest value
+// Outputs      : the value
+
+uint32_t crud_rand_value(uint32_t min, uint32_t max) {
+	uint64_t range = (uint64_t)max - min + 1;
+
+	if (max <= min)
+		return (min);
+	return (min + (uint32_t)(((crud_rand_next() >> 32) * range) >> 32));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudRandUnitTest
+// Description  : Check a seed and stream repeat their numbers, streams
+//                differ, values stay in range and spread evenly, and time
+//                the generator against getRandomValue
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudRandUnitTest(void) {
+	uint64_t first[CRUD_RAND_UNIT_TEST_DRAWS], stream[CRUD_RAND_UNIT_TEST_DRAWS];
+	uint32_t buckets[CRUD_RAND_UNIT_TEST_BUCKETS], val, i, same = 0;
+	volatile uint32_t sink; // Keeps the timed loops
+	uint64_t prev = crud_rand_get_seed(), start, fast, slow;
+	int ret = 0;
+
+	logMessage(LOG_INFO_LEVEL, "CRUD_RAND_UNIT_TEST : Starting random number unit test.");
+
+	// The same seed and stream give the same numbers, other streams do not
+	crud_rand_seed(CRUD_RAND_UNIT_TEST_SEED);
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_DRAWS; i++)
+		first[i] = crud_rand_next();
+	crud_rand_stream(7);
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_DRAWS; i++)
+		stream[i] = crud_rand_next();
+	crud_rand_seed(CRUD_RAND_UNIT_TEST_SEED);
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_DRAWS; i++) {
+		if (crud_rand_next() != first[i])
+			ret = -1;
+	}
+	crud_rand_stream(7);
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_DRAWS; i++) {
+		if (crud_rand_next() != stream[i])
+			ret = -1;
+		same += (stream[i] == first[i]);
+	}
+	if (ret || same) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_RAND_UNIT_TEST : Seeded streams did not repeat or overlapped.");
+		return (-1);
+	}
+
+	// In range (ends included) and evenly spread
+	memset(buckets, 0x0, sizeof(buckets));
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_BUCKETS * CRUD_RAND_UNIT_TEST_PER_BUCKET; i++) {
+		val = crud_rand_value(100, 100 + CRUD_RAND_UNIT_TEST_BUCKETS - 1);
+		if (val < 100 || val >= 100 + CRUD_RAND_UNIT_TEST_BUCKETS) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_RAND_UNIT_TEST : Value %u out of range.", val);
+			return (-1);
+		}
+		buckets[val - 100]++;
+	}
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_BUCKETS; i++) {
+		if (buckets[i] < CRUD_RAND_UNIT_TEST_PER_BUCKET * 95 / 100 ||
+				buckets[i] > CRUD_RAND_UNIT_TEST_PER_BUCKET * 105 / 100) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_RAND_UNIT_TEST : Value %u drawn %u times, expected about %u.",
+				100 + i, buckets[i], CRUD_RAND_UNIT_TEST_PER_BUCKET);
+			return (-1);
+		}
+	}
+	if (crud_rand_value(5, 5) != 5 || crud_rand_value(9, 3) != 9) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_RAND_UNIT_TEST : Empty range not handled.");
+		return (-1);
+	}
+
+	// Time it against the gcrypt backed values it replaces
+	start = crud_rand_clock();
+	for (i = 0, val = 0; i < CRUD_RAND_UNIT_TEST_BUCKETS * CRUD_RAND_UNIT_TEST_PER_BUCKET; i++)
+		val += crud_rand_value(0, UINT32_MAX);
+	fast = crud_rand_clock() - start;
+	start = crud_rand_clock();
+	for (i = 0; i < CRUD_RAND_UNIT_TEST_SLOW_DRAWS; i++)
+		val += getRandomValue(0, UINT32_MAX);
+	slow = crud_rand_clock() - start;
+	sink = val;
+	logMessage(LOG_INFO_LEVEL, "CRUD_RAND_UNIT_TEST : %.1f ns per value, getRandomValue %.1f ns",
+		(double)fast / (CRUD_RAND_UNIT_TEST_BUCKETS * CRUD_RAND_UNIT_TEST_PER_BUCKET),
+		(double)slow / CRUD_RAND_UNIT_TEST_SLOW_DRAWS);
+	(void)sink;
+
+	// Leave the following tests on the seed they were given
+	crud_rand_seed(prev);
+	logMessage(LOG_INFO_LEVEL, "CRUD_RAND_UNIT_TEST : Random number unit test completed successfully.");
+	return (0);
+}
@@ -0,0 +1,43 @@
+#ifndef CRUD_RAND_INCLUDED
+#define CRUD_RAND_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_rand.h
+//  Description    : This is the header file for the CRUD pseudo random
+//                   numbers: a seedable xoshiro256** generator with a state
+//                   per thread, so the unit tests, stress runs and generated
+//                   workloads can be replayed from their seed.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Mon May 29 11:05:37 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_RAND_DEFAULT_SEED 311 // The seed when none is given
+
+//
+// Random number interface
+
+void crud_rand_seed(uint64_t seed);
+	// Set the seed, restarting the calling thread on stream 0
+
+uint64_t crud_rand_get_seed(void);
+	// Get the seed
+
+void crud_rand_stream(uint32_t stream);
+	// Put the calling thread on its own numbered stream of the seed
+
+uint64_t crud_rand_next(void);
+	// Get the next 64 random bits of the calling thread's stream
+
+uint32_t crud_rand_value(uint32_t min, uint32_t max);
+	// Get a random value between min and max (inclusive)
+
+int crudRandUnitTest(void);
+	// Check the generator is repeatable, in range and roughly uniform
+
+#endif
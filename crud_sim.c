@@ -17,45 +17,181 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <getopt.h>
 
 // Project Includes
 #include <crud_driver.h>
 #include <crud_file_io.h>
+#include <crud_cache.h>
+#include <crud_batch.h>
+#include <crud_bench.h>
+#include <crud_stats.h>
+#include <crud_trace.h>
+#include <crud_alloc.h>
+#include <crud_rand.h>
+#include <crud_gen.h>
 #include <cmpsc311_log.h>
+#include <crud_log.h>
 #include <cmpsc311_util.h>
 #include <cmpsc311_hashtable.h>
 
 // Defines
-#define CRUD_SIM_MAX_OPEN_FILES 128
-#define CRUD_ARGUMENTS "hvul:x:"
+#define CRUD_SIM_OPEN_FILES 128 // Initial file table size (power of two), grown as needed
+#define CRUD_SIM_BATCH_WINDOW 64 // Workload lines per request batch
+#define CRUD_SIM_STRESS_THREADS 4 // Threads in the unit test stress run
+#define CRUD_SIM_MAX_THREADS 64 // Most workload replay threads
+#define CRUD_SIM_STREAM_SIZE 64 // Initial commands per file replay stream
+#define CRUD_SIM_BINARY_MAGIC 0x42575243 // "CRWB", marks a compiled workload
+#define CRUD_SIM_BINARY_VERSION 1
+#define CRUD_SIM_COMPILE_NAMES 32768 // Most distinct filenames in a compiled workload
+#define CRUD_SIM_STREAM_CHUNK (1 << 20) // Bytes moved per read/write when extracting or importing
+#define CRUD_ARGUMENTS "hvubdal:x:i:c:w:T:j:t:s:"
 #define USAGE \
-	"USAGE: crud [-h] [-v] [-l <logfile>] [-c <sz>] [-x <file>] <workload-file>\n" \
+	"USAGE: crud [-h] [-v] [-b] [-d] [-a] [-l <logfile>] [-c <sz>] [-w <lines>] [-T <threads>] [-j <threads>] [-t <trace>] [-s <seed>] <workload-file>\n" \
+	"       crud [-i <file> ...] [-x <file> ...] [<file> ...]\n" \
+	"       crud --compile <workload-file> <compiled-file>\n" \
+	"       crud [-s <seed>] --generate <spec> <workload-file> [<compiled-file>]\n" \
+	"       crud --trace-report <trace>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -u - run the unit tests instead of the simulator\n" \
 	"    -v - verbose output\n" \
+	"    -b - benchmark the file calls (JSON summary on stdout)\n" \
+	"    -d - dump the bus requests made by each file call on exit\n" \
+	"    -a - format and write the log messages on a background thread\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
-	"    -x - extract a file <file> from the crud filesystem\n" \
+	"    -c - use a block cache of <sz> lines (0 disables the cache)\n" \
+	"    -w - batch the bus requests of <lines> workload lines (0 disables)\n" \
+	"    -j - replay the files of the workload on <threads> threads\n" \
+	"    -T - run the unit test stress run with <threads> threads (0 disables)\n" \
+	"    -t - trace every bus request to the binary file <trace>\n" \
+	"    -s - seed the random numbers of the unit tests with <seed>\n" \
+	"    -x - extract the file <file> from the crud filesystem (repeatable)\n" \
+	"    -i - import the host file <file> into the crud filesystem (repeatable)\n" \
 	"\n" \
-	"    <workload-file> - file contain the workload to simulate\n" \
+	"    --compile - convert a text workload to the compiled (binary) form\n" \
+	"    --generate - write a synthetic workload (and compile it, if asked), the\n" \
+	"                 expected file contents and a check script, <spec> being\n" \
+	"    " CRUD_GEN_SPEC_HELP "\n" \
+	"    --trace-report - compare the bytes written by each file with the bus bytes of a trace\n" \
 	"\n" \
+	"    <workload-file> - file contain the workload to simulate (text or compiled)\n" \
+	"    <file> - more files to import or extract, as the last -i or -x did\n" \
+	"\n" \
+
+// These are the commands of a workload
+typedef enum {
+	CRUD_SIM_WRITEAT = 0, // Seek then write
+	CRUD_SIM_WRITE   = 1, // Write at the file position
+	CRUD_SIM_SEEK    = 2, // Seek to a position
+	CRUD_SIM_READ    = 3, // Read at the file position
+	CRUD_SIM_FORMAT  = 4, // Format the filesystem (this and below are barriers)
+	CRUD_SIM_MOUNT   = 5, // Mount the filesystem
+	CRUD_SIM_UNMOUNT = 6, // Close all files and unmount the filesystem
+	CRUD_SIM_UNKNOWN = -1,
+} CRUD_SIM_COMMANDS;
+
+// This is a decoded file command
+typedef struct {
+	CRUD_SIM_COMMANDS  op;   // The command
+	int32_t            len;  // The length field of the command
+	int32_t            off;  // The offset field of the command
+	char              *text; // The data to write (NULL if none)
+} CrudSimulationOp;
 
 // This is the file table
 typedef struct {
-	char     *filename;  // This is the filename for the test file
-	int16_t   fhandle;   // This is a file handle for the opened file
+	char             *filename;  // This is the filename for the test file
+	int32_t           fhandle;   // This is a file handle for the opened file
+	CrudSimulationOp *ops;       // Commands queued for parallel replay
+	int32_t           nops;      // The number of queued commands
+	int32_t           maxops;    // The size of the command queue
 } CrudSimulationTable;
 
+// This is the state of a workload replay
+typedef struct {
+	CrudSimulationTable *ftable; // The open files
+	int32_t *findex;    // Filename index (twice the table size), ftable index+1 (0 empty)
+	int      maxfiles;  // The size of the file table
+	int      nfiles;    // The number of files in the table
+	int32_t  linecount; // The number of commands executed
+} CrudSimulationState;
+
+// A compiled workload is this header, the filename table (an offset per
+// file id, relative to the table, followed by the names), the records,
+// and the payload area holding the (already translated) write data.
+typedef struct {
+	uint32_t magic;    // CRUD_SIM_BINARY_MAGIC
+	uint32_t version;  // CRUD_SIM_BINARY_VERSION
+	uint32_t nfiles;   // The number of interned filenames
+	uint32_t nrecords; // The number of records
+	uint64_t names;    // File offset of the filename table
+	uint64_t records;  // File offset of the records
+	uint64_t payload;  // File offset of the payload area
+	uint64_t size;     // The size of the whole file
+} CrudSimBinaryHeader;
+
+typedef struct {
+	uint16_t op;      // The command (CRUD_SIM_COMMANDS)
+	uint16_t file;    // The file id (index in the filename table)
+	int32_t  len;     // The length field of the command
+	int32_t  off;     // The offset field of the command
+	uint32_t payload; // Offset of the write data in the payload area
+} CrudSimBinaryRecord;
+
+// A step of a stream copy (read or write of up to "len" bytes)
+typedef int32_t (*CrudSimStreamIO)( int32_t handle, char *buf, int32_t len );
+
+// This is a stream copy, whose chunks are queued (two at most) for its
+// writer thread, the fields below the buffers being guarded by "lock"
+typedef struct {
+	CrudSimStreamIO  put;    // The sink write step
+	int32_t          handle; // The sink handle
+	char            *buf[2]; // The chunk buffers
+	int32_t          len[2]; // The bytes in each queued chunk
+	int              head;   // The chunk the writer takes next
+	int              queued; // The chunks queued for the writer
+	int              done;   // Flag indicating no more chunks will be queued
+	int              failed; // Flag indicating a write failed
+	pthread_mutex_t  lock;   // Guards the queue
+	pthread_cond_t   cond;   // Signalled when the queue changes
+} CrudSimStream;
+
+// This is the work shared by the replay threads
+typedef struct {
+	CrudSimulationTable *ftable; // The simulation file table
+	int                  nfiles; // The number of files in the table
+	int                  next;   // The next file to be replayed
+	int                  failed; // Flag indicating a command failed (atomic)
+} CrudSimulationPool;
+
 //
 // Global Data
 int verbose;
+uint32_t batch_window = CRUD_SIM_BATCH_WINDOW; // Workload lines per request batch
+uint32_t sim_threads = 1; // Workload replay threads (1 replays serially)
 
 //
 // Functional Prototypes
 
 int simulate_CRUD( char *wload );
+int sim_replay_workload( char *wload, char *end );
+int sim_replay_binary( char *wload, size_t size );
+int sim_compile_workload( char *wload, char *out );
+int sim_generate_workload( char *spec, char *out, char *compiled );
+char *sim_map_file( char *wload, size_t *size );
+int sim_parse_line( char *line, char *eol, char **fname, char **command, CrudSimulationOp *op );
 int extract_file_from_crud(char *ex_file);
+int import_file_to_crud(char *im_file);
+int sim_stream_copy( CrudSimStreamIO get, int32_t from, CrudSimStreamIO put, int32_t to );
+uint32_t sim_name_hash( const char *fname );
+int sim_file_command( CrudSimulationTable *ent, CrudSimulationOp *op );
+int sim_queue_command( CrudSimulationTable *ent, CrudSimulationOp *op );
+int sim_grow_files( CrudSimulationState *ss );
+int sim_replay_files( CrudSimulationTable *ftable, int nfiles );
 
 //
 // Functions
@@ -71,12 +207,22 @@ int extract_file_from_crud(char *ex_file);
 
 int main( int argc, char *argv[] ) {
 	// Local variables
-	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0;
+	int ch, verbose = 0, unit_tests = 0, benchmark = 0, bus_stats = 0, async_log = 0;
+	int i, log_fd = CMPSC311_LOG_STDERR, nex_files = 0, nim_files = 0, last_move = 0;
 	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
-	char *ex_file = NULL;
+	uint32_t stress_threads = CRUD_SIM_STRESS_THREADS;
+	unsigned long long seed = CRUD_RAND_DEFAULT_SEED;
+	char *compile_file = NULL, *trace_file = NULL, *report_file = NULL, *log_file = NULL, *gen_spec = NULL;
+	char *ex_files[argc], *im_files[argc]; // The files to extract and import
+	struct option long_options[] = {
+		{ "compile", required_argument, NULL, 'C' },
+		{ "trace-report", required_argument, NULL, 'R' },
+		{ "generate", required_argument, NULL, 'G' },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	// Process the command line parameters
-	while ((ch = getopt(argc, argv, CRUD_ARGUMENTS)) != -1) {
+	while ((ch = getopt_long(argc, argv, CRUD_ARGUMENTS, long_options, NULL)) != -1) {
 
 		switch (ch) {
 		case 'h': // Help, print usage
@@ -87,23 +233,81 @@ int main( int argc, char *argv[] ) {
 			verbose = 1;
 			break;
 
+		case 'b': // Benchmark Flag
+			benchmark = 1;
+			break;
+
+		case 'd': // Bus statistics Flag
+			bus_stats = 1;
+			break;
+
 		case 'u': // Unit Tests Flag
 			unit_tests = 1;
 			break;
 
+		case 'a': // Asynchronous logging Flag
+			async_log = 1;
+			break;
+
 		case 'l': // Set the log filename
-			initializeLogWithFilename( optarg );
-			log_initialized = 1;
+			log_file = optarg;
+			break;
+
+		case 'x': // Add a file to extract
+			ex_files[nex_files++] = optarg;
+			last_move = 'x';
+			break;
+
+		case 'i': // Add a file to import
+			im_files[nim_files++] = optarg;
+			last_move = 'i';
+			break;
+
+		case 'w': // Set batch window size
+			if ( sscanf( optarg, "%u", &batch_window ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad batch window [%s]", optarg );
+			}
 			break;
 
-		case 'x': // Set the log filename
-			ex_file = optarg;
-			extract_file = 1;
+		case 'C': // Compile a workload
+			compile_file = optarg;
+			break;
+
+		case 'G': // Generate a workload
+			gen_spec = optarg;
+			break;
+
+		case 't': // Trace the bus requests
+			trace_file = optarg;
+			break;
+
+		case 'R': // Report on a trace
+			report_file = optarg;
+			break;
+
+		case 'j': // Set workload replay thread count
+			if ( (sscanf( optarg, "%u", &sim_threads ) != 1) || (sim_threads > CRUD_SIM_MAX_THREADS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad replay thread count [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'T': // Set stress test thread count
+			if ( sscanf( optarg, "%u", &stress_threads ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad thread count [%s]", optarg );
+			}
+			break;
+
+		case 's': // Set the random seed
+			if ( sscanf( optarg, "%llu", &seed ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad random seed [%s]", optarg );
+			    return( -1 );
+			}
 			break;
 
 		case 'c': // Set cache line size
 			if ( sscanf( optarg, "%u", &cache_size ) != 1 ) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
+			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", optarg );
 			}
 			break;
 
@@ -113,32 +317,119 @@ int main( int argc, char *argv[] ) {
 		}
 	}
 
-	// Setup the log as needed
-	if ( ! log_initialized ) {
-		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	// Setup the log as needed, the writer thread needs the descriptor the log uses
+	if ( log_file && ! async_log ) {
+		initializeLogWithFilename( log_file );
+	} else {
+		if ( log_file && ((log_fd = open(log_file, O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR)) == -1) ) {
+			fprintf( stderr, "Unable to open log file [%s], aborting.\n", log_file );
+			return( -1 );
+		}
+		initializeLogWithFilehandle( log_fd );
 	}
 	if ( verbose ) {
 		enableLogLevels( LOG_INFO_LEVEL );
 	}
+	if ( async_log && crud_log_start(log_fd) ) {
+		fprintf( stderr, "Unable to start the log writer, aborting.\n" );
+		return( -1 );
+	}
+
+	// Seed the random numbers, then setup the block cache
+	crud_rand_seed( seed );
+	if ( crud_cache_init(cache_size) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to setup cache of %u lines, aborting.", cache_size );
+		return( -1 );
+	}
+
+	// Start the trace, if asked
+	if ( trace_file && crud_trace_open(trace_file) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to trace to [%s], aborting.", trace_file );
+		return( -1 );
+	}
+
+	// If we are reporting on a trace, do that
+	if ( report_file ) {
+
+		if ( crud_trace_report(report_file, stdout) ) {
+			logMessage( LOG_ERROR_LEVEL, "Reporting on trace [%s] failed.\n\n", report_file );
+		}
+
+	// If we are compiling a workload, do that
+	} else if ( compile_file ) {
+
+		// The output filename should be the next option
+		if ( optind >= argc ) {
+			fprintf( stderr, "Missing compiled workload filename, use -h to see usage, aborting.\n" );
+			return( -1 );
+		}
+		if ( sim_compile_workload(compile_file, argv[optind]) == 0 ) {
+			logMessage( LOG_INFO_LEVEL, "Workload [%s] compiled to [%s].\n\n", compile_file, argv[optind] );
+		} else {
+			logMessage( LOG_ERROR_LEVEL, "Compiling workload [%s] failed.\n\n", compile_file );
+		}
+
+	// If we are generating a workload, do that
+	} else if ( gen_spec ) {
+
+		// The workload (and optional compiled) filenames should be next
+		if ( optind >= argc ) {
+			fprintf( stderr, "Missing workload filename, use -h to see usage, aborting.\n" );
+			return( -1 );
+		}
+		if ( sim_generate_workload(gen_spec, argv[optind], (optind+1 < argc) ? argv[optind+1] : NULL) == 0 ) {
+			logMessage( LOG_INFO_LEVEL, "Workload [%s] generated.\n\n", argv[optind] );
+		} else {
+			logMessage( LOG_ERROR_LEVEL, "Generating workload [%s] failed.\n\n", argv[optind] );
+		}
 
 	// If we are running the unit tests, do that
-	if ( unit_tests ) {
+	} else if ( unit_tests ) {
 
-		// Enable verbose, run the tests and check the results
+		// Enable verbose, run the tests and check the results (-s <seed> replays a run)
 		enableLogLevels( LOG_INFO_LEVEL );
-		if ( hashTableUnitTest() || crud_unit_test() || crudIOUnitTest() ) {
+		logMessage( LOG_INFO_LEVEL, "CRUD unit tests starting with random seed %llu.", seed );
+		if ( crudRandUnitTest() || hashTableUnitTest() || crudGenUnitTest() || crudAllocUnitTest() || crudLogUnitTest() || crud_unit_test() || crudIOUnitTest() ||
+				(stress_threads && crudIOStressTest(stress_threads)) ) {
 			logMessage( LOG_ERROR_LEVEL, "CRUD unit tests failed.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD unit tests completed successfully.\n\n" );
 		}
 
-	} else if (extract_file) {
+	} else if (last_move) {
 
-		// Extracting a file from the crud file systems
-		if (extract_file_from_crud(ex_file) == 0) {
-			logMessage(LOG_INFO_LEVEL, "File [%s] extracted from crud successfully.\n\n", ex_file);
-		} else {
-			logMessage(LOG_ERROR_LEVEL, "File [%s] extraction failed, aborting.\n\n");
+		// Any other filenames go with the last of -i or -x
+		for ( i = optind; i < argc; i++ ) {
+			if ( last_move == 'x' ) {
+				ex_files[nex_files++] = argv[i];
+			} else {
+				im_files[nim_files++] = argv[i];
+			}
+		}
+
+		// Moving files between the host and the crud file system, imports first
+		if ( crud_mount() ) {
+			logMessage(LOG_ERROR_LEVEL, "Mounting the crud file system failed, aborting.\n\n");
+			return( -1 );
+		}
+		for ( i = 0; i < nim_files; i++ ) {
+			if (import_file_to_crud(im_files[i]) == 0) {
+				logMessage(LOG_INFO_LEVEL, "File [%s] imported to crud successfully.\n\n", im_files[i]);
+			} else {
+				logMessage(LOG_ERROR_LEVEL, "File [%s] import failed.\n\n", im_files[i]);
+			}
+		}
+		for ( i = 0; i < nex_files; i++ ) {
+			if (extract_file_from_crud(ex_files[i]) == 0) {
+				logMessage(LOG_INFO_LEVEL, "File [%s] extracted from crud successfully.\n\n", ex_files[i]);
+			} else {
+				logMessage(LOG_ERROR_LEVEL, "File [%s] extraction failed.\n\n", ex_files[i]);
+			}
+		}
+
+		// Imports are only kept once the file system is unmounted
+		if ( nim_files && crud_unmount() ) {
+			logMessage(LOG_ERROR_LEVEL, "Unmounting the crud file system failed.\n\n");
 		}
 
 	} else {
@@ -152,7 +443,10 @@ int main( int argc, char *argv[] ) {
 
 		}
 
-		// Run the simulation
+		// Run the simulation, timing the file calls as asked
+		if ( benchmark ) {
+			crud_bench_enable();
+		}
 		if ( simulate_CRUD(argv[optind]) == 0 ) {
 			logMessage( LOG_INFO_LEVEL, "CRUD simulation completed successfully.\n\n" );
 		} else {
@@ -160,6 +454,23 @@ int main( int argc, char *argv[] ) {
 		}
 	}
 
+	// Report the benchmark, cache and batching behavior, release the cache
+	crud_bench_report( stdout );
+	crud_cache_log_stats();
+	crud_batch_log_stats();
+	crud_alloc_log_stats();
+	if ( bus_stats ) {
+		crud_stats_log();
+	}
+	crud_cache_close();
+	if ( trace_file && crud_trace_close() ) {
+		logMessage( LOG_ERROR_LEVEL, "Trace [%s] is incomplete.", trace_file );
+	}
+	if ( async_log ) {
+		crud_log_log_stats();
+		crud_log_stop();
+	}
+
 	// Return successfully
 	return( 0 );
 }
@@ -168,7 +479,9 @@ int main( int argc, char *argv[] ) {
 //
 // Function     : simulate_CRUD
 // Description  : The main control loop for the processing of the CRUD
-//                simulation.
+//                simulation.  The workload file is mapped (privately, so
+//                lines can be tokenized in place) and replayed from memory,
+//                either as text or as a workload compiled with --compile.
 //
 // Inputs       : wload - the name of the workload file
 // Outputs      : 0 if successful test, -1 if failure
@@ -176,244 +489,1179 @@ int main( int argc, char *argv[] ) {
 int simulate_CRUD( char *wload ) {
 
 	// Local variables
-	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
-	CrudSimulationTable ftable[CRUD_SIM_MAX_OPEN_FILES];
-	int idx, i;
+	size_t size;
+	char *map;
+	int ret;
 
-	// Setup the file table
-	memset(ftable, 0x0, sizeof(CrudSimulationTable)*CRUD_SIM_MAX_OPEN_FILES);
+	// Map the workload file
+	if ( (map = sim_map_file(wload, &size)) == NULL ) {
+		return( -1 );
+	}
+	if ( size == 0 ) {
+		return( 0 );
+	}
+
+	// Replay it, compiled or text, then drop the mapping
+	if ( (size >= sizeof(CrudSimBinaryHeader)) &&
+			(((CrudSimBinaryHeader *)map)->magic == CRUD_SIM_BINARY_MAGIC) ) {
+		ret = sim_replay_binary( map, size );
+	} else {
+		ret = sim_replay_workload( map, map + size );
+	}
+	munmap( map, size );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_map_file
+// Description  : Map a workload file privately (writable, changes are not
+//                written back)
+//
+// Inputs       : wload - the name of the workload file
+//                size - set to the size of the file
+// Outputs      : the mapping (not to be unmapped if the size is 0), or NULL
+
+char *sim_map_file( char *wload, size_t *size ) {
+
+	// Local variables
+	static char empty[1];
+	struct stat st;
+	char *map;
+	int fd;
 
 	// Open the workload file
-	linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
+	if ( ((fd = open(wload, O_RDONLY)) == -1) || (fstat(fd, &st) == -1) ) {
 		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
 			wload, strerror(errno) );
-		return( -1 );
+		if ( fd != -1 ) {
+			close( fd );
+		}
+		return( NULL );
+	}
+	*size = st.st_size;
+	if ( st.st_size == 0 ) {
+		close( fd );
+		return( empty );
 	}
 
-	// While file not done
-	while (!feof(fhandle)) {
+	// Map it, we read it straight through
+	map = mmap( NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.\n",
+			wload, strerror(errno) );
+		return( NULL );
+	}
+	madvise( map, st.st_size, MADV_SEQUENTIAL );
+	return( map );
+}
 
-		// Get the line and bail out on fail
-		if (fgets(line, 1024, fhandle) != NULL) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_execute
+// Description  : Execute one workload command.  With more than one replay
+//                thread, the file commands between two filesystem commands
+//                are queued per file and each file's queue replayed in order
+//                on the pool.
+//
+// Inputs       : ss - the simulation state
+//                fname - the filename of the command
+//                op - the decoded command
+// Outputs      : 0 if successful, -1 if failure
 
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
-				return( -1 );
-			}
+int sim_execute( CrudSimulationState *ss, const char *fname, CrudSimulationOp *op ) {
 
-			// Just log the contents
-			logMessage(LOG_INFO_LEVEL, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
+	// Local variables
+	CrudSimulationTable *ftable = ss->ftable;
+	int32_t err = 0, ret;
+	uint64_t t;
+	uint32_t slot;
+	int idx;
+
+	// Filesystem commands wait for every queued file command
+	ss->linecount ++;
+	if ( (op->op >= CRUD_SIM_FORMAT) && sim_replay_files(ftable, ss->nfiles) ) {
+		logMessage(LOG_ERROR_LEVEL, "Parallel replay failed, aborting simulation.");
+		return(-1);
+	}
 
-			// Now process the commands
-			if (strncmp(command, "FORMAT", 6) == 0) {
+	// Now process the commands
+	switch ( op->op ) {
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+	case CRUD_SIM_FORMAT:
 
-				// Now perform the format
-				if (crud_format() != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
-					return(-1);
-				}
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+
+		// Now perform the format
+		t = crud_bench_now();
+		ret = crud_format();
+		crud_bench_record(CRUD_BENCH_FORMAT, t, 0);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
+			return(-1);
+		}
+		break;
+
+	case CRUD_SIM_MOUNT:
+
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
+
+		// Now perform the filesystem mount
+		t = crud_bench_now();
+		ret = crud_mount();
+		crud_bench_record(CRUD_BENCH_MOUNT, t, 0);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+			return(-1);
+		}
+		break;
+
+	case CRUD_SIM_UNMOUNT:
 
-			} else if (strncmp(command, "MOUNT", 5) == 0) {
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
+		// Finished, close all of the files
+		for (idx=0; idx<ss->nfiles; idx++) {
 
-				// Now perform the filesystem mount
-				if (crud_mount() != len) {
+			// If file in use, close if
+			if (ftable[idx].filename != NULL) {
+				// Log the file close
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", ftable[idx].filename);
+				t = crud_bench_now();
+				ret = crud_close(ftable[idx].fhandle);
+				crud_bench_record(CRUD_BENCH_CLOSE, t, 0);
+				if (ret == -1) {
 					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+					logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", ftable[idx].filename);
 					return(-1);
 				}
+				free(ftable[idx].filename);
+				free(ftable[idx].ops);
+				memset(&ftable[idx], 0x0, sizeof(CrudSimulationTable));
+			}
 
-			} else if (strncmp(command, "UNMOUNT", 5) == 0) {
+		}
+		if ( ss->findex != NULL ) {
+			memset(ss->findex, 0x0, ss->maxfiles * 2 * sizeof(int32_t));
+		}
+		ss->nfiles = 0;
+
+		// Now perform the filesystem unmount
+		t = crud_bench_now();
+		ret = crud_unmount();
+		crud_bench_record(CRUD_BENCH_UNMOUNT, t, 0);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+			return(-1);
+		}
+		break;
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
+	default:
 
-				// Finished, close all of the files
-				for (idx=0; idx<CRUD_SIM_MAX_OPEN_FILES; idx++) {
+		//
+		// File operations
 
-					// If file in use, close if
-					if (ftable[idx].filename != NULL) {
-						// Log the file close
-						logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", ftable[idx].filename);
-						if (crud_close(ftable[idx].fhandle) == -1) {
-							// Failed, error out
-							logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", ftable[idx].filename);
-							return(-1);
-						}
-						free(ftable[idx].filename);
-						ftable[idx].filename = NULL;
-					}
+		// Make room for a new file, then probe the filename index looking for the file
+		if ( (ss->nfiles == ss->maxfiles) && sim_grow_files(ss) ) {
+			return( -1 );
+		}
+		ftable = ss->ftable;
+		idx = -1;
+		slot = sim_name_hash(fname) & (ss->maxfiles * 2 - 1);
+		while ( ss->findex[slot] != 0 ) {
+			if ( strcmp(ftable[ss->findex[slot]-1].filename,fname) == 0 ) {
+				idx = ss->findex[slot]-1;
+				break;
+			}
+			slot = (slot + 1) & (ss->maxfiles * 2 - 1);
+		}
 
-				}
+		// File is not found, open the file
+		if (idx == -1) {
+
+			// Log message, take next unused index and save filename for later use
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
+			idx = ss->nfiles++;
+			ftable[idx].filename = strdup(fname);
+			ss->findex[slot] = idx+1;
+
+			// Now perform the open
+			t = crud_bench_now();
+			ftable[idx].fhandle = crud_open(ftable[idx].filename);
+			crud_bench_record(CRUD_BENCH_OPEN, t, 0);
+			if (ftable[idx].fhandle == -1) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
+				return(-1);
+			}
 
-				// Now perform the filesystem unmount
-				if (crud_unmount() != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
-					return(-1);
-				}
+		}
 
+		// Run it now, or queue a copy for the file's replay stream
+		if (sim_threads <= 1) {
+			err = sim_file_command(&ftable[idx], op);
+		} else {
+			err = sim_queue_command(&ftable[idx], op);
+		}
+		if ( err ) {
+			return( -1 );
+		}
+		break;
+	}
 
-			} else {
+	// Dispatch the requests queued by this window of lines
+	if ( (batch_window > 0) && (sim_threads <= 1) && ((ss->linecount % batch_window) == 0) && crud_batch_flush() ) {
+		err = -1;
+	}
 
-				//
-				// File operations
-
-				// Now walk the the table looking for the file
-				idx = -1;
-				i = 0;
-				while ( (i < CRUD_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-					if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-						idx = i;
-					}
-					i++;
-				}
+	// Check for the virtual level failing
+	if ( err ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_finish
+// Description  : Replay and dispatch whatever is still queued at the end of
+//                the workload
+//
+// Inputs       : ss - the simulation state
+// Outputs      : 0 if successful, -1 if failure
 
-				// File is not found, open the file
-				if (idx == -1) {
-
-					// Log message, find unused index and save filename for later use
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
-					idx = 0;
-					while ((ftable[idx].filename != NULL) && (idx < CRUD_SIM_MAX_OPEN_FILES)) {
-						idx++;
-					}
-					CMPSC_ASSERT1(idx<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", idx);
-					ftable[idx].filename = strdup(fname);
-
-					// Now perform the open
-					ftable[idx].fhandle = crud_open(ftable[idx].filename);
-					if (ftable[idx].fhandle == -1) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-						return(-1);
-					}
+int sim_finish( CrudSimulationState *ss ) {
 
-				}
+	// Local variables
+	int idx, ret = 0;
+
+	// Replay whatever file commands are still queued
+	if ( sim_replay_files(ss->ftable, ss->nfiles) ) {
+		logMessage( LOG_ERROR_LEVEL, "Parallel replay failed, aborting simulation." );
+		ret = -1;
+	}
+
+	// Dispatch whatever is still queued
+	if ( crud_batch_end() ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD batched requests failed, aborting" );
+		ret = -1;
+	}
+
+	// Release the file table (files still open stay open)
+	for ( idx=0; idx<ss->nfiles; idx++ ) {
+		free( ss->ftable[idx].filename );
+		free( ss->ftable[idx].ops );
+	}
+	free( ss->ftable );
+	free( ss->findex );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_grow_files
+// Description  : Double the file table, rebuilding the filename index
+//
+// Inputs       : ss - the simulation state
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_grow_files( CrudSimulationState *ss ) {
+
+	// Local variables
+	int max = ss->maxfiles ? ss->maxfiles * 2 : CRUD_SIM_OPEN_FILES, idx;
+	CrudSimulationTable *ftable;
+	int32_t *findex;
+	uint32_t slot;
+
+	if ( (ftable = realloc(ss->ftable, max * sizeof(CrudSimulationTable))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to grow the file table to %d files.", max );
+		return( -1 );
+	}
+	ss->ftable = ftable;
+	memset( &ftable[ss->maxfiles], 0x0, (max - ss->maxfiles) * sizeof(CrudSimulationTable) );
+	if ( (findex = calloc(max * 2, sizeof(int32_t))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to grow the filename index to %d files.", max );
+		return( -1 );
+	}
+
+	// Re-index the files already open
+	for ( idx=0; idx<ss->nfiles; idx++ ) {
+		slot = sim_name_hash(ftable[idx].filename) & (max * 2 - 1);
+		while ( findex[slot] != 0 ) {
+			slot = (slot + 1) & (max * 2 - 1);
+		}
+		findex[slot] = idx+1;
+	}
+	free( ss->findex );
+	ss->findex = findex;
+	ss->maxfiles = max;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_replay_workload
+// Description  : Replay the text workload lines held in memory
+//
+// Inputs       : wload - the start of the workload text
+//                end - the end of the workload text
+// Outputs      : 0 if successful test, -1 if failure
+
+int sim_replay_workload( char *wload, char *end ) {
+
+	// Local variables
+	CrudSimulationState ss;
+	char *line, *eol, *fname, *command;
+	CrudSimulationOp op;
+
+	// Setup the file table, queue bus requests a window of lines at a time
+	memset(&ss, 0x0, sizeof(ss));
+	if ( batch_window > 0 ) {
+		crud_batch_begin();
+	}
+
+	// While file not done, one line at a time
+	for (line = wload; line < end; line = eol + 1) {
+		if ( (eol = memchr(line, '\n', end - line)) == NULL ) {
+			eol = end;
+		}
+		if ( eol == line ) {
+			continue;
+		}
 
-				// Now execute the specific command
-				if (strncmp(command, "WRITEAT", 7) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
-
-					// First perform the seek
-					if (crud_seek(ftable[idx].fhandle, off)) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
-
-					// Now perform the write
-					if (crud_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "WRITE", 5) == 0) {
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", len, fname);
-
-					// Now perform the write
-					if (crud_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "SEEK", 4) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", off, fname);
-
-					// Now perform the seek
-					if (crud_seek(ftable[idx].fhandle, off) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "READ", 4) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", len, fname);
-
-					// Now perform the read
-					rbuf = malloc(len);
-					if (crud_read(ftable[idx].fhandle, rbuf, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-					free(rbuf);
-					rbuf = NULL;
-
-				} else {
-
-					// Bomb out, don't understand the command
-					CMPSC_ASSERT1(0, "CRUD_SIM : Failed, unknown command [%s]", command);
+		// Parse out the string
+		if ( sim_parse_line(line, eol, &fname, &command, &op) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%.*s], line %d",
+					(int)(eol - line), line, ss.linecount+1 );
+			return( -1 );
+		}
+
+		// Just log the contents, then run it
+		logMessage(LOG_INFO_LEVEL, "File [%s], command [%s], len=%d, offset=%d",
+				fname, command, op.len, op.off);
+		if ( sim_execute(&ss, fname, &op) ) {
+			return( -1 );
+		}
+	}
+
+	return( sim_finish(&ss) );
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_replay_binary
+// Description  : Replay a compiled workload held in memory, straight from
+//                its records
+//
+// Inputs       : wload - the start of the compiled workload
+//                size - the size of the compiled workload
+// Outputs      : 0 if successful test, -1 if failure
+
+int sim_replay_binary( char *wload, size_t size ) {
+
+	// Local variables
+	CrudSimulationState ss;
+	CrudSimBinaryHeader *hdr = (CrudSimBinaryHeader *)wload;
+	CrudSimBinaryRecord *rec;
+	uint32_t *names, i;
+	CrudSimulationOp op;
+
+	// Check that the sections are where the header says they are
+	if ( (hdr->version != CRUD_SIM_BINARY_VERSION) || (hdr->size != size) ||
+			(hdr->names + (uint64_t)hdr->nfiles * sizeof(uint32_t) > size) ||
+			(hdr->records + (uint64_t)hdr->nrecords * sizeof(CrudSimBinaryRecord) > size) ||
+			(hdr->payload > size) ) {
+		logMessage( LOG_ERROR_LEVEL, "Corrupt compiled workload, aborting." );
+		return( -1 );
+	}
+	names = (uint32_t *)&wload[hdr->names];
+	rec = (CrudSimBinaryRecord *)&wload[hdr->records];
+
+	// Each filename must start and be terminated inside the mapping
+	for (i = 0; i < hdr->nfiles; i++) {
+		if ( (hdr->names + (uint64_t)names[i] >= size) ||
+				(memchr(&wload[hdr->names + names[i]], '\0',
+					size - (hdr->names + names[i])) == NULL) ) {
+			logMessage( LOG_ERROR_LEVEL, "Corrupt compiled workload, aborting." );
+			return( -1 );
+		}
+	}
+
+	// Setup the file table, queue bus requests a window of records at a time
+	memset(&ss, 0x0, sizeof(ss));
+	if ( batch_window > 0 ) {
+		crud_batch_begin();
+	}
+
+	// Each record is already decoded, with its text in the payload area
+	for (i = 0; i < hdr->nrecords; i++) {
+		op.op = rec[i].op;
+		op.len = rec[i].len;
+		op.off = rec[i].off;
+		op.text = ((op.op == CRUD_SIM_WRITEAT) || (op.op == CRUD_SIM_WRITE)) ?
+			&wload[hdr->payload + rec[i].payload] : NULL;
+		if ( (rec[i].file >= hdr->nfiles) || (op.op > CRUD_SIM_UNMOUNT) ||
+				((op.text != NULL) && (hdr->payload + rec[i].payload + (uint64_t)op.len > size)) ) {
+			logMessage( LOG_ERROR_LEVEL, "Bad compiled workload record %u, aborting.", i );
+			return( -1 );
+		}
+		if ( sim_execute(&ss, &wload[hdr->names + names[rec[i].file]], &op) ) {
+			return( -1 );
+		}
+	}
+
+	return( sim_finish(&ss) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_next_token
+// Description  : Split the next whitespace separated token off a line,
+//                terminating it in place
+//
+// Inputs       : pos - the parse position, moved past the token
+//                end - the end of the text that may hold tokens
+// Outputs      : the token, or NULL if there are no more
+
+char *sim_next_token( char **pos, char *end ) {
+
+	// Local variables
+	char *p = *pos, *tok;
+
+	while ( (p < end) && ((*p == ' ') || (*p == '\t')) ) {
+		p++;
+	}
+	if ( p == end ) {
+		return( NULL );
+	}
+	tok = p;
+	while ( (p < end) && (*p != ' ') && (*p != '\t') ) {
+		p++;
+	}
+	*p = 0x0; // Either whitespace or the ':' that ends the fields
+	*pos = (p < end) ? p + 1 : end;
+	return( tok );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_decode_command
+// Description  : Map a workload command name to its opcode
+//
+// Inputs       : command - the command name
+// Outputs      : the opcode, or CRUD_SIM_UNKNOWN
+
+CRUD_SIM_COMMANDS sim_decode_command( const char *command ) {
+
+	switch ( command[0] ) {
+	case 'F':
+		if ( strcmp(command, "FORMAT") == 0 ) return( CRUD_SIM_FORMAT );
+		break;
+	case 'M':
+		if ( strcmp(command, "MOUNT") == 0 ) return( CRUD_SIM_MOUNT );
+		break;
+	case 'U':
+		if ( strcmp(command, "UNMOUNT") == 0 ) return( CRUD_SIM_UNMOUNT );
+		break;
+	case 'W':
+		if ( strcmp(command, "WRITE") == 0 ) return( CRUD_SIM_WRITE );
+		if ( strcmp(command, "WRITEAT") == 0 ) return( CRUD_SIM_WRITEAT );
+		break;
+	case 'S':
+		if ( strcmp(command, "SEEK") == 0 ) return( CRUD_SIM_SEEK );
+		break;
+	case 'R':
+		if ( strcmp(command, "READ") == 0 ) return( CRUD_SIM_READ );
+		break;
+	}
+	return( CRUD_SIM_UNKNOWN );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_parse_line
+// Description  : Tokenize a workload line ("<file> <command> <len> <off>
+//                :<text>") in place, translating '*' in the text to newlines
+//
+// Inputs       : line - the start of the line
+//                eol - the end of the line
+//                fname - set to the filename
+//                command - set to the command name
+//                op - the decoded command (text points into the line)
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_parse_line( char *line, char *eol, char **fname, char **command, CrudSimulationOp *op ) {
+
+	// Local variables
+	char *sep, *pos = line, *tok, *num, *p;
+
+	// The fields end at the first ':', the text follows it
+	if ( (sep = memchr(line, ':', eol - line)) == NULL ) {
+		return( -1 );
+	}
+	if ( ((*fname = sim_next_token(&pos, sep)) == NULL) ||
+			((*command = sim_next_token(&pos, sep)) == NULL) ) {
+		return( -1 );
+	}
+	if ( (tok = sim_next_token(&pos, sep)) == NULL ) {
+		return( -1 );
+	}
+	op->len = strtol(tok, &num, 10);
+	if ( (num == tok) || ((tok = sim_next_token(&pos, sep)) == NULL) ) {
+		return( -1 );
+	}
+	op->off = strtol(tok, &num, 10);
+	if ( num == tok ) {
+		return( -1 );
+	}
+	*sep = 0x0;
+
+	// Decode the command, file writes carry text
+	op->text = NULL;
+	if ( (op->op = sim_decode_command(*command)) == CRUD_SIM_UNKNOWN ) {
+		// Bomb out, don't understand the command
+		CMPSC_ASSERT1(0, "CRUD_SIM : Failed, unknown command [%s]", *command);
+	}
+	if ( (op->op == CRUD_SIM_WRITEAT) || (op->op == CRUD_SIM_WRITE) ) {
+
+		// Now see if we have enough data to fill, terminate the lines
+		CMPSC_ASSERT2((op->len >= 0) && (eol - (sep+1) >= op->len), "Workload str [%d<%d]",
+			(int)(eol - (sep+1)), op->len);
+		op->text = sep + 1;
+		for (p = op->text; (p = memchr(p, '*', op->text + op->len - p)) != NULL; p++) {
+			*p = '\n';
+		}
+	}
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_compile_workload
+// Description  : Convert a text workload into the compiled form, which
+//                replays without any parsing
+//
+// Inputs       : wload - the name of the text workload file
+//                out - the name of the compiled file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_compile_workload( char *wload, char *out ) {
+
+	// Local variables
+	CrudSimBinaryHeader hdr;
+	CrudSimBinaryRecord *recs = NULL, *rec;
+	CrudSimulationOp op;
+	char *map, *line, *eol, *fname, *command, *pool = NULL, *payload = NULL, *ptr;
+	uint32_t offsets[CRUD_SIM_COMPILE_NAMES], slot, maxrecs = 0;
+	uint16_t index[CRUD_SIM_COMPILE_NAMES * 2]; // Filename index, file id+1 (0 empty)
+	size_t size, poolsz = 0, maxpool = 0, paysz = 0, maxpay = 0, namesz;
+	uint8_t pad[8] = { 0 };
+	FILE *fhandle;
+	int ret = -1;
+
+	// Map the text workload
+	if ( (map = sim_map_file(wload, &size)) == NULL ) {
+		return( -1 );
+	}
+	memset(&hdr, 0x0, sizeof(hdr));
+	memset(index, 0x0, sizeof(index));
+
+	// Decode each line into a record, interning the filenames
+	for (line = map; line < map + size; line = eol + 1) {
+		if ( (eol = memchr(line, '\n', map + size - line)) == NULL ) {
+			eol = map + size;
+		}
+		if ( eol == line ) {
+			continue;
+		}
+		if ( sim_parse_line(line, eol, &fname, &command, &op) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%.*s], line %u",
+					(int)(eol - line), line, hdr.nrecords+1 );
+			goto done;
+		}
+
+		// Find the filename, adding it to the pool if new
+		slot = sim_name_hash(fname) & (CRUD_SIM_COMPILE_NAMES * 2 - 1);
+		while ( (index[slot] != 0) && strcmp(&pool[offsets[index[slot]-1]], fname) ) {
+			slot = (slot + 1) & (CRUD_SIM_COMPILE_NAMES * 2 - 1);
+		}
+		if ( index[slot] == 0 ) {
+			if ( hdr.nfiles == CRUD_SIM_COMPILE_NAMES ) {
+				logMessage( LOG_ERROR_LEVEL, "Too many filenames to compile, aborting." );
+				goto done;
+			}
+			if ( poolsz + strlen(fname) + 1 > maxpool ) {
+				maxpool = (maxpool + strlen(fname) + 1) * 2;
+				if ( (ptr = realloc(pool, maxpool)) == NULL ) {
+					goto done;
 				}
+				pool = ptr;
 			}
+			offsets[hdr.nfiles] = poolsz;
+			strcpy( &pool[poolsz], fname );
+			poolsz += strlen(fname) + 1;
+			index[slot] = ++hdr.nfiles;
+		}
 
-			// Check for the virtual level failing
-			if ( err ) {
-				logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
-				fclose( fhandle );
-				return( -1 );
+		// Add the record, and its (translated) write data
+		if ( hdr.nrecords == maxrecs ) {
+			maxrecs = maxrecs ? maxrecs * 2 : 1024;
+			if ( (rec = realloc(recs, maxrecs * sizeof(CrudSimBinaryRecord))) == NULL ) {
+				goto done;
+			}
+			recs = rec;
+		}
+		rec = &recs[hdr.nrecords++];
+		rec->op = op.op;
+		rec->file = index[slot] - 1;
+		rec->len = op.len;
+		rec->off = op.off;
+		rec->payload = paysz;
+		if ( op.text != NULL ) {
+			if ( paysz + op.len > UINT32_MAX ) {
+				logMessage( LOG_ERROR_LEVEL, "Workload too large to compile, aborting." );
+				goto done;
 			}
+			if ( paysz + op.len > maxpay ) {
+				maxpay = (maxpay + op.len) * 2;
+				if ( (ptr = realloc(payload, maxpay)) == NULL ) {
+					goto done;
+				}
+				payload = ptr;
+			}
+			memcpy( &payload[paysz], op.text, op.len );
+			paysz += op.len;
+		}
+	}
+
+	// Lay out the sections, records start 8 byte aligned
+	namesz = hdr.nfiles * sizeof(uint32_t) + poolsz;
+	for (slot = 0; slot < hdr.nfiles; slot++) {
+		offsets[slot] += hdr.nfiles * sizeof(uint32_t);
+	}
+	hdr.magic = CRUD_SIM_BINARY_MAGIC;
+	hdr.version = CRUD_SIM_BINARY_VERSION;
+	hdr.names = sizeof(CrudSimBinaryHeader);
+	hdr.records = (hdr.names + namesz + 7) & ~7ULL;
+	hdr.payload = hdr.records + hdr.nrecords * sizeof(CrudSimBinaryRecord);
+	hdr.size = hdr.payload + paysz;
+
+	// Write it out
+	if ( (fhandle = fopen(out, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening compiled workload [%s], error: %s.\n",
+			out, strerror(errno) );
+		goto done;
+	}
+	if ( (fwrite(&hdr, sizeof(hdr), 1, fhandle) != 1) ||
+			(fwrite(offsets, sizeof(uint32_t), hdr.nfiles, fhandle) != hdr.nfiles) ||
+			(fwrite(pool, 1, poolsz, fhandle) != poolsz) ||
+			(fwrite(pad, 1, hdr.records - hdr.names - namesz, fhandle) != hdr.records - hdr.names - namesz) ||
+			(fwrite(recs, sizeof(CrudSimBinaryRecord), hdr.nrecords, fhandle) != hdr.nrecords) ||
+			(fwrite(payload, 1, paysz, fhandle) != paysz) || fclose(fhandle) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure writing compiled workload [%s].", out );
+		goto done;
+	}
+	logMessage( LOG_INFO_LEVEL, "Compiled %u commands on %u files, %lu bytes of data.",
+		hdr.nrecords, hdr.nfiles, paysz );
+	ret = 0;
+
+done:
+	free( recs );
+	free( pool );
+	free( payload );
+	if ( size > 0 ) {
+		munmap( map, size );
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_generate_workload
+// Description  : Generate a synthetic workload (see crud_gen.h), compiling
+//                it if a compiled filename is given, in which case the check
+//                script replays the compiled form
+//
+// Inputs       : spec - the workload specification ("key=value,...")
+//                out - the name of the text workload to write
+//                compiled - the name of the compiled workload, or NULL
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_generate_workload( char *spec, char *out, char *compiled ) {
+
+	// Local variables
+	CrudGenParams params;
+
+	// Read the specification, then write (and compile) the workload
+	crud_gen_defaults( &params );
+	if ( crud_gen_parse(spec, &params) ) {
+		fprintf( stderr, "Bad workload specification [%s], use -h to see usage, aborting.\n", spec );
+		return( -1 );
+	}
+	if ( crud_gen_workload(&params, out, (compiled != NULL) ? compiled : out) ) {
+		return( -1 );
+	}
+	if ( (compiled != NULL) && sim_compile_workload(out, compiled) ) {
+		logMessage( LOG_ERROR_LEVEL, "Compiling generated workload [%s] failed.", out );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_file_command
+// Description  : Execute one command against an open simulation file
+//
+// Inputs       : ent - the simulation file table entry
+//                op - the decoded command
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_file_command( CrudSimulationTable *ent, CrudSimulationOp *op ) {
+
+	// Local variables
+	CrudScratchMark mark;
+	char *rbuf;
+	int32_t ret;
+	uint64_t t;
+
+	// Now execute the specific command
+	switch ( op->op ) {
+
+	case CRUD_SIM_WRITEAT:
+
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", op->len, op->off, ent->filename);
+
+		// First perform the seek
+		t = crud_bench_now();
+		ret = crud_seek(ent->fhandle, op->off);
+		crud_bench_record(CRUD_BENCH_SEEK, t, 0);
+		if (ret) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", ent->filename, op->off);
+			return(-1);
 		}
+
+		// Now perform the write
+		t = crud_bench_now();
+		ret = crud_write(ent->fhandle, op->text, op->len);
+		crud_bench_record(CRUD_BENCH_WRITE, t, op->len);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", ent->filename, op->len);
+			return(-1);
+		}
+		break;
+
+	case CRUD_SIM_WRITE:
+
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", op->len, ent->filename);
+
+		// Now perform the write
+		t = crud_bench_now();
+		ret = crud_write(ent->fhandle, op->text, op->len);
+		crud_bench_record(CRUD_BENCH_WRITE, t, op->len);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", ent->filename, op->len);
+			return(-1);
+		}
+		break;
+
+	case CRUD_SIM_SEEK:
+
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", op->off, ent->filename);
+
+		// Now perform the seek
+		t = crud_bench_now();
+		ret = crud_seek(ent->fhandle, op->off);
+		crud_bench_record(CRUD_BENCH_SEEK, t, 0);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", ent->filename, op->off);
+			return(-1);
+		}
+		break;
+
+	case CRUD_SIM_READ:
+
+		// Log the command executed
+		logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", op->len, ent->filename);
+
+		// Now perform the read
+		mark = crud_scratch_mark();
+		rbuf = crud_scratch_alloc(op->len);
+		t = crud_bench_now();
+		ret = crud_read(ent->fhandle, rbuf, op->len);
+		crud_bench_record(CRUD_BENCH_READ, t, op->len);
+		if (ret != op->len) {
+			// Failed, error out
+			logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", ent->filename, op->off);
+			crud_scratch_release(mark);
+			return(-1);
+		}
+		crud_scratch_release(mark);
+		break;
+
+	default: // Filesystem commands never reach a file
+		break;
 	}
 
-	// Close the workload file, successfully
-	fclose( fhandle );
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_queue_command
+// Description  : Add a copy of a command to a file's replay stream
+//
+// Inputs       : ent - the simulation file table entry
+//                op - the decoded command
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_queue_command( CrudSimulationTable *ent, CrudSimulationOp *op ) {
+
+	// Local variables
+	CrudSimulationOp *ops;
+	int32_t max;
+
+	// Grow the stream as needed
+	if ( ent->nops == ent->maxops ) {
+		max = ent->maxops ? ent->maxops * 2 : CRUD_SIM_STREAM_SIZE;
+		if ( (ops = realloc(ent->ops, max * sizeof(CrudSimulationOp))) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Unable to grow replay stream of [%s].", ent->filename );
+			return( -1 );
+		}
+		ent->ops = ops;
+		ent->maxops = max;
+	}
+
+	// Keep a private copy of the write data
+	ent->ops[ent->nops] = *op;
+	if ( op->text != NULL ) {
+		if ( (ent->ops[ent->nops].text = malloc(op->len + 1)) == NULL ) {
+			return( -1 );
+		}
+		memcpy( ent->ops[ent->nops].text, op->text, op->len );
+	}
+	ent->nops ++;
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_replay_worker
+// Description  : Replay file streams from the pool until none are left
+//
+// Inputs       : arg - the CrudSimulationPool being replayed
+// Outputs      : NULL
+
+void *sim_replay_worker( void *arg ) {
+
+	// Local variables
+	CrudSimulationPool *pool = arg;
+	CrudSimulationTable *ent;
+	int idx, i;
+
+	// Take the next file, running its commands in workload order
+	while ( (idx = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->nfiles ) {
+		ent = &pool->ftable[idx];
+		for ( i=0; i<ent->nops; i++ ) {
+			if ( !__atomic_load_n(&pool->failed, __ATOMIC_RELAXED) && sim_file_command(ent, &ent->ops[i]) ) {
+				__atomic_store_n( &pool->failed, 1, __ATOMIC_RELAXED );
+			}
+			if ( (batch_window > 0) && (((i+1) % batch_window) == 0) && crud_batch_flush() ) {
+				__atomic_store_n( &pool->failed, 1, __ATOMIC_RELAXED );
+			}
+			free( ent->ops[i].text );
+		}
+		ent->nops = 0;
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_replay_files
+// Description  : Replay the queued commands of every file on the thread
+//                pool, each file's commands in order
+//
+// Inputs       : ftable - the simulation file table
+//                nfiles - the number of files in the table
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_replay_files( CrudSimulationTable *ftable, int nfiles ) {
+
+	// Local variables
+	CrudSimulationPool pool = { ftable, nfiles, 0, 0 };
+	pthread_t tids[CRUD_SIM_MAX_THREADS];
+	int i, nthreads;
+
+	if ( sim_threads <= 1 ) {
+		return( 0 );
+	}
+
+	// No more threads than files, this thread being one of them
+	nthreads = ((sim_threads < nfiles) ? sim_threads : nfiles) - 1;
+	for ( i=0; i<nthreads; i++ ) {
+		if ( pthread_create(&tids[i], NULL, sim_replay_worker, &pool) ) {
+			logMessage( LOG_ERROR_LEVEL, "Unable to start replay thread %d.", i );
+			__atomic_store_n( &pool.failed, 1, __ATOMIC_RELAXED );
+			break;
+		}
+	}
+	nthreads = i;
+	sim_replay_worker( &pool );
+	for ( i=0; i<nthreads; i++ ) {
+		pthread_join( tids[i], NULL );
+	}
+
+	return( __atomic_load_n(&pool.failed, __ATOMIC_RELAXED) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_name_hash
+// Description  : Hash a filename for the filename indices (FNV-1a)
+//
+// Inputs       : fname - the filename to hash
+// Outputs      : the hash, to be masked to the index size
+
+uint32_t sim_name_hash( const char *fname ) {
+
+	// Local variables
+	uint32_t hash = 2166136261U;
+
+	while ( *fname ) {
+		hash ^= (uint8_t)*fname++;
+		hash *= 16777619U;
+	}
+	return( hash );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_host_read
+// Description  : Read up to "len" bytes from a host file, short only at the
+//                end of the file
+//
+// Inputs       : fd - the host file
+//                buf - the buffer to fill
+//                len - the bytes wanted
+// Outputs      : the bytes read, or -1 if failure
+
+int32_t sim_host_read( int32_t fd, char *buf, int32_t len ) {
+	int32_t done = 0;
+	ssize_t ret;
+
+	while ( done < len ) {
+		if ( (ret = read(fd, &buf[done], len - done)) == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			fprintf( stderr, "CRUD: host read() failed, error=%s\n", strerror(errno) );
+			return( -1 );
+		}
+		if ( ret == 0 ) {
+			break;
+		}
+		done += ret;
+	}
+	return( done );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_host_write
+// Description  : Write all "len" bytes to a host file
+//
+// Inputs       : fd - the host file
+//                buf - the bytes to write
+//                len - the number of bytes
+// Outputs      : the bytes written, or -1 if failure
+
+int32_t sim_host_write( int32_t fd, char *buf, int32_t len ) {
+	int32_t done = 0;
+	ssize_t ret;
+
+	while ( done < len ) {
+		if ( (ret = write(fd, &buf[done], len - done)) == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			fprintf( stderr, "CRUD: host write() failed, error=%s\n", strerror(errno) );
+			return( -1 );
+		}
+		done += ret;
+	}
+	return( done );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_crud_read
+// Description  : Read from a crud file, in the form of a stream step
+//
+// Inputs       : fd - the crud file handle
+//                buf - the buffer to fill
+//                len - the bytes wanted
+// Outputs      : the bytes read, or -1 if failure
+
+int32_t sim_crud_read( int32_t fd, char *buf, int32_t len ) {
+	return( crud_read(fd, buf, len) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_crud_write
+// Description  : Write to a crud file, in the form of a stream step
+//
+// Inputs       : fd - the crud file handle
+//                buf - the bytes to write
+//                len - the number of bytes
+// Outputs      : the bytes written, or -1 if failure
+
+int32_t sim_crud_write( int32_t fd, char *buf, int32_t len ) {
+	return( crud_write(fd, buf, len) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_stream_put
+// Description  : Write the queued chunks of a stream copy to its sink until
+//                the reader is done (the writer thread)
+//
+// Inputs       : arg - the stream copy
+// Outputs      : NULL
+
+void *sim_stream_put( void *arg ) {
+	CrudSimStream *st = (CrudSimStream *)arg;
+	int32_t len, result;
+
+	pthread_mutex_lock( &st->lock );
+	while ( 1 ) {
+		while ( (st->queued == 0) && !st->done ) {
+			pthread_cond_wait( &st->cond, &st->lock );
+		}
+		if ( st->queued == 0 ) {
+			break;
+		}
+
+		// Write the chunk unlocked, the reader fills the other one meanwhile
+		len = st->len[st->head];
+		if ( !st->failed ) {
+			pthread_mutex_unlock( &st->lock );
+			result = st->put( st->handle, st->buf[st->head], len );
+			pthread_mutex_lock( &st->lock );
+			if ( result != len ) {
+				st->failed = 1;
+			}
+		}
+		st->head ^= 1;
+		st->queued--;
+		pthread_cond_broadcast( &st->cond );
+	}
+	pthread_mutex_unlock( &st->lock );
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sim_stream_copy
+// Description  : Copy everything from a source to a sink in chunks, double
+//                buffered so one chunk is written out by a writer thread
+//                while the next is read in
+//
+// Inputs       : get - the source read step
+//                from - the source handle
+//                put - the sink write step
+//                to - the sink handle
+// Outputs      : 0 if successful, -1 if failure
+
+int sim_stream_copy( CrudSimStreamIO get, int32_t from, CrudSimStreamIO put, int32_t to ) {
+	CrudSimStream st;
+	CrudScratchMark mark = crud_scratch_mark();
+	pthread_t writer;
+	int cur = 0, ret = 0;
+	int32_t len;
+
+	memset( &st, 0x0, sizeof(st) );
+	st.put = put;
+	st.handle = to;
+	st.buf[0] = crud_scratch_alloc( CRUD_SIM_STREAM_CHUNK );
+	st.buf[1] = crud_scratch_alloc( CRUD_SIM_STREAM_CHUNK );
+	if ( (st.buf[0] == NULL) || (st.buf[1] == NULL) ) {
+		crud_scratch_release( mark );
+		return( -1 );
+	}
+	pthread_mutex_init( &st.lock, NULL );
+	pthread_cond_init( &st.cond, NULL );
+	if ( pthread_create(&writer, NULL, sim_stream_put, &st) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to start stream writer thread." );
+		ret = -1;
+		goto done;
+	}
+
+	do {
+		// Wait for a free buffer (the writer has at most the other one)
+		pthread_mutex_lock( &st.lock );
+		while ( (st.queued == 2) && !st.failed ) {
+			pthread_cond_wait( &st.cond, &st.lock );
+		}
+		ret = st.failed ? -1 : 0;
+		pthread_mutex_unlock( &st.lock );
+		if ( ret == -1 ) {
+			break;
+		}
+
+		// Fill it, then queue it for the writer
+		if ( (len = get(from, st.buf[cur], CRUD_SIM_STREAM_CHUNK)) == -1 ) {
+			ret = -1;
+			break;
+		}
+		if ( len > 0 ) {
+			pthread_mutex_lock( &st.lock );
+			st.len[cur] = len;
+			st.queued++;
+			pthread_cond_broadcast( &st.cond );
+			pthread_mutex_unlock( &st.lock );
+		}
+		cur ^= 1;
+	} while ( len == CRUD_SIM_STREAM_CHUNK );
+
+	// Let the writer finish the queued chunks
+	pthread_mutex_lock( &st.lock );
+	st.done = 1;
+	pthread_cond_broadcast( &st.cond );
+	pthread_mutex_unlock( &st.lock );
+	pthread_join( writer, NULL );
+	if ( st.failed ) {
+		ret = -1;
+	}
+
+done:
+	pthread_cond_destroy( &st.cond );
+	pthread_mutex_destroy( &st.lock );
+	crud_scratch_release( mark );
+	return( ret );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : extract_file_from_crud
-// Description  : Extract a file from the CRUD file system
+// Description  : Extract a file from the (mounted) CRUD file system
 //
 // Inputs       : ex_file - the name of the file to extract
 // Outputs      : 0 if successful test, -1 if failure
@@ -421,15 +1669,12 @@ int simulate_CRUD( char *wload ) {
 int extract_file_from_crud(char *ex_file) {
 
 	// Local variables
-	int16_t fd;
-	int32_t len;
-	char buf[CRUD_MAX_OBJECT_SIZE];
-    int fhandle, flags;
-    mode_t mode;
-	// Open the file, read from it, close it
-	if ( (crud_mount()) || ((fd = crud_open(ex_file)) == -1) ||
-		 ((len = crud_read(fd, buf, CRUD_MAX_OBJECT_SIZE)) == -1) ||
-		 (crud_close(fd) == -1)	) {
+	int32_t fd;
+	int fhandle, flags, ret;
+	mode_t mode;
+
+	// Open the file in crud, it is streamed out a chunk at a time
+	if ( (fd = crud_open(ex_file)) == -1 ) {
 		// Error out
 		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
 		return(-1);
@@ -441,16 +1686,55 @@ int extract_file_from_crud(char *ex_file) {
     fhandle = open(ex_file, flags, mode);
     if ( fhandle == -1 ) {
         fprintf( stderr, "CRUD: extraction open() failed, error=%s\n", strerror(errno) );
+        crud_close(fd);
         return( -1 );
     }
 
-    // Now write the read bytes to the file, then close
-    if (write(fhandle, buf, len) != len) {
-        fprintf( stderr, "CRUD: extraction write() failed, error=%s\n", strerror(errno) );
+    // Now copy the file over, then close both
+    ret = sim_stream_copy(sim_crud_read, fd, sim_host_write, fhandle);
+    close( fhandle );
+    if ( (crud_close(fd) == -1) || (ret == -1) ) {
+        logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
         return( -1 );
     }
-    close( fhandle );
 
     // Return successfully
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : import_file_to_crud
+// Description  : Copy a host file into the (mounted) CRUD file system under
+//                the same name, replacing any file already there
+//
+// Inputs       : im_file - the name of the host file to import
+// Outputs      : 0 if successful, -1 if failure
+
+int import_file_to_crud(char *im_file) {
+
+	// Local variables
+	int32_t fd;
+	int fhandle, ret;
+
+	fhandle = open(im_file, O_RDONLY);
+	if ( fhandle == -1 ) {
+		fprintf( stderr, "CRUD: import open() failed, error=%s\n", strerror(errno) );
+		return( -1 );
+	}
+	if ( ((fd = crud_open(im_file)) == -1) || crud_truncate(fd, 0) ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD : import failed on crud interface [%s].", im_file);
+		close( fhandle );
+		return( -1 );
+	}
+
+	// Copy it over, queuing the block map and cache write backs in batches
+	crud_batch_begin();
+	ret = sim_stream_copy(sim_host_read, fhandle, sim_crud_write, fd);
+	close( fhandle );
+	if ( (crud_close(fd) == -1) || crud_batch_end() || (ret == -1) ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD : import failed on crud interface [%s].", im_file);
+		return( -1 );
+	}
+	return( 0 );
+}
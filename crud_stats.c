@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_stats.c
+//  Description    : This is the implementation of the CRUD bus
+//                   instrumentation.  Every bus request passes through
+//                   crud_stats_bus_request, which charges it to the file IO
+//                   call the sending thread is in.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri May 12 11:40:18 PDT 2017
+//
+
+// Includes
+#include <string.h>
+
+// Project Includes
+#include <crud_stats.h>
+#include <crud_trace.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+
+// Stats Static Data
+CrudBusStats crud_bus_stats; // The counters
+__thread CRUD_STATS_CALLERS crud_stats_caller = CRUD_CALL_NONE; // The calling thread's file IO call
+__thread int32_t crud_stats_file = CRUD_TRACE_NO_FILE; // The calling thread's file handle
+const char *crud_stats_caller_names[CRUD_CALL_MAXVAL] = {
+	"(none)", "open", "close", "read", "write", "pread", "pwrite",
+	"readv", "writev", "seek", "format", "mount", "unmount",
+	"truncate", "fallocate"
+};
+const char *crud_stats_type_names[CRUD_MAXVAL] = {
+	"INIT", "FORMAT", "CREATE", "READ", "UPDATE", "DELETE", "CLOSE", "UNKNOWN"
+};
+
+// Pick up these definitions from the unit test of the crud driver
+int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
+		CRUD_REQUEST_TYPES *req, uint32_t *length, uint8_t *flags,
+		uint8_t *res);
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_bus_request
+// Description  : Send a request on the bus, counting it, the bytes it moved
+//                and whether it failed against the current caller
+//
+// Inputs       : request - the request to send
+//                buf - the request data
+// Outputs      : the bus response
+
+CrudResponse crud_stats_bus_request(CrudRequest request, void *buf) {
+	CrudBusCounters *ctr;
+	CrudResponse response;
+	CRUD_REQUEST_TYPES req, rreq;
+	uint32_t length, rlength;
+	uint8_t flags, res;
+	CrudOID oid;
+
+	deconstruct_crud_request(request, &oid, &req, &length, &flags, &res);
+	response = crud_bus_request(request, buf);
+	crud_trace_request(request, response, crud_stats_caller, crud_stats_file);
+	deconstruct_crud_request(response, &oid, &rreq, &rlength, &flags, &res);
+	if (req >= CRUD_MAXVAL)
+		req = CRUD_UNKNOWN;
+
+	ctr = &crud_bus_stats.calls[crud_stats_caller][req];
+	__atomic_fetch_add(&ctr->requests, 1, __ATOMIC_RELAXED);
+	if (response & 0x1) {
+		__atomic_fetch_add(&ctr->failures, 1, __ATOMIC_RELAXED);
+	} else if (req == CRUD_CREATE || req == CRUD_UPDATE) {
+		__atomic_fetch_add(&ctr->bytes_out, length, __ATOMIC_RELAXED);
+	} else if (req == CRUD_READ) {
+		__atomic_fetch_add(&ctr->bytes_in, rlength, __ATOMIC_RELAXED);
+	}
+	return (response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_set_caller
+// Description  : Set the file IO call the calling thread's requests belong to
+//
+// Inputs       : caller - the file IO call (CRUD_CALL_NONE when leaving it)
+// Outputs      : none
+
+void crud_stats_set_caller(CRUD_STATS_CALLERS caller) {
+	crud_stats_caller = caller;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_get_caller
+// Description  : Get the file IO call the calling thread's requests belong to
+//
+// Inputs       : none
+// Outputs      : the file IO call
+
+CRUD_STATS_CALLERS crud_stats_get_caller(void) {
+	return (crud_stats_caller);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_set_file
+// Description  : Set the file handle the calling thread's requests belong to
+//
+// Inputs       : fd - the file handle (CRUD_TRACE_NO_FILE when leaving it)
+// Outputs      : none
+
+void crud_stats_set_file(int32_t fd) {
+	crud_stats_file = fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_get_file
+// Description  : Get the file handle the calling thread's requests belong to
+//
+// Inputs       : none
+// Outputs      : the file handle
+
+int32_t crud_stats_get_file(void) {
+	return (crud_stats_file);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_file_bytes
+// Description  : Note the bytes the current file call read or wrote, so the
+//                trace can compare them with the bytes moved on the bus
+//
+// Inputs       : bytes - the bytes read or written
+// Outputs      : none
+
+void crud_stats_file_bytes(int32_t bytes) {
+	crud_trace_call(crud_stats_caller, crud_stats_file, bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_get_stats
+// Description  : Get a copy of the bus statistics
+//
+// Inputs       : stats - the structure to fill in
+// Outputs      : none
+
+void crud_get_stats(CrudBusStats *stats) {
+	memcpy(stats, &crud_bus_stats, sizeof(CrudBusStats));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_total
+// Description  : Sum the counters of one caller over every request type
+//
+// Inputs       : stats - the statistics to sum
+//                caller - the caller, or CRUD_CALL_MAXVAL for every caller
+//                total - the counters to fill in
+// Outputs      : none
+
+void crud_stats_total(CrudBusStats *stats, CRUD_STATS_CALLERS caller, CrudBusCounters *total) {
+	CrudBusCounters *ctr;
+	int c, t;
+
+	memset(total, 0x0, sizeof(CrudBusCounters));
+	for (c = 0; c < CRUD_CALL_MAXVAL; c++) {
+		if (caller != CRUD_CALL_MAXVAL && caller != c)
+			continue;
+		for (t = 0; t < CRUD_MAXVAL; t++) {
+			ctr = &stats->calls[c][t];
+			total->requests += ctr->requests;
+			total->bytes_out += ctr->bytes_out;
+			total->bytes_in += ctr->bytes_in;
+			total->failures += ctr->failures;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stats_log
+// Description  : Write the bus statistics to the log, a line per caller and
+//                request type that was used
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_stats_log(void) {
+	CrudBusStats stats;
+	CrudBusCounters *ctr, total;
+	int c, t;
+
+	crud_get_stats(&stats);
+	crud_stats_total(&stats, CRUD_CALL_MAXVAL, &total);
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD bus : %lu requests, %lu bytes out, %lu bytes in, %lu failed",
+		total.requests, total.bytes_out, total.bytes_in, total.failures);
+
+	for (c = 0; c < CRUD_CALL_MAXVAL; c++) {
+		for (t = 0; t < CRUD_MAXVAL; t++) {
+			ctr = &stats.calls[c][t];
+			if (ctr->requests == 0)
+				continue;
+			logMessage(LOG_OUTPUT_LEVEL, "CRUD bus : %-9s %-7s %8lu requests, %10lu bytes out, "
+				"%10lu bytes in, %lu failed", crud_stats_caller_names[c],
+				crud_stats_type_names[t], ctr->requests, ctr->bytes_out,
+				ctr->bytes_in, ctr->failures);
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef CRUD_STATS_INCLUDED
+#define CRUD_STATS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_stats.h
+//  Description    : This is the header file for the CRUD bus instrumentation,
+//                   which counts the requests sent on the bus by request
+//                   type and by the file IO call that caused them.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri May 12 11:40:18 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// The file IO calls bus requests are attributed to
+typedef enum {
+	CRUD_CALL_NONE      = 0,  // Not inside a file IO call
+	CRUD_CALL_OPEN      = 1,
+	CRUD_CALL_CLOSE     = 2,
+	CRUD_CALL_READ      = 3,
+	CRUD_CALL_WRITE     = 4,
+	CRUD_CALL_PREAD     = 5,
+	CRUD_CALL_PWRITE    = 6,
+	CRUD_CALL_READV     = 7,
+	CRUD_CALL_WRITEV    = 8,
+	CRUD_CALL_SEEK      = 9,
+	CRUD_CALL_FORMAT    = 10,
+	CRUD_CALL_MOUNT     = 11,
+	CRUD_CALL_UNMOUNT   = 12,
+	CRUD_CALL_TRUNCATE  = 13,
+	CRUD_CALL_FALLOCATE = 14,
+	CRUD_CALL_MAXVAL    = 15,
+} CRUD_STATS_CALLERS;
+
+// Counts of one request type from one caller
+typedef struct {
+	uint64_t requests;  // Requests sent
+	uint64_t bytes_out; // Bytes sent to the store (CREATE, UPDATE)
+	uint64_t bytes_in;  // Bytes returned by the store (READ)
+	uint64_t failures;  // Responses with the R bit set
+} CrudBusCounters;
+
+// The bus statistics, by caller and request type
+typedef struct {
+	CrudBusCounters calls[CRUD_CALL_MAXVAL][CRUD_MAXVAL];
+} CrudBusStats;
+
+//
+// Instrumentation interface
+
+CrudResponse crud_stats_bus_request(CrudRequest request, void *buf);
+	// Send a request on the bus, counting it against the current caller
+
+void crud_stats_set_caller(CRUD_STATS_CALLERS caller);
+	// Set the file IO call the calling thread's requests belong to
+
+CRUD_STATS_CALLERS crud_stats_get_caller(void);
+	// Get the file IO call the calling thread's requests belong to
+
+void crud_stats_set_file(int32_t fd);
+	// Set the file handle the calling thread's requests belong to
+
+int32_t crud_stats_get_file(void);
+	// Get the file handle the calling thread's requests belong to
+
+void crud_stats_file_bytes(int32_t bytes);
+	// Note the bytes the current file call read or wrote (for the trace)
+
+void crud_get_stats(CrudBusStats *stats);
+	// Get a copy of the bus statistics
+
+void crud_stats_total(CrudBusStats *stats, CRUD_STATS_CALLERS caller, CrudBusCounters *total);
+	// Sum the counters of one caller (CRUD_CALL_MAXVAL for every caller)
+
+void crud_stats_log(void);
+	// Write the bus statistics to the log
+
+#endif
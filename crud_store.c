@@ -0,0 +1,1012 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_store.c
+//  Description    : This is the implementation of the in-tree CRUD object
+//                   store.  The store is a file mapped into memory: a
+//                   superblock, an index of the objects by OID (less
+//                   CRUD_STORE_FIRST_OID) and size classed payload regions
+//                   with free lists.  Mounting maps the file and checks the
+//                   superblock, the payloads being paged in as they are
+//                   used, and CRUD_CLOSE syncs the pages written since.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri Jun  2 14:31:08 PDT 2017
+//
+
+// Includes
+#define _GNU_SOURCE // For mremap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+
+// Project Includes
+#include <crud_store.h>
+#include <crud_rand.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_STORE_MAGIC 0x53445243       // "CRDS", little endian (a saved store)
+#define CRUD_STORE_VERSION 1
+#define CRUD_STORE_MAP_MAGIC 0x4d445243   // "CRDM", little endian (the mapped store)
+#define CRUD_STORE_MAP_VERSION 1
+#define CRUD_STORE_PAGE 4096              // Sync granularity
+#define CRUD_STORE_SUPER_SIZE 4096        // Bytes kept for the superblock, regions follow
+#define CRUD_STORE_MAP_INITIAL (1 << 20)  // Initial store file size (doubled as needed)
+#define CRUD_STORE_MIN_SHIFT 4            // Smallest region class (16 bytes)
+#define CRUD_STORE_CLASSES 44             // Region classes (up to 128TB)
+#define CRUD_STORE_INDEX_INITIAL 1024     // Initial index size (objects)
+#define CRUD_STORE_DIRTY_RANGES 64        // Dirty ranges kept apart before merging them
+#define CRUD_STORE_SUPER ((CrudStoreSuper *)crud_store_map) // The superblock
+#define CRUD_STORE_UNIT_TEST_ITERATIONS 20000
+#define CRUD_STORE_UNIT_TEST_OBJECTS 64
+#define CRUD_STORE_UNIT_TEST_MAX_SIZE 8192
+#define CRUD_STORE_UNIT_TEST_FILE "crud_store_utest.crd"
+#define CRUD_STORE_UNIT_TEST_SAVE "crud_store_utest.sav"
+
+// Type definitions
+
+// A stored object, as kept in the index
+typedef struct {
+	uint64_t offset; // The file offset of the payload
+	uint32_t length; // The object length
+	uint32_t live;   // Flag indicating the object exists
+} CrudStoreObject;
+
+// The superblock, at the start of the store file
+typedef struct {
+	uint32_t magic;      // CRUD_STORE_MAP_MAGIC
+	uint32_t version;    // CRUD_STORE_MAP_VERSION
+	uint32_t next_oid;   // The next OID to hand out
+	uint32_t index_size; // The objects the index has room for
+	uint64_t index;      // The file offset of the index
+	uint64_t heap_end;   // The end of the regions handed out
+	uint64_t objects;    // The number of live objects
+	uint64_t free[CRUD_STORE_CLASSES]; // The free regions of each class, linked through their first bytes
+	CrudStoreObject priority; // The priority object
+} CrudStoreSuper;
+
+// A page aligned range of the store written since the last sync
+typedef struct {
+	uint64_t start;
+	uint64_t end;
+} CrudStoreDirty;
+
+// The saved store header, followed by an entry and payload per object
+typedef struct {
+	uint32_t magic;    // CRUD_STORE_MAGIC
+	uint32_t version;  // CRUD_STORE_VERSION
+	uint32_t next_oid; // The next OID to hand out
+	uint32_t nobjects; // The number of objects saved
+} CrudStoreHeader;
+
+// A saved object (the priority object has OID CRUD_NO_OBJECT)
+typedef struct {
+	uint32_t oid;
+	uint32_t length;
+} CrudStoreEntry;
+
+// Store Static Data
+const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL] = {
+	"CRUD_INIT", "CRUD_FORMAT", "CRUD_CREATE", "CRUD_READ", "CRUD_UPDATE",
+	"CRUD_DELETE", "CRUD_CLOSE", "CRUD_UNKNOWN"
+};
+const char *CRUD_FLAG_TYPE_LABLES[CRUD_FLAGMAX] = {
+	"CRUD_NULL_FLAG", "CRUD_PRIORITY_OBJECT"
+};
+int crud_store_initialized = 0;         // Flag indicating CRUD_INIT was seen
+const char *crud_store_path = CRUD_STORE_FILE; // The store file
+int crud_store_fd = -1;                 // The open store file
+char *crud_store_map = NULL;            // The mapped store file
+uint64_t crud_store_map_size = 0;       // The size of the mapping (and the file)
+CrudStoreDirty crud_store_dirty[CRUD_STORE_DIRTY_RANGES]; // The ranges to sync
+int crud_store_ndirty = 0;              // The number of ranges to sync
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : construct_crud_request
+// Description  : Pack the fields of a request (or response)
+//
+// Inputs       : oid - the object identifier
+//                req - the request type
+//                length - the length field
+//                flags - the flags
+//                res - the result bit
+// Outputs      : the packed request
+
+CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
+		uint32_t length, uint8_t flags, uint8_t res) {
+	return (((CrudRequest)oid << 32) | ((CrudRequest)(req & 0xf) << 28) |
+		((CrudRequest)(length & 0xffffff) << 4) | ((flags & 0x7) << 1) | (res & 0x1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deconstruct_crud_request
+// Description  : Unpack the fields of a request (or response)
+//
+// Inputs       : request - the packed request
+//                oid, req, length, flags, res - the fields to fill in
+// Outputs      : 0 always
+
+int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
+		CRUD_REQUEST_TYPES *req, uint32_t *length, uint8_t *flags,
+		uint8_t *res) {
+	*oid = request >> 32;
+	*req = (request >> 28) & 0xf;
+	*length = (request >> 4) & 0xffffff;
+	*flags = (request >> 1) & 0x7;
+	*res = request & 0x1;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_mark
+// Description  : Note a range of the store as written, to be synced by the
+//                next CRUD_CLOSE (overlapping or touching ranges are merged,
+//                and once out of ranges all of them are)
+//
+// Inputs       : off - the file offset written
+//                len - the bytes written
+// Outputs      : none
+
+void crud_store_mark(uint64_t off, uint64_t len) {
+	uint64_t start = off & ~(uint64_t)(CRUD_STORE_PAGE - 1);
+	uint64_t end = (off + len + CRUD_STORE_PAGE - 1) & ~(uint64_t)(CRUD_STORE_PAGE - 1);
+	CrudStoreDirty *rng;
+	int i;
+
+	if (len == 0)
+		return;
+
+	// Newest first, as writes tend to follow on from the last one
+	for (i = crud_store_ndirty - 1; i >= 0; i--) {
+		rng = &crud_store_dirty[i];
+		if (start <= rng->end && end >= rng->start) {
+			rng->start = (start < rng->start) ? start : rng->start;
+			rng->end = (end > rng->end) ? end : rng->end;
+			return;
+		}
+	}
+
+	if (crud_store_ndirty == CRUD_STORE_DIRTY_RANGES) {
+		rng = &crud_store_dirty[0];
+		for (i = 1; i < crud_store_ndirty; i++) {
+			rng->start = (crud_store_dirty[i].start < rng->start) ? crud_store_dirty[i].start : rng->start;
+			rng->end = (crud_store_dirty[i].end > rng->end) ? crud_store_dirty[i].end : rng->end;
+		}
+		crud_store_ndirty = 1;
+		crud_store_mark(off, len);
+		return;
+	}
+	crud_store_dirty[crud_store_ndirty].start = start;
+	crud_store_dirty[crud_store_ndirty++].end = end;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_sync
+// Description  : Write the dirty ranges of the store, then its superblock,
+//                back to the store file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_sync(void) {
+	uint64_t end;
+	int i, ret = 0;
+
+	for (i = 0; i < crud_store_ndirty; i++) {
+		end = (crud_store_dirty[i].end < crud_store_map_size) ? crud_store_dirty[i].end : crud_store_map_size;
+		if (crud_store_dirty[i].start < end && msync(&crud_store_map[crud_store_dirty[i].start],
+				end - crud_store_dirty[i].start, MS_SYNC))
+			ret = -1;
+	}
+	crud_store_ndirty = 0;
+	if (msync(crud_store_map, CRUD_STORE_SUPER_SIZE, MS_SYNC))
+		ret = -1;
+
+	if (ret)
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Sync of [%s] failed.", crud_store_path);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_grow
+// Description  : Grow the store file (doubling) and its mapping
+//
+// Inputs       : size - the size the store must reach
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_grow(uint64_t size) {
+	uint64_t grown = crud_store_map_size;
+	void *map;
+
+	if (size <= grown)
+		return (0);
+
+	while (grown < size)
+		grown *= 2;
+	if (ftruncate(crud_store_fd, grown) ||
+			(map = mremap(crud_store_map, crud_store_map_size, grown, MREMAP_MAYMOVE)) == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to grow [%s] to %lu bytes.", crud_store_path, grown);
+		return (-1);
+	}
+	crud_store_map = map;
+	crud_store_map_size = grown;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_class
+// Description  : Find the region class holding a number of bytes
+//
+// Inputs       : size - the bytes to hold
+// Outputs      : the class (regions of 1 << (class + CRUD_STORE_MIN_SHIFT))
+
+int crud_store_class(uint64_t size) {
+	int cls = 0;
+
+	while (((uint64_t)1 << (cls + CRUD_STORE_MIN_SHIFT)) < size)
+		cls++;
+	return (cls);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_region_alloc
+// Description  : Hand out a region of the store, from the free list of its
+//                class or else from the end of the regions (the mapping may
+//                move, so pointers into it must be found again after)
+//
+// Inputs       : size - the bytes the region must hold
+//                off - the file offset of the region (set)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_region_alloc(uint64_t size, uint64_t *off) {
+	int cls = crud_store_class(size);
+
+	if (cls >= CRUD_STORE_CLASSES) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Region too large [%lu].", size);
+		return (-1);
+	}
+
+	if (CRUD_STORE_SUPER->free[cls] != 0) {
+		*off = CRUD_STORE_SUPER->free[cls];
+		CRUD_STORE_SUPER->free[cls] = *(uint64_t *)&crud_store_map[*off];
+		return (0);
+	}
+	if (crud_store_grow(CRUD_STORE_SUPER->heap_end + ((uint64_t)1 << (cls + CRUD_STORE_MIN_SHIFT))))
+		return (-1);
+	*off = CRUD_STORE_SUPER->heap_end;
+	CRUD_STORE_SUPER->heap_end += (uint64_t)1 << (cls + CRUD_STORE_MIN_SHIFT);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_region_free
+// Description  : Put a region back on the free list of its class
+//
+// Inputs       : off - the file offset of the region
+//                size - the bytes it was handed out for
+// Outputs      : none
+
+void crud_store_region_free(uint64_t off, uint64_t size) {
+	int cls = crud_store_class(size);
+
+	*(uint64_t *)&crud_store_map[off] = CRUD_STORE_SUPER->free[cls];
+	CRUD_STORE_SUPER->free[cls] = off;
+	crud_store_mark(off, sizeof(uint64_t));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_format
+// Description  : Empty the store, dropping the payloads from the file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_format(void) {
+	void *map;
+
+	if (ftruncate(crud_store_fd, 0) || ftruncate(crud_store_fd, CRUD_STORE_MAP_INITIAL) ||
+			(map = mremap(crud_store_map, crud_store_map_size, CRUD_STORE_MAP_INITIAL,
+			MREMAP_MAYMOVE)) == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to format [%s].", crud_store_path);
+		return (-1);
+	}
+	crud_store_map = map;
+	crud_store_map_size = CRUD_STORE_MAP_INITIAL;
+	crud_store_ndirty = 0;
+
+	// The file reads back as zeros, so only the fixed fields need setting
+	CRUD_STORE_SUPER->magic = CRUD_STORE_MAP_MAGIC;
+	CRUD_STORE_SUPER->version = CRUD_STORE_MAP_VERSION;
+	CRUD_STORE_SUPER->next_oid = CRUD_STORE_FIRST_OID;
+	CRUD_STORE_SUPER->heap_end = CRUD_STORE_SUPER_SIZE;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_close
+// Description  : Sync and unmap the store
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_close(void) {
+	int ret = 0;
+
+	if (crud_store_map != NULL) {
+		ret = crud_store_sync();
+		munmap(crud_store_map, crud_store_map_size);
+		close(crud_store_fd);
+	}
+	crud_store_map = NULL;
+	crud_store_map_size = 0;
+	crud_store_fd = -1;
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_open
+// Description  : Map the store file, creating an empty store if there is
+//                none and importing a saved one left by crud_save_store
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_open(void) {
+	char saved[PATH_MAX];
+	CrudStoreHeader hdr;
+	struct stat st;
+	uint64_t size;
+	void *map;
+	int fd;
+
+	if ((fd = open(crud_store_path, O_RDWR | O_CREAT, 0600)) == -1 || fstat(fd, &st)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to open [%s].", crud_store_path);
+		if (fd != -1)
+			close(fd);
+		return (-1);
+	}
+
+	// A saved store moves aside and is loaded into a new one
+	if (st.st_size >= sizeof(hdr) && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+			hdr.magic == CRUD_STORE_MAGIC) {
+		close(fd);
+		snprintf(saved, sizeof(saved), "%s.sav", crud_store_path);
+		if (rename(crud_store_path, saved) || crud_store_open())
+			return (-1);
+		if (crud_load_store(saved)) {
+			crud_store_close();
+			return (-1);
+		}
+		unlink(saved);
+		return (0);
+	}
+
+	size = st.st_size ? st.st_size : CRUD_STORE_MAP_INITIAL;
+	if ((st.st_size == 0 && ftruncate(fd, size)) ||
+			(map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to map [%s].", crud_store_path);
+		close(fd);
+		return (-1);
+	}
+	crud_store_fd = fd;
+	crud_store_map = map;
+	crud_store_map_size = size;
+	if (st.st_size == 0)
+		return (crud_store_format());
+
+	// Only the superblock is checked, the index and payloads are read as used
+	if (size < CRUD_STORE_SUPER_SIZE || CRUD_STORE_SUPER->magic != CRUD_STORE_MAP_MAGIC ||
+			CRUD_STORE_SUPER->version != CRUD_STORE_MAP_VERSION ||
+			CRUD_STORE_SUPER->heap_end < CRUD_STORE_SUPER_SIZE || CRUD_STORE_SUPER->heap_end > size ||
+			CRUD_STORE_SUPER->index + (uint64_t)CRUD_STORE_SUPER->index_size *
+			sizeof(CrudStoreObject) > CRUD_STORE_SUPER->heap_end) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : [%s] is not an object store.", crud_store_path);
+		crud_store_close();
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_entry
+// Description  : Find the index entry of an OID
+//
+// Inputs       : oid - the object identifier (within the index)
+// Outputs      : the entry
+
+CrudStoreObject *crud_store_entry(CrudOID oid) {
+	return (&((CrudStoreObject *)&crud_store_map[CRUD_STORE_SUPER->index])[oid - CRUD_STORE_FIRST_OID]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_reserve
+// Description  : Grow the index (doubling, into a new region) to hold an OID
+//
+// Inputs       : oid - the OID to make room for
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_reserve(CrudOID oid) {
+	uint32_t size, old = CRUD_STORE_SUPER->index_size;
+	uint64_t index;
+
+	if (oid - CRUD_STORE_FIRST_OID < old)
+		return (0);
+
+	size = old ? old : CRUD_STORE_INDEX_INITIAL;
+	while (size <= oid - CRUD_STORE_FIRST_OID)
+		size *= 2;
+	if (crud_store_region_alloc((uint64_t)size * sizeof(CrudStoreObject), &index)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to grow index to %u objects.", size);
+		return (-1);
+	}
+	memcpy(&crud_store_map[index], &crud_store_map[CRUD_STORE_SUPER->index], old * sizeof(CrudStoreObject));
+	memset(&crud_store_map[index + old * sizeof(CrudStoreObject)], 0x0, (size - old) * sizeof(CrudStoreObject));
+	if (old)
+		crud_store_region_free(CRUD_STORE_SUPER->index, old * sizeof(CrudStoreObject));
+	CRUD_STORE_SUPER->index = index;
+	CRUD_STORE_SUPER->index_size = size;
+	crud_store_mark(index, (uint64_t)size * sizeof(CrudStoreObject));
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_object
+// Description  : Find an existing object
+//
+// Inputs       : oid - the object identifier
+//                flags - the request flags (CRUD_PRIORITY_OBJECT)
+// Outputs      : the object, or NULL if it does not exist
+
+CrudStoreObject *crud_store_object(CrudOID oid, uint8_t flags) {
+	CrudStoreObject *obj;
+
+	if (flags & CRUD_PRIORITY_OBJECT)
+		obj = &CRUD_STORE_SUPER->priority;
+	else if (oid < CRUD_STORE_FIRST_OID || oid - CRUD_STORE_FIRST_OID >= CRUD_STORE_SUPER->index_size)
+		return (NULL);
+	else
+		obj = crud_store_entry(oid);
+	return (obj->live ? obj : NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_put
+// Description  : Add an object to the store, handing out its payload
+//
+// Inputs       : oid - the object identifier
+//                flags - the request flags (CRUD_PRIORITY_OBJECT)
+//                length - the object length
+// Outputs      : the payload to fill in, or NULL if failure
+
+char *crud_store_put(CrudOID oid, uint8_t flags, uint32_t length) {
+	CrudStoreObject *obj;
+	uint64_t off;
+
+	if ((!(flags & CRUD_PRIORITY_OBJECT) && crud_store_reserve(oid)) ||
+			crud_store_region_alloc(length, &off)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Payload allocation failed [%u].", length);
+		return (NULL);
+	}
+
+	// Found once the room is made, as the mapping may have moved
+	obj = (flags & CRUD_PRIORITY_OBJECT) ? &CRUD_STORE_SUPER->priority : crud_store_entry(oid);
+	obj->offset = off;
+	obj->length = length;
+	obj->live = 1;
+	CRUD_STORE_SUPER->objects++;
+	crud_store_mark((char *)obj - crud_store_map, sizeof(CrudStoreObject));
+	crud_store_mark(off, length);
+	return (&crud_store_map[off]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_create
+// Description  : Create an object with the contents of the buffer
+//
+// Inputs       : length - the object length
+//                flags - the request flags
+//                buf - the object contents
+// Outputs      : the response
+
+CrudResponse crud_store_create(uint32_t length, uint8_t flags, void *buf) {
+	CrudOID oid = CRUD_NO_OBJECT;
+	char *data;
+
+	if (length > CRUD_MAX_OBJECT_SIZE) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Create too large [%u].", length);
+		return (construct_crud_request(oid, CRUD_CREATE, 0, flags, 1));
+	}
+
+	if (flags & CRUD_PRIORITY_OBJECT) {
+		if (CRUD_STORE_SUPER->priority.live) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD store : Priority object already exists.");
+			return (construct_crud_request(oid, CRUD_CREATE, 0, flags, 1));
+		}
+	} else {
+		oid = CRUD_STORE_SUPER->next_oid;
+	}
+
+	if ((data = crud_store_put(oid, flags, length)) == NULL)
+		return (construct_crud_request(CRUD_NO_OBJECT, CRUD_CREATE, 0, flags, 1));
+	memcpy(data, buf, length);
+	if (oid != CRUD_NO_OBJECT)
+		CRUD_STORE_SUPER->next_oid++;
+	return (construct_crud_request(oid, CRUD_CREATE, length, flags, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_read
+// Description  : Read an object (the whole of it, or a range)
+//
+// Inputs       : oid - the object identifier
+//                length - the buffer size (the range length if ranged)
+//                flags - the request flags
+//                buf - the buffer (a CrudStoreRange if ranged)
+// Outputs      : the response, whose length is the bytes read
+
+CrudResponse crud_store_read(CrudOID oid, uint32_t length, uint8_t flags, void *buf) {
+	CrudStoreObject *obj;
+	CrudStoreRange *rng = buf;
+
+	if ((obj = crud_store_object(oid, flags)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Read of missing object [%u].", oid);
+		return (construct_crud_request(oid, CRUD_READ, 0, flags, 1));
+	}
+
+	if (flags & CRUD_STORE_RANGED) {
+		if (rng->offset > obj->length) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD store : Read past end of object [%u].", oid);
+			return (construct_crud_request(oid, CRUD_READ, 0, flags, 1));
+		}
+		if (length > obj->length - rng->offset)
+			length = obj->length - rng->offset;
+		memcpy(rng->data, &crud_store_map[obj->offset + rng->offset], length);
+		return (construct_crud_request(oid, CRUD_READ, length, flags, 0));
+	}
+
+	if (length < obj->length) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Read buffer too small [OID %u, %u<%u].",
+			oid, length, obj->length);
+		return (construct_crud_request(oid, CRUD_READ, 0, flags, 1));
+	}
+	memcpy(buf, &crud_store_map[obj->offset], obj->length);
+	return (construct_crud_request(oid, CRUD_READ, obj->length, flags, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_update
+// Description  : Replace the contents of an object (the whole of it, with
+//                the same length, or a range within it)
+//
+// Inputs       : oid - the object identifier
+//                length - the object length (the range length if ranged)
+//                flags - the request flags
+//                buf - the contents (a CrudStoreRange if ranged)
+// Outputs      : the response
+
+CrudResponse crud_store_update(CrudOID oid, uint32_t length, uint8_t flags, void *buf) {
+	CrudStoreObject *obj;
+	CrudStoreRange *rng = buf;
+
+	if ((obj = crud_store_object(oid, flags)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Update of missing object [%u].", oid);
+		return (construct_crud_request(oid, CRUD_UPDATE, 0, flags, 1));
+	}
+
+	if (flags & CRUD_STORE_RANGED) {
+		if (rng->offset > obj->length || length > obj->length - rng->offset) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD store : Update past end of object [%u].", oid);
+			return (construct_crud_request(oid, CRUD_UPDATE, 0, flags, 1));
+		}
+		memcpy(&crud_store_map[obj->offset + rng->offset], rng->data, length);
+		crud_store_mark(obj->offset + rng->offset, length);
+		return (construct_crud_request(oid, CRUD_UPDATE, length, flags, 0));
+	}
+
+	if (length != obj->length) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Update length mismatch [OID %u, %u!=%u].",
+			oid, length, obj->length);
+		return (construct_crud_request(oid, CRUD_UPDATE, 0, flags, 1));
+	}
+	memcpy(&crud_store_map[obj->offset], buf, length);
+	crud_store_mark(obj->offset, length);
+	return (construct_crud_request(oid, CRUD_UPDATE, length, flags, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_delete
+// Description  : Delete an object (its OID is never handed out again)
+//
+// Inputs       : oid - the object identifier
+//                flags - the request flags
+// Outputs      : the response
+
+CrudResponse crud_store_delete(CrudOID oid, uint8_t flags) {
+	CrudStoreObject *obj;
+
+	if ((obj = crud_store_object(oid, flags)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Delete of missing object [%u].", oid);
+		return (construct_crud_request(oid, CRUD_DELETE, 0, flags, 1));
+	}
+	crud_store_region_free(obj->offset, obj->length);
+	memset(obj, 0x0, sizeof(CrudStoreObject));
+	CRUD_STORE_SUPER->objects--;
+	crud_store_mark((char *)obj - crud_store_map, sizeof(CrudStoreObject));
+	return (construct_crud_request(oid, CRUD_DELETE, 0, flags, 0));
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bus_request
+// Description  : Carry out a request on the store
+//
+// Inputs       : request - the request
+//                buf - the request data
+// Outputs      : the response
+
+CrudResponse crud_bus_request(CrudRequest request, void *buf) {
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+	CrudOID oid;
+
+	deconstruct_crud_request(request, &oid, &req, &length, &flags, &res);
+	if (req != CRUD_INIT && !crud_store_initialized) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Request before CRUD_INIT.");
+		return (construct_crud_request(oid, req, 0, flags, 1));
+	}
+
+	switch (req) {
+
+	case CRUD_INIT: // Map the store, made empty if there is none
+		if (!crud_store_initialized) {
+			if (crud_store_open())
+				return (construct_crud_request(oid, req, 0, flags, 1));
+			crud_store_initialized = 1;
+			logMessage(LOG_INFO_LEVEL, "CRUD store : Object store mapped [%s, %lu objects, first OID %u].",
+				crud_store_path, CRUD_STORE_SUPER->objects, CRUD_STORE_FIRST_OID);
+		}
+		return (construct_crud_request(CRUD_NO_OBJECT, req, 0, flags, 0));
+
+	case CRUD_FORMAT:
+		if (crud_store_format())
+			return (construct_crud_request(CRUD_NO_OBJECT, req, 0, flags, 1));
+		return (construct_crud_request(CRUD_NO_OBJECT, req, 0, flags, 0));
+
+	case CRUD_CREATE:
+		return (crud_store_create(length, flags, buf));
+
+	case CRUD_READ:
+		return (crud_store_read(oid, length, flags, buf));
+
+	case CRUD_UPDATE:
+		return (crud_store_update(oid, length, flags, buf));
+
+	case CRUD_DELETE:
+		return (crud_store_delete(oid, flags));
+
+	case CRUD_CLOSE: // Sync the store, which stays usable
+		if (crud_store_sync())
+			return (construct_crud_request(CRUD_NO_OBJECT, req, 0, flags, 1));
+		return (construct_crud_request(CRUD_NO_OBJECT, req, 0, flags, 0));
+
+	default:
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unknown request type (%d).", req);
+		return (construct_crud_request(oid, req, 0, flags, 1));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_store
+// Description  : Write a copy of the contents of the store to a file
+//
+// Inputs       : fname - the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_save_store(char *fname) {
+	CrudStoreHeader hdr = { CRUD_STORE_MAGIC, CRUD_STORE_VERSION, 0, 0 };
+	CrudStoreEntry ent;
+	CrudStoreObject *obj;
+	uint32_t i, size;
+	FILE *fh;
+
+	if (crud_store_map == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Save before CRUD_INIT.");
+		return (-1);
+	}
+	if ((fh = fopen(fname, "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to open [%s] for writing.", fname);
+		return (-1);
+	}
+
+	// The object count is filled in once known
+	hdr.next_oid = CRUD_STORE_SUPER->next_oid;
+	size = CRUD_STORE_SUPER->index_size;
+	fwrite(&hdr, sizeof(hdr), 1, fh);
+	for (i = 0; i <= size; i++) {
+		obj = (i < size) ? crud_store_entry(i + CRUD_STORE_FIRST_OID) : &CRUD_STORE_SUPER->priority;
+		if (!obj->live)
+			continue;
+		ent.oid = (i < size) ? i + CRUD_STORE_FIRST_OID : CRUD_NO_OBJECT;
+		ent.length = obj->length;
+		fwrite(&ent, sizeof(ent), 1, fh);
+		fwrite(&crud_store_map[obj->offset], 1, obj->length, fh);
+		hdr.nobjects++;
+	}
+	fseek(fh, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, fh);
+
+	if (ferror(fh) | fclose(fh)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Write of [%s] failed.", fname);
+		return (-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "CRUD store : Saved %u objects to [%s].", hdr.nobjects, fname);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_store
+// Description  : Replace the contents of the store with those of a file
+//                written by crud_save_store
+//
+// Inputs       : fname - the file to read
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_load_store(char *fname) {
+	CrudStoreHeader hdr;
+	CrudStoreEntry ent;
+	uint8_t flags;
+	uint32_t i;
+	char *data;
+	FILE *fh;
+
+	if (crud_store_map == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Load before CRUD_INIT.");
+		return (-1);
+	}
+	if ((fh = fopen(fname, "r")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : Unable to open [%s] for reading.", fname);
+		return (-1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fh) != 1 || hdr.magic != CRUD_STORE_MAGIC ||
+			hdr.version != CRUD_STORE_VERSION || crud_store_format()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : [%s] is not a saved store.", fname);
+		fclose(fh);
+		return (-1);
+	}
+
+	for (i = 0; i < hdr.nobjects; i++) {
+		if (fread(&ent, sizeof(ent), 1, fh) != 1 || ent.length > CRUD_MAX_OBJECT_SIZE ||
+				(ent.oid != CRUD_NO_OBJECT && (ent.oid < CRUD_STORE_FIRST_OID ||
+				ent.oid >= hdr.next_oid))) {
+			break;
+		}
+		flags = (ent.oid == CRUD_NO_OBJECT) ? CRUD_PRIORITY_OBJECT : 0;
+		if (crud_store_object(ent.oid, flags) != NULL ||
+				(data = crud_store_put(ent.oid, flags, ent.length)) == NULL ||
+				fread(data, 1, ent.length, fh) != ent.length)
+			break;
+	}
+	fclose(fh);
+
+	if (i < hdr.nobjects) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD store : [%s] is damaged at object %u.", fname, i);
+		crud_store_format();
+		return (-1);
+	}
+	CRUD_STORE_SUPER->next_oid = hdr.next_oid;
+	logMessage(LOG_INFO_LEVEL, "CRUD store : Loaded %u objects from [%s].", hdr.nobjects, fname);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_check
+// Description  : Check that an object holds the expected contents
+//
+// Inputs       : oid - the object identifier
+//                flags - the request flags
+//                data - the expected contents
+//                length - the expected length
+// Outputs      : 0 if it does, -1 if not
+
+int crud_store_check(CrudOID oid, uint8_t flags, char *data, uint32_t length) {
+	char buf[CRUD_STORE_UNIT_TEST_MAX_SIZE];
+	CrudResponse response;
+
+	response = crud_bus_request(construct_crud_request(oid, CRUD_READ,
+		sizeof(buf), flags, 0), buf);
+	if ((response & 0x1) || ((response >> 4) & 0xffffff) != length ||
+			memcmp(buf, data, length)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_STORE_UNIT_TEST : Object %u does not match.", oid);
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_unit_test
+// Description  : Run random requests against a scratch store, checking
+//                every object against a private copy, then save and reload
+//                it and unmap and remount it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_unit_test(void) {
+	CrudOID oids[CRUD_STORE_UNIT_TEST_OBJECTS];
+	uint32_t lens[CRUD_STORE_UNIT_TEST_OBJECTS];
+	char *copies[CRUD_STORE_UNIT_TEST_OBJECTS], buf[CRUD_STORE_UNIT_TEST_MAX_SIZE];
+	uint32_t count = 0, i, obj, len, off;
+	CrudStoreRange rng;
+	CrudResponse response;
+	int ret = -1, mounted = crud_store_initialized;
+
+	// The test gets a store file of its own, the mounted one is put back after
+	logMessage(LOG_INFO_LEVEL, "CRUD_STORE_UNIT_TEST : Starting store unit test.");
+	crud_store_close();
+	crud_store_initialized = 0;
+	crud_store_path = CRUD_STORE_UNIT_TEST_FILE;
+	unlink(CRUD_STORE_UNIT_TEST_FILE);
+	if ((crud_bus_request(construct_crud_request(0, CRUD_INIT, 0, 0, 0), NULL) & 0x1) ||
+			(crud_bus_request(construct_crud_request(0, CRUD_FORMAT, 0, 0, 0), NULL) & 0x1))
+		goto done;
+
+	for (i = 0; i < CRUD_STORE_UNIT_TEST_ITERATIONS; i++) {
+		obj = count ? crud_rand_value(0, count - 1) : 0;
+
+		switch (count < CRUD_STORE_UNIT_TEST_OBJECTS / 2 ? 0 : crud_rand_value(0, 5)) {
+
+		case 0: // Create an object, if there is room
+			if (count == CRUD_STORE_UNIT_TEST_OBJECTS)
+				continue;
+			len = crud_rand_value(0, CRUD_STORE_UNIT_TEST_MAX_SIZE);
+			copies[count] = malloc(len ? len : 1);
+			memset(copies[count], crud_rand_value(0, 0xff), len);
+			response = crud_bus_request(construct_crud_request(0, CRUD_CREATE,
+				len, 0, 0), copies[count]);
+			if (response & 0x1) {
+				free(copies[count]);
+				goto done;
+			}
+			oids[count] = response >> 32;
+			lens[count++] = len;
+			break;
+
+		case 1: // Read it whole
+			if (crud_store_check(oids[obj], 0, copies[obj], lens[obj]))
+				goto done;
+			break;
+
+		case 2: // Update it whole
+			memset(copies[obj], crud_rand_value(0, 0xff), lens[obj]);
+			if (crud_bus_request(construct_crud_request(oids[obj], CRUD_UPDATE,
+					lens[obj], 0, 0), copies[obj]) & 0x1)
+				goto done;
+			break;
+
+		case 3: // Read a range
+			off = crud_rand_value(0, lens[obj]);
+			len = crud_rand_value(0, CRUD_STORE_UNIT_TEST_MAX_SIZE);
+			rng.offset = off;
+			rng.data = buf;
+			response = crud_bus_request(construct_crud_request(oids[obj], CRUD_READ,
+				len, CRUD_STORE_RANGED, 0), &rng);
+			if (len > lens[obj] - off)
+				len = lens[obj] - off;
+			if ((response & 0x1) || ((response >> 4) & 0xffffff) != len ||
+					memcmp(buf, &copies[obj][off], len)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_STORE_UNIT_TEST : Ranged read mismatch.");
+				goto done;
+			}
+			break;
+
+		case 4: // Update a range
+			off = crud_rand_value(0, lens[obj]);
+			len = crud_rand_value(0, lens[obj] - off);
+			memset(&copies[obj][off], crud_rand_value(0, 0xff), len);
+			rng.offset = off;
+			rng.data = &copies[obj][off];
+			if (crud_bus_request(construct_crud_request(oids[obj], CRUD_UPDATE,
+					len, CRUD_STORE_RANGED, 0), &rng) & 0x1)
+				goto done;
+			break;
+
+		default: // Delete it
+			if (crud_bus_request(construct_crud_request(oids[obj], CRUD_DELETE,
+					0, 0, 0), NULL) & 0x1)
+				goto done;
+			free(copies[obj]);
+			count--;
+			oids[obj] = oids[count];
+			lens[obj] = lens[count];
+			copies[obj] = copies[count];
+			break;
+		}
+	}
+
+	// The priority object lives apart from the others
+	memset(buf, 0x5a, 64);
+	if ((crud_bus_request(construct_crud_request(0, CRUD_CREATE, 64,
+			CRUD_PRIORITY_OBJECT, 0), buf) & 0x1) ||
+			crud_store_check(0, CRUD_PRIORITY_OBJECT, buf, 64))
+		goto done;
+
+	// Everything survives a save, format and load
+	if (crud_save_store(CRUD_STORE_UNIT_TEST_SAVE) ||
+			(crud_bus_request(construct_crud_request(0, CRUD_FORMAT, 0, 0, 0), NULL) & 0x1) ||
+			crud_load_store(CRUD_STORE_UNIT_TEST_SAVE))
+		goto done;
+	for (i = 0; i < count; i++) {
+		if (crud_store_check(oids[i], 0, copies[i], lens[i]))
+			goto done;
+	}
+	if (crud_store_check(0, CRUD_PRIORITY_OBJECT, buf, 64))
+		goto done;
+
+	// And an unmap and remount, the objects being read from the file
+	if ((crud_bus_request(construct_crud_request(0, CRUD_CLOSE, 0, 0, 0), NULL) & 0x1) ||
+			crud_store_close())
+		goto done;
+	crud_store_initialized = 0;
+	if (crud_bus_request(construct_crud_request(0, CRUD_INIT, 0, 0, 0), NULL) & 0x1)
+		goto done;
+	for (i = 0; i < count; i++) {
+		if (crud_store_check(oids[i], 0, copies[i], lens[i]))
+			goto done;
+	}
+	if (crud_store_check(0, CRUD_PRIORITY_OBJECT, buf, 64))
+		goto done;
+	ret = 0;
+
+done:
+	crud_store_close();
+	crud_store_initialized = 0;
+	unlink(CRUD_STORE_UNIT_TEST_FILE);
+	unlink(CRUD_STORE_UNIT_TEST_SAVE);
+	crud_store_path = CRUD_STORE_FILE;
+	if (mounted && crud_store_open() == 0)
+		crud_store_initialized = 1;
+	for (i = 0; i < count; i++)
+		free(copies[i]);
+	if (ret == 0)
+		logMessage(LOG_INFO_LEVEL, "CRUD_STORE_UNIT_TEST : Store unit test completed successfully.");
+	else
+		logMessage(LOG_ERROR_LEVEL, "CRUD_STORE_UNIT_TEST : Store unit test failed.");
+	return (ret);
+}
@@ -0,0 +1,43 @@
+#ifndef CRUD_STORE_INCLUDED
+#define CRUD_STORE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_store.h
+//  Description    : This is the header file for the in-tree CRUD object
+//                   store, a source level stand-in for libcrud's driver that
+//                   implements the crud_driver.h interface.  It is linked in
+//                   place of the library driver by the crud_sim_local target.
+//                   The store lives in a memory mapped file: a superblock,
+//                   an index of the objects by OID and their payloads.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Fri Jun  2 14:31:08 PDT 2017
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_STORE_FILE "crud_local.crd" // The mapped store (CRUD_CLOSE syncs it)
+#define CRUD_STORE_FIRST_OID 4096        // The first OID handed out
+#define CRUD_STORE_RANGED 0x2            // Flag selecting a ranged READ/UPDATE
+
+// The buffer of a ranged READ or UPDATE (CRUD_STORE_RANGED flag), whose
+// request length is the number of bytes from "offset" to read or write
+typedef struct {
+	uint32_t  offset; // The object offset of the range
+	void     *data;   // The bytes of the range
+} CrudStoreRange;
+
+//
+// The store implements the crud_driver.h interface (crud_bus_request,
+// crud_save_store, crud_load_store and crud_unit_test).  Callers must
+// serialize their requests, as the batching layer does.  CRUD_INIT maps
+// the store without reading the payloads, which are paged in as used, and
+// crud_save_store/crud_load_store export and import a copy of it.
+
+#endif
@@ -0,0 +1,436 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_trace.c
+//  Description    : This is the implementation of the CRUD bus trace.  The
+//                   records are kept in a ring of CRUD_TRACE_RING_RECORDS
+//                   entries that is written to the trace file whenever it
+//                   fills, and once more when the trace is closed.  The
+//                   report reads a trace back and compares the bytes the
+//                   file calls asked for with the bytes moved on the bus.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Mon May 15 09:12:44 PDT 2017
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_trace.h>
+#include <crud_stats.h>
+#include <cmpsc311_log.h>
+#include <crud_log.h>
+
+// Type definitions
+
+// The totals of one file in a trace report
+typedef struct {
+	char     *name;        // The file name (NULL if unknown)
+	uint64_t  written;     // Bytes the file calls wrote
+	uint64_t  read;        // Bytes the file calls read
+	uint64_t  bus_out;     // Bytes sent on the bus
+	uint64_t  bus_in;      // Bytes returned on the bus
+	uint64_t  requests;    // Bus requests
+	uint64_t  rmw_in;      // Bytes returned during write calls (read-modify-write)
+} CrudTraceFile;
+
+// Trace Static Data
+int crud_trace_enabled = 0;   // Flag indicating requests are being traced
+int crud_trace_fd = -1;       // The trace file
+CrudTraceRecord crud_trace_ring[CRUD_TRACE_RING_RECORDS]; // The records not yet written
+uint32_t crud_trace_count = 0; // The number of records in the ring
+uint64_t crud_trace_total = 0; // The number of records written to the file
+char **crud_trace_names = NULL; // The name of each traced file handle
+int32_t crud_trace_nnames = 0;  // The size of the name array
+pthread_mutex_t crud_trace_lock = PTHREAD_MUTEX_INITIALIZER; // Guards all of the above
+
+// Pick up these definitions from the unit test of the crud driver
+int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
+		CRUD_REQUEST_TYPES *req, uint32_t *length, uint8_t *flags,
+		uint8_t *res);
+
+//
+// Module local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_write
+// Description  : Write a buffer to the trace file
+//
+// Inputs       : buf - the data to write
+//                len - the length of the data
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_trace_write(const void *buf, size_t len) {
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(crud_trace_fd, p, len)) < 0) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : Trace write failed.");
+			return (-1);
+		}
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_drain
+// Description  : Write the ring out to the trace file (the trace lock is
+//                held), turning tracing off on failure
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_trace_drain(void) {
+	if (crud_trace_write(crud_trace_ring, crud_trace_count * sizeof(CrudTraceRecord))) {
+		crud_trace_enabled = 0;
+		return (-1);
+	}
+	crud_trace_total += crud_trace_count;
+	crud_trace_count = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_append
+// Description  : Add a record to the ring, draining it when full
+//
+// Inputs       : rec - the record to add
+// Outputs      : none
+
+void crud_trace_append(CrudTraceRecord *rec) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	pthread_mutex_lock(&crud_trace_lock);
+	if (crud_trace_enabled) {
+		crud_trace_ring[crud_trace_count++] = *rec;
+		if (crud_trace_count == CRUD_TRACE_RING_RECORDS)
+			crud_trace_drain();
+	}
+	pthread_mutex_unlock(&crud_trace_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_file_entry
+// Description  : Find the report totals of a file, growing the array as needed
+//
+// Inputs       : files - the totals array (index 0 is "no file")
+//                nfiles - the size of the array
+//                file - the file handle
+// Outputs      : the totals, or NULL if failure
+
+CrudTraceFile *crud_trace_file_entry(CrudTraceFile **files, int32_t *nfiles, int32_t file) {
+	CrudTraceFile *grown;
+	int32_t idx = file + 1, size;
+
+	if (idx < 0)
+		return (NULL);
+	if (idx >= *nfiles) {
+		size = (idx + 1) * 2;
+		if ((grown = realloc(*files, size * sizeof(CrudTraceFile))) == NULL)
+			return (NULL);
+		memset(&grown[*nfiles], 0x0, (size - *nfiles) * sizeof(CrudTraceFile));
+		*files = grown;
+		*nfiles = size;
+	}
+	return (&(*files)[idx]);
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_open
+// Description  : Start tracing to a file, which is truncated
+//
+// Inputs       : path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_trace_open(const char *path) {
+	CrudTraceHeader hdr;
+
+	pthread_mutex_lock(&crud_trace_lock);
+	if ((crud_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : Unable to open trace [%s].", path);
+		pthread_mutex_unlock(&crud_trace_lock);
+		return (-1);
+	}
+
+	// The header is rewritten with the counts on close
+	memset(&hdr, 0x0, sizeof(hdr));
+	if (crud_trace_write(&hdr, sizeof(hdr))) {
+		close(crud_trace_fd);
+		crud_trace_fd = -1;
+		pthread_mutex_unlock(&crud_trace_lock);
+		return (-1);
+	}
+	crud_trace_count = 0;
+	crud_trace_total = 0;
+	crud_trace_enabled = 1;
+	pthread_mutex_unlock(&crud_trace_lock);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_request
+// Description  : Record a bus request and its response
+//
+// Inputs       : request - the request sent
+//                response - the response received
+//                caller - the file IO call that made it
+//                file - the file handle it was for
+// Outputs      : none
+
+void crud_trace_request(CrudRequest request, CrudResponse response, uint8_t caller, int32_t file) {
+	CrudTraceRecord rec;
+	CRUD_REQUEST_TYPES req, rreq;
+	uint32_t length, rlength;
+	uint8_t flags, res;
+	CrudOID oid, roid;
+
+	if (!crud_trace_enabled)
+		return;
+
+	deconstruct_crud_request(request, &oid, &req, &length, &flags, &res);
+	deconstruct_crud_request(response, &roid, &rreq, &rlength, &flags, &res);
+	rec.oid = (req == CRUD_CREATE) ? roid : oid;
+	rec.length = (req == CRUD_READ) ? rlength : length;
+	rec.file = file;
+	rec.type = req;
+	rec.flags = flags;
+	rec.result = response & 0x1;
+	rec.caller = caller;
+	crud_trace_append(&rec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_call
+// Description  : Record the bytes a file call read or wrote
+//
+// Inputs       : caller - the file IO call
+//                file - the file handle
+//                bytes - the bytes read or written
+// Outputs      : none
+
+void crud_trace_call(uint8_t caller, int32_t file, int32_t bytes) {
+	CrudTraceRecord rec;
+
+	if (!crud_trace_enabled || bytes <= 0)
+		return;
+
+	memset(&rec, 0x0, sizeof(rec));
+	rec.length = bytes;
+	rec.file = file;
+	rec.type = CRUD_TRACE_FILE_CALL;
+	rec.caller = caller;
+	crud_trace_append(&rec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_name
+// Description  : Record the name of a file handle (the last one given wins)
+//
+// Inputs       : file - the file handle
+//                path - the file name
+// Outputs      : none
+
+void crud_trace_name(int32_t file, const char *path) {
+	char **grown;
+	int32_t size;
+
+	if (!crud_trace_enabled || file < 0)
+		return;
+
+	pthread_mutex_lock(&crud_trace_lock);
+	if (file >= crud_trace_nnames) {
+		size = (file + 1) * 2;
+		if ((grown = realloc(crud_trace_names, size * sizeof(char *))) == NULL) {
+			pthread_mutex_unlock(&crud_trace_lock);
+			return;
+		}
+		memset(&grown[crud_trace_nnames], 0x0, (size - crud_trace_nnames) * sizeof(char *));
+		crud_trace_names = grown;
+		crud_trace_nnames = size;
+	}
+	free(crud_trace_names[file]);
+	crud_trace_names[file] = strdup(path);
+	pthread_mutex_unlock(&crud_trace_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_close
+// Description  : Write out the buffered records and the name table, then
+//                fill in the header and stop tracing
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_trace_close(void) {
+	CrudTraceHeader hdr;
+	CrudTraceName ent;
+	int32_t i, ret = 0;
+
+	pthread_mutex_lock(&crud_trace_lock);
+	if (crud_trace_fd < 0) {
+		pthread_mutex_unlock(&crud_trace_lock);
+		return (0);
+	}
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	if (!crud_trace_enabled || crud_trace_drain())
+		ret = -1;
+	hdr.magic = CRUD_TRACE_MAGIC;
+	hdr.version = CRUD_TRACE_VERSION;
+	hdr.nrecords = crud_trace_total;
+	hdr.names = sizeof(CrudTraceHeader) + crud_trace_total * sizeof(CrudTraceRecord);
+
+	for (i = 0; ret == 0 && i < crud_trace_nnames; i++) {
+		if (crud_trace_names[i] == NULL)
+			continue;
+		ent.file = i;
+		ent.length = strlen(crud_trace_names[i]);
+		ent.reserved = 0;
+		if (crud_trace_write(&ent, sizeof(ent)) || crud_trace_write(crud_trace_names[i], ent.length))
+			ret = -1;
+		hdr.nnames++;
+	}
+	if (ret == 0 && pwrite(crud_trace_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : Trace header write failed.");
+		ret = -1;
+	}
+
+	for (i = 0; i < crud_trace_nnames; i++)
+		free(crud_trace_names[i]);
+	free(crud_trace_names);
+	crud_trace_names = NULL;
+	crud_trace_nnames = 0;
+	close(crud_trace_fd);
+	crud_trace_fd = -1;
+	crud_trace_enabled = 0;
+	pthread_mutex_unlock(&crud_trace_lock);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_report
+// Description  : Summarize a trace, comparing per file the bytes the file
+//                calls read and wrote with the bytes moved on the bus
+//
+// Inputs       : path - the trace file
+//                out - where to write the report
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_trace_report(const char *path, FILE *out) {
+	CrudTraceHeader hdr;
+	CrudTraceRecord rec;
+	CrudTraceName ent;
+	CrudTraceFile *files = NULL, *f, total;
+	int32_t nfiles = 0, i, ret = -1;
+	uint64_t r;
+	int writing;
+	FILE *fh;
+
+	if ((fh = fopen(path, "r")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : Unable to open trace [%s].", path);
+		return (-1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fh) != 1 || hdr.magic != CRUD_TRACE_MAGIC ||
+			hdr.version != CRUD_TRACE_VERSION) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : [%s] is not a complete trace.", path);
+		fclose(fh);
+		return (-1);
+	}
+
+	// Add up the records by file
+	for (r = 0; r < hdr.nrecords; r++) {
+		if (fread(&rec, sizeof(rec), 1, fh) != 1 ||
+				(f = crud_trace_file_entry(&files, &nfiles, rec.file)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : Bad trace record %lu.", r);
+			goto done;
+		}
+		writing = (rec.caller == CRUD_CALL_WRITE || rec.caller == CRUD_CALL_PWRITE ||
+				rec.caller == CRUD_CALL_WRITEV);
+		if (rec.type == CRUD_TRACE_FILE_CALL) {
+			if (writing)
+				f->written += rec.length;
+			else
+				f->read += rec.length;
+			continue;
+		}
+		f->requests++;
+		if (rec.result)
+			continue;
+		if (rec.type == CRUD_CREATE || rec.type == CRUD_UPDATE) {
+			f->bus_out += rec.length;
+		} else if (rec.type == CRUD_READ) {
+			f->bus_in += rec.length;
+			f->rmw_in += writing ? rec.length : 0;
+		}
+	}
+
+	// Then the names
+	for (i = 0; i < hdr.nnames; i++) {
+		if (fread(&ent, sizeof(ent), 1, fh) != 1 ||
+				(f = crud_trace_file_entry(&files, &nfiles, ent.file)) == NULL ||
+				(f->name = calloc(ent.length + 1, 1)) == NULL ||
+				fread(f->name, 1, ent.length, fh) != ent.length) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_TRACE : Bad trace name table.");
+			goto done;
+		}
+	}
+
+	// One line per file, then the totals; the write amplification counts the
+	// bytes sent plus those read back to merge partial writes
+	memset(&total, 0x0, sizeof(total));
+	fprintf(out, "%-28s %10s %10s %10s %10s %8s %10s %7s\n", "file", "written",
+		"read", "bus out", "bus in", "requests", "rmw in", "w-amp");
+	for (i = 0; i <= nfiles; i++) {
+		f = (i < nfiles) ? &files[i] : &total;
+		if (i < nfiles && f->requests == 0 && f->written == 0 && f->read == 0)
+			continue;
+		fprintf(out, "%-28s %10lu %10lu %10lu %10lu %8lu %10lu ",
+			(i == nfiles) ? "(total)" : (i == 0) ? "(filesystem)" :
+			(f->name ? f->name : "(unnamed)"), f->written, f->read,
+			f->bus_out, f->bus_in, f->requests, f->rmw_in);
+		if (f->written)
+			fprintf(out, "%7.2f\n", (double)(f->bus_out + f->rmw_in) / f->written);
+		else
+			fprintf(out, "%7s\n", "-");
+		if (i < nfiles) {
+			total.written += f->written;
+			total.read += f->read;
+			total.bus_out += f->bus_out;
+			total.bus_in += f->bus_in;
+			total.requests += f->requests;
+			total.rmw_in += f->rmw_in;
+		}
+	}
+	ret = 0;
+
+done:
+	for (i = 0; i < nfiles; i++)
+		free(files[i].name);
+	free(files);
+	fclose(fh);
+	return (ret);
+}
@@ -0,0 +1,80 @@
+#ifndef CRUD_TRACE_INCLUDED
+#define CRUD_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_trace.h
+//  Description    : This is the header file for the CRUD bus trace, which
+//                   records every bus request (and the bytes each file call
+//                   asked for) in a binary file for later analysis.
+//
+//  Author         : Samuel Atkins
+//  Last Modified  : Mon May 15 09:12:44 PDT 2017
+//
+
+// Include files
+#include <stdio.h>
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_TRACE_MAGIC 0x32435254 // "TRC2", little endian (32 bit file handles)
+#define CRUD_TRACE_VERSION 2
+#define CRUD_TRACE_RING_RECORDS 4096 // Records buffered before a write to disk
+#define CRUD_TRACE_FILE_CALL 0xff    // Record type of a file call (not a bus request)
+#define CRUD_TRACE_NO_FILE -1        // Record file of requests outside any file
+
+// Trace file header, followed by the records and then the file names
+typedef struct {
+	uint32_t magic;    // CRUD_TRACE_MAGIC
+	uint32_t version;  // CRUD_TRACE_VERSION
+	uint64_t nrecords; // The number of records
+	uint64_t names;    // File offset of the name table
+	uint32_t nnames;   // The number of names in the name table
+	uint32_t reserved;
+} CrudTraceHeader;
+
+// A traced bus request or file call
+typedef struct {
+	uint64_t time;     // Monotonic time (ns)
+	uint32_t oid;      // The object of the request
+	uint32_t length;   // The request length (response length for a READ),
+	                   // or the bytes moved by a file call
+	int32_t  file;     // The file handle the request was for
+	uint8_t  type;     // The request type, or CRUD_TRACE_FILE_CALL
+	uint8_t  flags;    // The request flags
+	uint8_t  result;   // The R bit of the response
+	uint8_t  caller;   // The file IO call (CRUD_STATS_CALLERS)
+} CrudTraceRecord;
+
+// An entry of the name table
+typedef struct {
+	int32_t  file;     // The file handle
+	uint16_t length;   // The length of the name that follows
+	uint16_t reserved;
+} CrudTraceName;
+
+//
+// Trace interface
+
+int crud_trace_open(const char *path);
+	// Start tracing to the file "path"
+
+void crud_trace_request(CrudRequest request, CrudResponse response, uint8_t caller, int32_t file);
+	// Record a bus request and its response
+
+void crud_trace_call(uint8_t caller, int32_t file, int32_t bytes);
+	// Record the bytes a file call read or wrote
+
+void crud_trace_name(int32_t file, const char *path);
+	// Record the name of a file handle
+
+int crud_trace_close(void);
+	// Write out the buffered records and the name table, stop tracing
+
+int crud_trace_report(const char *path, FILE *out);
+	// Summarize logical vs. bus bytes per file of the trace "path"
+
+#endif